@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bench.h"
+
+/*
+   acgen: print a synthetic AC program, see GenParams in bench.h.
+
+   acgen [-d declarations] [-s statements] [-w width] [-e depth]
+         [-F float share] [-l identifier length] [-c constant share]
+         [-S seed] [target_file]
+*/
+
+static void usage( void )
+{
+    fprintf(stderr, "usage: acgen [-d declarations] [-s statements] [-w width] [-e depth] "
+                    "[-F floats] [-l idlength] [-c constants] [-S seed] [target_file]\n");
+    exit(2);
+}
+
+int main( int argc, char *argv[] )
+{
+    GenParams p;
+    FILE *out = stdout;
+    int c;
+
+    defaultGenParams(&p);
+    while((c = getopt(argc, argv, "d:s:w:e:F:l:c:S:")) != -1)
+        if(!parseGenOption(&p, c, optarg))
+            usage();
+    if(optind + 1 < argc)
+        usage();
+    if(optind < argc && (out = fopen(argv[optind], "w")) == NULL){
+        fprintf(stderr, "can't open the target file\n");
+        return 2;
+    }
+    generateProgram(out, &p);
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/header.h"
+#include "bench.h"
+
+/*
+   bench: time the phases of the compiler on synthetic programs.
+
+   bench [-r repetitions] [-o results.json] [-b baseline.json] [-t percent]
+         [generator options of acgen]
+
+   Every scale is one program of gen.c, compiled once to warm up and then
+   `repetitions` times by the phases of compileText at -O0: parser,
+   mybuild, mycheck and gencode, each timed on its own. Without
+   generator options the three scales below are run; with any, the one
+   program they describe. The results are written as JSON with the min,
+   median and mean of every phase.
+
+   Given a baseline, an earlier results file, the median of every phase is
+   compared with the one of the same scale there; the exit status is 1
+   when one is more than `percent` (10 by default) slower.
+*/
+
+#define MaxRepetitions 1000
+
+enum { Parser, Build, Check, Gencode, TimedPhases };
+static const char *phaseName[TimedPhases] = { "parser", "mybuild", "mycheck", "gencode" };
+
+typedef struct Scale{
+    const char *name;
+    GenParams params;
+    size_t bytes;
+    long long ns[TimedPhases][MaxRepetitions];
+}Scale;
+
+static long long now( void )
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compareNs( const void *a, const void *b )
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void usage( void )
+{
+    fprintf(stderr, "usage: bench [-r repetitions] [-o results.json] [-b baseline.json] [-t percent] "
+                    "[-d declarations] [-s statements] [-w width] [-e depth] "
+                    "[-F floats] [-l idlength] [-c constants] [-S seed]\n");
+    exit(2);
+}
+
+/* compile the program of the scale `repetitions` times */
+static void runScale( Scale *scale, int repetitions )
+{
+    Context ctx;
+    Program program;
+    HashMap *map;
+    FILE *source, *sink = fopen("/dev/null", "w");
+    char *text;
+    size_t len;
+    long long t[TimedPhases + 1];
+    int r, phase;
+
+    source = open_memstream(&text, &len);
+    generateProgram(source, &scale->params);
+    fclose(source);
+    scale->bytes = len;
+
+    ctx.diag = NULL;/* the conversions the checker reports are not timed */
+    enterContext(&ctx);
+    if(setjmp(ctx.fail)){
+        fprintf(stderr, "the %s program did not compile\n", scale->name);
+        exit(1);
+    }
+    for(r = -1; r < repetitions; r++){/* the first run only warms up */
+        source = fmemopen(text, len, "r");
+        t[Parser] = now();
+        program = parser(source);
+        t[Build] = now();
+        map = mybuild(program);
+        t[Check] = now();
+        mycheck(&program, map);
+        t[Gencode] = now();
+        gencode(program, sink);
+        fflush(sink);
+        t[TimedPhases] = now();
+        fclose(source);
+        FreeMap(map);
+        FreeProgram(&program);
+        for(phase = 0; phase < TimedPhases && r >= 0; phase++)
+            scale->ns[phase][r] = t[phase + 1] - t[phase];
+    }
+    enterContext(NULL);
+    fclose(sink);
+    free(text);
+}
+
+static void writeResults( FILE *out, Scale *scales, int count, int repetitions )
+{
+    GenParams *p;
+    long long sorted[MaxRepetitions], sum;
+    int s, phase, r;
+
+    fprintf(out, "{\n  \"benchmark\": \"phases\",\n  \"repetitions\": %d,\n  \"scales\": [\n", repetitions);
+    for(s = 0; s < count; s++){
+        p = &scales[s].params;
+        fprintf(out, "    {\"scale\": \"%s\", \"declarations\": %d, \"statements\": %d, \"width\": %d, "
+                     "\"depth\": %d, \"floats\": %.2f, \"idLength\": %d, \"constants\": %.2f, "
+                     "\"seed\": %lu, \"bytes\": %zu,\n     \"phases\": {\n",
+                scales[s].name, p->declarations, p->statements, p->width, p->depth,
+                p->floats, p->idLength, p->constants, p->seed, scales[s].bytes);
+        for(phase = 0; phase < TimedPhases; phase++){
+            memcpy(sorted, scales[s].ns[phase], repetitions * sizeof(long long));
+            qsort(sorted, repetitions, sizeof(long long), compareNs);
+            for(sum = 0, r = 0; r < repetitions; r++)
+                sum += sorted[r];
+            fprintf(out, "      \"%s\": {\"min_ns\": %lld, \"median_ns\": %lld, \"mean_ns\": %lld}%s\n",
+                    phaseName[phase], sorted[0], sorted[repetitions / 2], sum / repetitions,
+                    phase + 1 < TimedPhases ? "," : "");
+        }
+        fprintf(out, "     }}%s\n", s + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/* the median of a phase of a scale in a results file, -1 when it has none */
+static long long baselineMedian( const char *json, const char *scale, const char *phase )
+{
+    char key[128];
+    const char *at, *end;
+    long long median;
+
+    snprintf(key, sizeof(key), "\"scale\": \"%s\"", scale);
+    if((at = strstr(json, key)) == NULL)
+        return -1;
+    end = strstr(at + 1, "\"scale\": ");
+    snprintf(key, sizeof(key), "\"%s\": {", phase);
+    if((at = strstr(at, key)) == NULL || (end != NULL && at > end))
+        return -1;
+    if((at = strstr(at, "\"median_ns\": ")) == NULL || sscanf(at, "\"median_ns\": %lld", &median) != 1)
+        return -1;
+    return median;
+}
+
+/* print the change of every median, returns the number of regressions */
+static int compareBaseline( const char *path, Scale *scales, int count, int repetitions, double percent )
+{
+    FILE *file = fopen(path, "r");
+    char *json;
+    long long sorted[MaxRepetitions], old;
+    long size;
+    double change;
+    int s, phase, slower = 0;
+
+    if(file == NULL){
+        fprintf(stderr, "can't open the baseline file\n");
+        exit(2);
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    json = calloc(size + 1, 1);
+    fread(json, 1, size, file);
+    fclose(file);
+
+    for(s = 0; s < count; s++)
+        for(phase = 0; phase < TimedPhases; phase++){
+            old = baselineMedian(json, scales[s].name, phaseName[phase]);
+            if(old <= 0)
+                continue;
+            memcpy(sorted, scales[s].ns[phase], repetitions * sizeof(long long));
+            qsort(sorted, repetitions, sizeof(long long), compareNs);
+            change = 100.0 * (sorted[repetitions / 2] - old) / old;
+            fprintf(stderr, "%-8s %-8s %12lld ns %12lld ns %+7.1f%%%s\n", scales[s].name, phaseName[phase],
+                    old, sorted[repetitions / 2], change, change > percent ? "  slower" : "");
+            slower += change > percent;
+        }
+    free(json);
+    return slower;
+}
+
+int main( int argc, char *argv[] )
+{
+    static Scale scales[3];
+    const char *results = NULL, *baseline = NULL;
+    FILE *out = stdout;
+    GenParams custom;
+    double percent = 10;
+    int repetitions = 5, count = 3, c, s;
+    bool generator = false;
+
+    defaultGenParams(&custom);
+    while((c = getopt(argc, argv, "r:o:b:t:d:s:w:e:F:l:c:S:")) != -1)
+        switch(c){
+            case 'r':
+                repetitions = atoi(optarg);
+                if(repetitions < 1 || repetitions > MaxRepetitions)
+                    usage();
+                break;
+            case 'o':
+                results = optarg;
+                break;
+            case 'b':
+                baseline = optarg;
+                break;
+            case 't':
+                percent = atof(optarg);
+                break;
+            default:
+                if(!parseGenOption(&custom, c, optarg))
+                    usage();
+                generator = true;
+        }
+    if(optind != argc)
+        usage();
+
+    for(s = 0; s < 3; s++)
+        defaultGenParams(&scales[s].params);
+    scales[0].name = "small";
+    scales[1].name = "medium";
+    scales[1].params.declarations = 200;
+    scales[1].params.statements = 10000;
+    scales[2].name = "large";
+    scales[2].params.declarations = 2000;
+    scales[2].params.statements = 100000;
+    if(generator){
+        scales[0].name = "custom";
+        scales[0].params = custom;
+        count = 1;
+    }
+
+    for(s = 0; s < count; s++)
+        runScale(&scales[s], repetitions);
+    if(results != NULL && (out = fopen(results, "w")) == NULL){
+        fprintf(stderr, "can't open the results file\n");
+        return 2;
+    }
+    writeResults(out, scales, count, repetitions);
+    if(out != stdout)
+        fclose(out);
+    if(baseline != NULL && compareBaseline(baseline, scales, count, repetitions, percent) > 0)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+   Shapes of the synthetic AC programs of gen.c.
+
+   A program declares `declarations` variables, a `floats` share of them
+   float, with names of `idLength` letters (longer when that many names
+   do not fit). Each of its `statements` statements is a print of a
+   variable or an assignment whose right hand side is `width` operands
+   joined by + - * /, one of them a parenthesized expression of the same
+   shape nested `depth` deep. A `constants` share of the operands are
+   constants, the others variables. An int variable is only assigned an
+   expression of ints, so every program checks without errors.
+*/
+typedef struct GenParams{
+    int declarations;
+    int statements;
+    int width;
+    int depth;
+    double floats;
+    int idLength;
+    double constants;
+    unsigned long seed;
+}GenParams;
+
+void defaultGenParams( GenParams *p );
+bool parseGenOption( GenParams *p, int c, const char *arg );
+void generateProgram( FILE *out, const GenParams *p );
+
+#endif
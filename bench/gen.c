@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "bench.h"
+
+/*
+   Synthetic AC programs, see GenParams in bench.h.
+
+   The same parameters and seed always give the same program, on any
+   machine, so timings of two builds of the compiler can be compared.
+*/
+
+typedef struct Generator{
+    const GenParams *p;
+    FILE *out;
+    unsigned long long state;
+    char (*names)[65];
+    bool *isFloat;
+    int *ints;              /* the indices of the int variables */
+    int intCount;
+}Generator;
+
+void defaultGenParams( GenParams *p )
+{
+    p->declarations = 20;
+    p->statements = 1000;
+    p->width = 4;
+    p->depth = 2;
+    p->floats = 0.5;
+    p->idLength = 4;
+    p->constants = 0.3;
+    p->seed = 1;
+}
+
+/* the options shared with bench, false on one that is not */
+bool parseGenOption( GenParams *p, int c, const char *arg )
+{
+    switch(c){
+        case 'd': p->declarations = atoi(arg); return p->declarations >= 1;
+        case 's': p->statements = atoi(arg); return p->statements >= 0;
+        case 'w': p->width = atoi(arg); return p->width >= 1;
+        case 'e': p->depth = atoi(arg); return p->depth >= 0;
+        case 'F': p->floats = atof(arg); return p->floats >= 0 && p->floats <= 1;
+        case 'l': p->idLength = atoi(arg); return p->idLength >= 1 && p->idLength <= 64;
+        case 'c': p->constants = atof(arg); return p->constants >= 0 && p->constants <= 1;
+        case 'S': p->seed = strtoul(arg, NULL, 10); return true;
+    }
+    return false;
+}
+
+/* xorshift64*, not rand(), so the programs do not depend on the C library */
+static unsigned long long next( Generator *g )
+{
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 2685821657736338717ULL;
+}
+
+static int below( Generator *g, int n )
+{
+    return (int)(next(g) % (unsigned long long)n);
+}
+
+static bool chance( Generator *g, double share )
+{
+    return (next(g) >> 11) * (1.0 / 9007199254740992.0) < share;
+}
+
+/* f, i, p and repeat are keywords */
+static bool reserved( const char *name )
+{
+    return strcmp(name, "f") == 0 || strcmp(name, "i") == 0 ||
+           strcmp(name, "p") == 0 || strcmp(name, "repeat") == 0;
+}
+
+/* the k-th name of `length` letters, in base 26 */
+static void spell( unsigned long long k, int length, char *name )
+{
+    int i;
+
+    for(i = length - 1; i >= 0; i--){
+        name[i] = 'a' + k % 26;
+        k /= 26;
+    }
+    name[length] = '\0';
+}
+
+static void makeNames( Generator *g )
+{
+    unsigned long long capacity = 26, k = 0;
+    int length = 1, i;
+
+    while(capacity < (unsigned long long)g->p->declarations + 4 && length < 64){
+        capacity *= 26;
+        length++;
+    }
+    if(length < g->p->idLength)
+        length = g->p->idLength > 64 ? 64 : g->p->idLength;
+    for(i = 0; i < g->p->declarations; i++){
+        do
+            spell(k++, length, g->names[i]);
+        while(reserved(g->names[i]));
+    }
+}
+
+static void constant( Generator *g, bool floats )
+{
+    if(floats && chance(g, 0.5))
+        fprintf(g->out, "%d.%d", below(g, 100), below(g, 10));
+    else
+        fprintf(g->out, "%d", 1 + below(g, 99));
+}
+
+static void operand( Generator *g, bool floats )
+{
+    if(chance(g, g->p->constants) || (!floats && g->intCount == 0))
+        constant(g, floats);
+    else if(floats)
+        fputs(g->names[below(g, g->p->declarations)], g->out);
+    else
+        fputs(g->names[g->ints[below(g, g->intCount)]], g->out);
+}
+
+/* width operands, one of them nested while depth lasts; floats allows float operands */
+static void expression( Generator *g, int depth, bool floats )
+{
+    static const char ops[] = "+-*/";
+    int nested = depth > 0 ? below(g, g->p->width) : -1;
+    int i;
+
+    for(i = 0; i < g->p->width; i++){
+        if(i > 0)
+            fprintf(g->out, " %c ", ops[below(g, 4)]);
+        if(i == nested){
+            fputc('(', g->out);
+            expression(g, depth - 1, floats);
+            fputc(')', g->out);
+        }
+        else
+            operand(g, floats);
+    }
+}
+
+void generateProgram( FILE *out, const GenParams *p )
+{
+    Generator g;
+    int i, target;
+
+    g.p = p;
+    g.out = out;
+    g.state = p->seed * 0x9E3779B97F4A7C15ULL + 1;
+    g.names = calloc(p->declarations, sizeof(g.names[0]));
+    g.isFloat = calloc(p->declarations, sizeof(bool));
+    g.ints = calloc(p->declarations, sizeof(int));
+    g.intCount = 0;
+    makeNames(&g);
+
+    for(i = 0; i < p->declarations; i++){
+        g.isFloat[i] = chance(&g, p->floats);
+        if(!g.isFloat[i])
+            g.ints[g.intCount++] = i;
+        fprintf(out, "%c %s\n", g.isFloat[i] ? 'f' : 'i', g.names[i]);
+    }
+    for(i = 0; i < p->statements && p->declarations > 0; i++){
+        target = below(&g, p->declarations);
+        if(below(&g, 8) == 0)
+            fprintf(out, "p %s\n", g.names[target]);
+        else{
+            fprintf(out, "%s = ", g.names[target]);
+            expression(&g, p->depth, g.isFloat[target]);
+            fputc('\n', out);
+        }
+    }
+
+    free(g.names);
+    free(g.isFloat);
+    free(g.ints);
+}
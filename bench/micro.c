@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/header.h"
+#include "bench.h"
+
+/*
+   micro: time the hot functions of the compiler on their own.
+
+   micro [-r repetitions] [-w warmups] [-o results.json] [benchmark ...]
+
+   Every benchmark runs a batch of calls over a fixed corpus: `warmups`
+   batches that are not counted, then `repetitions` that are. For each it
+   prints the median and the min of the ns per call over the batches, their
+   relative standard deviation, and the heap allocations per call. The
+   allocations are counted by wrapping malloc, calloc and realloc at link
+   time (see the Makefile), so only the compiler's own are seen, not those
+   inside the C library. Named benchmarks run alone.
+
+   The corpora are made by gen.c with its default shape and seed, so they
+   are the same for every build.
+*/
+
+#define MaxRepetitions 1000
+#define CorpusSize 10000
+
+/****  Counting allocations ****/
+
+static long allocations;
+
+void *__real_malloc( size_t size );
+void *__real_calloc( size_t count, size_t size );
+void *__real_realloc( void *p, size_t size );
+
+void *__wrap_malloc( size_t size )
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc( size_t count, size_t size )
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc( void *p, size_t size )
+{
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+
+
+
+/****  Corpora ****/
+
+static char *program, *numbers, *words;
+static size_t programLength, numbersLength, wordsLength;
+static char (*names)[65];
+static int nameCount;
+static HashMap *filled, *emptied;
+static Expression *pairs;
+static Value *pairValues;
+static Program checked;
+static FILE *sink;
+
+/* the default program of gen.c, its numbers and its words each followed by a space */
+static void makeCorpora( void )
+{
+    GenParams p;
+    FILE *out;
+    Lexer lex;
+    Token token;
+    FILE *nums, *ids;
+
+    defaultGenParams(&p);
+    out = open_memstream(&program, &programLength);
+    generateProgram(out, &p);
+    fclose(out);
+
+    nums = open_memstream(&numbers, &numbersLength);
+    ids = open_memstream(&words, &wordsLength);
+    InitializeLexer(&lex, program, programLength);
+    while((token = scanner(&lex)).type != EOFsymbol){
+        if(token.type == IntValue || token.type == FloatValue)
+            fprintf(nums, "%.*s ", token.length, token.start);
+        else if(token.type == Alphabet)
+            fprintf(ids, "%.*s ", token.length, token.start);
+    }
+    fclose(nums);
+    fclose(ids);
+}
+
+/* CorpusSize distinct names, hashed into a table twice their count */
+static void makeTables( void )
+{
+    GenParams p;
+    Program decls;
+    FILE *out;
+    char *text;
+    size_t len;
+    int i;
+
+    defaultGenParams(&p);
+    p.declarations = CorpusSize;
+    p.statements = 0;
+    out = open_memstream(&text, &len);
+    generateProgram(out, &p);
+    fclose(out);
+    decls = parseText(text, len, 1);
+    free(text);
+
+    nameCount = decls.declarations.count;
+    names = malloc(nameCount * sizeof(names[0]));
+    for(i = 0; i < nameCount; i++)
+        strcpy(names[i], decls.declarations.items[i].name);
+    filled = mybuild(decls);
+    emptied = mybuild(decls);
+    FreeProgram(&decls);
+}
+
+/* CorpusSize binary nodes of two constants, ints and floats, every operator */
+static void makePairs( void )
+{
+    static const ValueType ops[] = { PlusNode, MinusNode, MulNode, DivNode };
+    Expression *leaf;
+    unsigned long long state = 1;
+    int i, j;
+
+    pairs = calloc(CorpusSize, sizeof(Expression));
+    pairValues = calloc(CorpusSize, sizeof(Value));
+    for(i = 0; i < CorpusSize; i++){
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        pairs[i].type = (state >> 33) & 1 ? Float : Int;
+        pairs[i].v.type = ops[(state >> 40) & 3];
+        for(j = 0; j < 2; j++){
+            leaf = calloc(1, sizeof(Expression));
+            leaf->type = pairs[i].type;
+            if(leaf->type == Int){
+                leaf->v.type = IntConst;
+                leaf->v.val.ivalue = 1 + (state >> (20 + 10 * j)) % 999;
+            }
+            else{
+                leaf->v.type = FloatConst;
+                leaf->v.val.fvalue = (1 + (state >> (20 + 10 * j)) % 999) / 10.0;
+            }
+            if(j == 0)
+                pairs[i].leftOperand = leaf;
+            else
+                pairs[i].rightOperand = leaf;
+        }
+        pairValues[i] = pairs[i].v;
+    }
+}
+
+/* the default program of gen.c after the checker */
+static void makeChecked( void )
+{
+    HashMap *map;
+
+    checked = parseText(program, programLength, 1);
+    map = mybuild(checked);
+    mycheck(&checked, map);
+    FreeMap(map);
+    sink = fopen("/dev/null", "w");
+}
+
+
+
+
+/****  Benchmarks ****/
+
+/* every benchmark does one batch and returns the number of calls in it */
+
+static long benchScanner( void )
+{
+    Lexer lex;
+    long calls = 1;
+
+    InitializeLexer(&lex, program, programLength);
+    while(scanner(&lex).type != EOFsymbol)
+        calls++;
+    return calls;
+}
+
+static long benchNumeric( void )
+{
+    Lexer lex;
+    long calls = 0;
+
+    InitializeLexer(&lex, numbers, numbersLength);
+    while(lex.cur < lex.end){
+        getNumericToken(&lex);
+        lex.cur++;
+        calls++;
+    }
+    return calls;
+}
+
+static long benchString( void )
+{
+    Lexer lex;
+    long calls = 0;
+
+    InitializeLexer(&lex, words, wordsLength);
+    while(lex.cur < lex.end){
+        getStringToken(&lex);
+        lex.cur++;
+        calls++;
+    }
+    return calls;
+}
+
+static long benchHash( void )
+{
+    volatile int sum = 0;
+    int i;
+
+    for(i = 0; i < nameCount; i++)
+        sum += hash(filled, names[i]);
+    return nameCount;
+}
+
+/* the table is emptied before the batch, outside the clock */
+static void emptyTable( void )
+{
+    int i;
+
+    for(i = 0; i < emptied->size; i++)
+        emptied->storage[i]->type = Notype;
+}
+
+static long benchAdd( void )
+{
+    int i;
+
+    for(i = 0; i < nameCount; i++)
+        add_map(emptied, names[i], Int);
+    return nameCount;
+}
+
+static long benchLookup( void )
+{
+    volatile int sum = 0;
+    int i;
+
+    for(i = 0; i < nameCount; i++)
+        sum += lookup_map(filled, names[i]);
+    return nameCount;
+}
+
+/* the nodes get back their operators before the batch, outside the clock */
+static void unfoldPairs( void )
+{
+    int i;
+
+    for(i = 0; i < CorpusSize; i++)
+        pairs[i].v = pairValues[i];
+}
+
+static long benchCalculate( void )
+{
+    int i;
+
+    for(i = 0; i < CorpusSize; i++)
+        calculate_op(&pairs[i], AnyPrecision);
+    return CorpusSize;
+}
+
+static long benchPrint( void )
+{
+    Statements *stmts = &checked.statements;
+    long calls = 0;
+    int i;
+
+    for(i = 0; i < stmts->count; i++)
+        if(stmts->kind[i] == Assignment){
+            fprint_expr(sink, stmts->expr[i]);
+            calls++;
+        }
+    fflush(sink);
+    return calls;
+}
+
+typedef struct Micro{
+    const char *name;
+    long (*batch)( void );
+    void (*prepare)( void );    /* if set, runs before every batch and is not timed */
+}Micro;
+
+static const Micro micros[] = {
+    { "scanner", benchScanner, NULL },
+    { "getNumericToken", benchNumeric, NULL },
+    { "getStringToken", benchString, NULL },
+    { "hash", benchHash, NULL },
+    { "add_map", benchAdd, emptyTable },
+    { "lookup_map", benchLookup, NULL },
+    { "calculate_op", benchCalculate, unfoldPairs },
+    { "fprint_expr", benchPrint, NULL },
+};
+#define MicroCount (int)(sizeof(micros) / sizeof(micros[0]))
+
+
+
+
+/****  Running ****/
+
+typedef struct Result{
+    double median, min, deviation, allocs;
+}Result;
+
+static long long now( void )
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int compareDouble( const void *a, const void *b )
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static Result run( const Micro *micro, int warmups, int repetitions )
+{
+    static double perCall[MaxRepetitions];
+    Result result;
+    long long start;
+    long calls, totalCalls = 0, before, allocated = 0;
+    double mean = 0, variance = 0;
+    int r;
+
+    for(r = -warmups; r < repetitions; r++){
+        if(micro->prepare)
+            micro->prepare();
+        before = allocations;
+        start = now();
+        calls = micro->batch();
+        if(r < 0)
+            continue;
+        perCall[r] = (double)(now() - start) / calls;
+        allocated += allocations - before;
+        totalCalls += calls;
+        mean += perCall[r] / repetitions;
+    }
+    for(r = 0; r < repetitions; r++)
+        variance += (perCall[r] - mean) * (perCall[r] - mean) / repetitions;
+    qsort(perCall, repetitions, sizeof(double), compareDouble);
+    result.median = perCall[repetitions / 2];
+    result.min = perCall[0];
+    result.deviation = mean > 0 ? 100 * sqrt(variance) / mean : 0;
+    result.allocs = (double)allocated / totalCalls;
+    return result;
+}
+
+static void usage( void )
+{
+    int i;
+
+    fprintf(stderr, "usage: micro [-r repetitions] [-w warmups] [-o results.json] [benchmark ...]\nbenchmarks:");
+    for(i = 0; i < MicroCount; i++)
+        fprintf(stderr, " %s", micros[i].name);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main( int argc, char *argv[] )
+{
+    Context ctx;
+    Result result;
+    const char *results = NULL;
+    FILE *json = NULL;
+    bool chosen[MicroCount];
+    int repetitions = 20, warmups = 3, c, i, j, done = 0;
+
+    while((c = getopt(argc, argv, "r:w:o:")) != -1)
+        switch(c){
+            case 'r':
+                repetitions = atoi(optarg);
+                if(repetitions < 1 || repetitions > MaxRepetitions)
+                    usage();
+                break;
+            case 'w':
+                warmups = atoi(optarg);
+                if(warmups < 0)
+                    usage();
+                break;
+            case 'o':
+                results = optarg;
+                break;
+            default:
+                usage();
+        }
+    for(i = 0; i < MicroCount; i++)
+        chosen[i] = optind == argc;
+    for(j = optind; j < argc; j++){
+        for(i = 0; i < MicroCount && strcmp(argv[j], micros[i].name) != 0; i++)
+            ;
+        if(i == MicroCount)
+            usage();
+        chosen[i] = true;
+    }
+    if(results != NULL && (json = fopen(results, "w")) == NULL){
+        fprintf(stderr, "can't open the results file\n");
+        return 2;
+    }
+
+    ctx.diag = NULL;/* the conversions the checker reports */
+    enterContext(&ctx);
+    if(setjmp(ctx.fail)){
+        fprintf(stderr, "the corpus did not compile\n");
+        return 1;
+    }
+    makeCorpora();
+    makeTables();
+    makePairs();
+    makeChecked();
+
+    printf("%-16s %12s %12s %8s %10s\n", "benchmark", "median ns/op", "min ns/op", "stddev", "allocs/op");
+    if(json)
+        fprintf(json, "{\n  \"benchmark\": \"micro\",\n  \"repetitions\": %d,\n  \"warmups\": %d,\n  \"functions\": {\n",
+                repetitions, warmups);
+    for(i = 0; i < MicroCount; i++){
+        if(!chosen[i])
+            continue;
+        result = run(&micros[i], warmups, repetitions);
+        printf("%-16s %12.1f %12.1f %7.1f%% %10.2f\n", micros[i].name,
+               result.median, result.min, result.deviation, result.allocs);
+        if(json)
+            fprintf(json, "%s    \"%s\": {\"median_ns\": %.1f, \"min_ns\": %.1f, \"stddev_percent\": %.1f, \"allocs\": %.2f}",
+                    done++ ? ",\n" : "", micros[i].name, result.median, result.min, result.deviation, result.allocs);
+    }
+    if(json){
+        fprintf(json, "\n  }\n}\n");
+        fclose(json);
+    }
+    enterContext(NULL);
+    return 0;
+}
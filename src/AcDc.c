@@ -1,48 +1,299 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
 #include "header.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #define NumsSize 23//EDITED2
+#define MinParallelStatements 4096
+
+/*********************************************
+  Diagnostics
+  Every compilation runs under a Context, so
+  batch jobs on different threads each keep
+  their own log and an error ends only the
+  compilation it happened in.
+ *********************************************/
+static __thread Context *current;
+
+/* a Context without diag discards what it is told */
+void report( const char *format, ... )
+{
+    FILE *diag = current ? current->diag : stdout;
+    va_list args;
+
+    va_start(args, format);
+    if(diag)
+        vfprintf(diag, format, args);
+    va_end(args);
+}
+
+/* make ctx the Context of this thread, returns the one it replaces */
+Context *enterContext( Context *ctx )
+{
+    Context *previous = current;
+
+    current = ctx;
+    return previous;
+}
+
+/* report the error and abandon the compilation */
+void fail( const char *format, ... )
+{
+    FILE *diag = current ? current->diag : stdout;
+    va_list args;
+
+    va_start(args, format);
+    if(diag)
+        vfprintf(diag, format, args);
+    va_end(args);
+    if(current)
+        longjmp(current->fail, 1);
+    exit(1);
+}
+
+/* check the program and print its dc code */
+void backend( Program *program, HashMap *map, FILE *code, Options *opt )
+{
+    IRProgram ir;
+    PhaseClock clock;
+
+    startPhase(CheckPhase, &clock);
+    if(opt->jobs > 1 && program->statements.count >= MinParallelStatements)/* printing is timed with checking */
+        parallelBackend(program, map, opt->optimize == 0 && !opt->image ? code : NULL, opt->jobs);
+    else{
+        //check(&program, &symtab);
+        mycheck(program, map);//EDITED
+        if(opt->optimize == 0 && !opt->image){
+            nextPhase(EmitPhase, &clock);
+            gencode(*program, code);
+        }
+    }
+    if(opt->optimize != 0 || opt->image){
+        nextPhase(LowerPhase, &clock);
+        InitializeIR(&ir);
+        lower_program(&ir, program);
+        nextPhase(PassesPhase, &clock);
+        run_passes(&ir, opt->optimize);
+        nextPhase(EmitPhase, &clock);
+        if(opt->image)
+            writeImage(&ir, opt->optimize, code);
+        else
+            ir_gencode(&ir, code);
+        FreeIR(&ir);
+    }
+    endPhase(&clock);
+}
+
+/*
+   backend with the fragments of unchanged statements taken from the
+   cache. Below -O2 every statement compiles on its own and is cached on
+   its own; at -O2 the passes see the whole program, so it is one fragment.
+*/
+void cachedBackend( Program *program, HashMap *map, FILE *code, Options *opt )
+{
+    Statements *stmts = &program->statements;
+    FILE *diag = current->diag, *key, *log, *out;
+    char declarations[33], *keyText, *logText, *outText, *hitLog, *hitCode;
+    size_t keyLength, logLength, outLength, hitLogLength, hitCodeLength;
+    long keyEnd, logEnd, outEnd;
+    IRProgram ir;
+    jmp_buf outer;
+    int i;
+
+    cache_declarations(&program->declarations, opt, declarations);
+    key = open_memstream(&keyText, &keyLength);
+    log = open_memstream(&logText, &logLength);
+    out = open_memstream(&outText, &outLength);
+    InitializeIR(&ir);
+    lower_declarations(&ir, &program->declarations);
+    memcpy(outer, current->fail, sizeof(jmp_buf));
+    if(setjmp(current->fail)){/* the error went to the log, pass it on */
+        current->diag = diag;
+        memcpy(current->fail, outer, sizeof(jmp_buf));
+        logEnd = ftell(log);
+        fflush(log);
+        report("%.*s", (int)logEnd, logText);
+        fclose(key);
+        fclose(log);
+        fclose(out);
+        free(keyText);
+        free(logText);
+        free(outText);
+        FreeIR(&ir);
+        longjmp(current->fail, 1);
+    }
+
+    for(i = 0; i < stmts->count || (opt->optimize >= 2 && i == 0); i++){
+        fseek(key, 0, SEEK_SET);
+        cache_key_header(key, declarations, opt->optimize);
+        if(opt->optimize >= 2){
+            for(i = 0; i < stmts->count; i++)
+                cache_statement_key(key, stmts, i);
+        }
+        else
+            cache_statement_key(key, stmts, i);
+        keyEnd = ftell(key);
+        fflush(key);
+
+        if(cache_load(opt->cache, keyText, keyEnd, &hitLog, &hitLogLength, &hitCode, &hitCodeLength)){
+            report("%.*s", (int)hitLogLength, hitLog);
+            fwrite(hitCode, 1, hitCodeLength, code);
+            free(hitLog);
+            free(hitCode);
+            continue;
+        }
+
+        fseek(log, 0, SEEK_SET);
+        fseek(out, 0, SEEK_SET);
+        current->diag = log;
+        if(opt->optimize >= 2)
+            backend(program, map, out, opt);
+        else{
+            mycheckstmt(stmts, i, map);
+            emitStatement(&ir, stmts, i, out, opt->optimize);
+        }
+        current->diag = diag;
+        logEnd = ftell(log);
+        outEnd = ftell(out);
+        fflush(log);
+        fflush(out);
+
+        report("%.*s", (int)logEnd, logText);
+        fwrite(outText, 1, outEnd, code);
+        cache_store(opt->cache, keyText, keyEnd, logText, logEnd, outText, outEnd);
+    }
 
-int main( int argc, char *argv[] )
+    memcpy(current->fail, outer, sizeof(jmp_buf));
+    fclose(key);
+    fclose(log);
+    fclose(out);
+    free(keyText);
+    free(logText);
+    free(outText);
+    FreeIR(&ir);
+}
+
+/* one source file to one target file, returns the exit status */
+int compile( Context *ctx, const char *source_file, const char *target_file, Options *opt )
 {
     FILE *source, *target;
+    PhaseClock clock;
+    char *text;
+    size_t len;
+    int status;
+
+    if(isImage(source_file)){/* already compiled, only the dc code is left to print */
+        if( (target = fopen(target_file, "w")) == NULL ){
+            fprintf(ctx->diag, "can't open the target file\n");
+            return 2;
+        }
+        status = compileImage(ctx, source_file, target, opt);
+        fclose(target);
+        return status;
+    }
+    source = fopen(source_file, "r");
+    target = fopen(target_file, "w");
+    if( !source ){
+        fprintf(ctx->diag, "can't open the source file\n");
+        if(target)
+            fclose(target);
+        return 2;
+    }
+    else if( !target ){
+        fprintf(ctx->diag, "can't open the target file\n");
+        fclose(source);
+        return 2;
+    }
+    startPhase(ReadPhase, &clock);
+    text = read_source(source, &len);
+    fclose(source);
+    endPhase(&clock);
+    countStat(bytes, len);
+    status = compileText(ctx, text, len, target, opt);
+    free(text);
+    if(status != 0){/* the pipeline may have printed some statements already */
+        fflush(target);
+        ftruncate(fileno(target), 0);
+    }
+    fclose(target);
+    return status;
+}
+
+/* source text to dc code in target, returns the exit status; errors never leave the Context */
+int compileText( Context *ctx, const char *text, size_t len, FILE *target, Options *opt )
+{
+    FILE *code, *out;
     Program program;
 //    SymbolTable symtab;
 	HashMap *symmap;//EDITED2
-
-    if( argc == 3){
-        source = fopen(argv[1], "r");
-        target = fopen(argv[2], "w");
-        if( !source ){
-            printf("can't open the source file\n");
-            exit(2);
-        }
-        else if( !target ){
-            printf("can't open the target file\n");
-            exit(2);
+    PhaseClock clock;
+    Emitted emitted;
+    char *buf;
+    size_t codeLength;
+    volatile bool factor = opt->factor && !opt->image;/* an image is factored when it is printed */
+
+    out = opt->image ? target : countingStream(target, &emitted);/* an image is not dc code, it is counted when it is printed */
+    code = factor ? open_memstream(&buf, &codeLength) : out;
+    if(setjmp(ctx->fail)){
+        current = NULL;
+        if(tracing)/* the phase that failed never ended */
+            traceEndPhase(-1);
+        if(factor){
+            fclose(code);
+            free(buf);
         }
-        else{
-            program = parser(source);
-            fclose(source);
-            //symtab = build(program);
-            symmap = mybuild(program);//EDITED2
-            //check(&program, &symtab);
-            mycheck(&program, symmap);//EDITED
+        if(out != target)
+            countEmitted(out, &emitted, false);
+        return 1;
+    }
+    current = ctx;
+
+    if(opt->pipeline && opt->cache == NULL && !opt->image){/* the cache works on whole parsed programs */
+        startPhase(PipelinePhase, &clock);
+        runPipeline(text, len, code, opt);
+        endPhase(&clock);
+        goto done;
+    }
+
+    startPhase(ParsePhase, &clock);
+    program = parseText(text, len, opt->jobs);
+    nextPhase(BuildPhase, &clock);
+    //symtab = build(program);
+    symmap = mybuild(program);//EDITED2
+    bind_map(symmap, opt);
+    endPhase(&clock);
 //			puts("---------DEBUG----------");
 //			fseek(source, 0, SEEK_SET);
 //			test_parser(source);
 //          fclose(source);
 //			puts("\n---------DEBUG----------");
-            gencode(program, target);
-        }
+    if(opt->cache != NULL && !opt->image){
+        startPhase(CachedPhase, &clock);
+        cachedBackend(&program, symmap, code, opt);
+        endPhase(&clock);
     }
-    else{
-        printf("Usage: %s source_file target_file\n", argv[0]);
+    else
+        backend(&program, symmap, code, opt);
+    FreeMap(symmap);
+    FreeProgram(&program);
+
+done:
+    if(factor){
+        fclose(code);
+        startPhase(MacrosPhase, &clock);
+        factor_macros(buf, codeLength, out);
+        endPhase(&clock);
+        free(buf);
     }
-
-
+    if(out != target)
+        countEmitted(out, &emitted, true);
+    current = NULL;
     return 0;
 }
 
@@ -50,399 +301,740 @@ int main( int argc, char *argv[] )
 /********************************************* 
   Scanning 
  *********************************************/
-Token getNumericToken( FILE *source, char c )
+
+/* character classes, indexed by the byte; everything else is invalid */
+static const unsigned char char_class[256] = {
+    ['\t'] = CharSpace, ['\n'] = CharSpace, ['\v'] = CharSpace,
+    ['\f'] = CharSpace, ['\r'] = CharSpace, [' '] = CharSpace,
+    ['0' ... '9'] = CharDigit,
+    ['a' ... 'z'] = CharLower,
+    ['='] = CharOperator, ['+'] = CharOperator, ['-'] = CharOperator,
+    ['*'] = CharOperator, ['/'] = CharOperator, ['('] = CharOperator,
+    [')'] = CharOperator, ['{'] = CharOperator, ['}'] = CharOperator,
+};
+
+/* scalar fallback, also used for the tail shorter than one vector */
+static const char *skip_space_scalar( const char *p, const char *end )
 {
-    Token token;
-    int i = 0;
+    while(p < end && char_class[(unsigned char)*p] == CharSpace) p++;
+    return p;
+}
+
+static const char *span_class_scalar( const char *p, const char *end, CharClass cls )
+{
+    while(p < end && char_class[(unsigned char)*p] == cls) p++;
+    return p;
+}
+
+static const char *span_lower_scalar( const char *p, const char *end )
+{
+    return span_class_scalar(p, end, CharLower);
+}
+
+static const char *span_digit_scalar( const char *p, const char *end )
+{
+    return span_class_scalar(p, end, CharDigit);
+}
+
+static const ScanOps scan_scalar = { "scalar", skip_space_scalar, span_lower_scalar, span_digit_scalar };
+
+#if defined(__x86_64__) || defined(__i386__)
+/* bytes in [lo, hi]; bytes >= 0x80 compare as negative and never match */
+#define InRange128(v, lo, hi) \
+    _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+#define InRange256(v, lo, hi) \
+    _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), v))
 
-    while( isdigit(c) ) {
-        token.tok[i++] = c;
-        c = fgetc(source);
+__attribute__((target("sse2")))
+static const char *skip_space_sse2( const char *p, const char *end )
+{
+    while(end - p >= 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), InRange128(v, '\t', '\r'));
+        unsigned mask = ~_mm_movemask_epi8(space) & 0xFFFF;
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
     }
+    return skip_space_scalar(p, end);
+}
 
-    if( c != '.' ){
-        ungetc(c, source);
-        token.tok[i] = '\0';
-        token.type = IntValue;
-        return token;
+__attribute__((target("sse2")))
+static const char *span_lower_sse2( const char *p, const char *end )
+{
+    while(end - p >= 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = ~_mm_movemask_epi8(InRange128(v, 'a', 'z')) & 0xFFFF;
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
     }
+    return span_lower_scalar(p, end);
+}
 
-    token.tok[i++] = '.';
+__attribute__((target("sse2")))
+static const char *span_digit_sse2( const char *p, const char *end )
+{
+    while(end - p >= 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = ~_mm_movemask_epi8(InRange128(v, '0', '9')) & 0xFFFF;
+        if(mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return span_digit_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *skip_space_avx2( const char *p, const char *end )
+{
+    while(end - p >= 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), InRange256(v, '\t', '\r'));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(space);
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return skip_space_sse2(p, end);
+}
 
-    c = fgetc(source);
-    if( !isdigit(c) ){
-        ungetc(c, source);
-        printf("Expect a digit : %c\n", c);
-        exit(1);
+__attribute__((target("avx2")))
+static const char *span_lower_avx2( const char *p, const char *end )
+{
+    while(end - p >= 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(InRange256(v, 'a', 'z'));
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
     }
+    return span_lower_sse2(p, end);
+}
 
-    while( isdigit(c) ){
-        token.tok[i++] = c;
-        c = fgetc(source);
+__attribute__((target("avx2")))
+static const char *span_digit_avx2( const char *p, const char *end )
+{
+    while(end - p >= 32){
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(InRange256(v, '0', '9'));
+        if(mask) return p + __builtin_ctz(mask);
+        p += 32;
     }
+    return span_digit_sse2(p, end);
+}
+
+static const ScanOps scan_sse2 = { "sse2", skip_space_sse2, span_lower_sse2, span_digit_sse2 };
+static const ScanOps scan_avx2 = { "avx2", skip_space_avx2, span_lower_avx2, span_digit_avx2 };
+#endif
+
+static const ScanOps *selected_scan_ops;
+static pthread_once_t scan_ops_once = PTHREAD_ONCE_INIT;
+
+static void detect_scan_ops( void )
+{
+    selected_scan_ops = &scan_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        selected_scan_ops = &scan_avx2;
+    else if(__builtin_cpu_supports("sse2"))
+        selected_scan_ops = &scan_sse2;
+#endif
+}
 
-    ungetc(c, source);
-    token.tok[i] = '\0';
+/* pick the widest scanning routines the running cpu supports, detected once per process */
+const ScanOps *select_scan_ops( void )
+{
+    pthread_once(&scan_ops_once, detect_scan_ops);
+    return selected_scan_ops;
+}
+
+void InitializeLexer( Lexer *lex, const char *text, size_t len )
+{
+    lex->cur = text;
+    lex->end = text + len;
+    lex->ops = select_scan_ops();
+    lex->hasPeek = false;
+    lex->ring = NULL;
+    lex->batch = NULL;
+    lex->depth = 0;
+    lex->tokens = 0;
+}
+
+/* read the whole source, the scanner works on memory */
+char *read_source( FILE *source, size_t *len )
+{
+    size_t cap = 1 << 16, n = 0, got;
+    char *buf = malloc(cap);
+
+    while((got = fread(buf + n, 1, cap - n, source)) > 0){
+        n += got;
+        if(n == cap){
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
+    *len = n;
+    return buf;
+}
+
+/* a token is the slice of the source it was scanned from, nothing is copied */
+static void set_token_text( Token *token, const char *start, const char *end )
+{
+    token->start = start;
+    token->length = end - start;
+}
+
+/* the text of an identifier as a name of the AST, at most 64 characters */
+void token_name( Token token, char *name )
+{
+    if(token.length > 64){
+        fail("Token too long : %.20s...\n", token.start);
+    }
+    memcpy(name, token.start, token.length);
+    name[token.length] = '\0';
+}
+
+/* exact powers of ten, (double)mantissa / pow10 is correctly rounded up to 1e22 */
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+Token getNumericToken( Lexer *lex )
+{
+    Token token;
+    const char *start = lex->cur, *dot, *p, *q;
+    unsigned long long mantissa = 0;
+    int digits, fraction;
+
+    p = lex->ops->span_digit(start, lex->end);
+    for(q = start; q < p; q++)
+        mantissa = mantissa * 10 + (*q - '0');
+
+    if( p == lex->end || *p != '.' ){
+        set_token_text(&token, start, p);
+        lex->cur = p;
+        token.type = IntValue;
+        token.ivalue = (int)mantissa;
+        return token;
+    }
+
+    dot = p++;
+    if( p == lex->end || char_class[(unsigned char)*p] != CharDigit ){
+        fail("Expect a digit : %c\n", p == lex->end ? ' ' : *p);
+    }
+
+    q = p;
+    p = lex->ops->span_digit(p, lex->end);
+    for(; q < p; q++)
+        mantissa = mantissa * 10 + (*q - '0');
+
+    set_token_text(&token, start, p);
+    lex->cur = p;
     token.type = FloatValue;
+
+    digits = p - start - 1;
+    fraction = p - dot - 1;
+    if(digits <= 15 && fraction <= 22)
+        token.fvalue = (double)mantissa / pow10_table[fraction];
+    else{/* too many digits to be exact, strtod needs the text terminated */
+        char *text = strndup(start, p - start);
+        token.fvalue = strtod(text, NULL);
+        free(text);
+    }
     return token;
 }
 
 //EDITED2
-Token getStringToken( FILE *source, char c )
+Token getStringToken( Lexer *lex )
 {
     Token token;
-    int i = 0;
-
-    while( islower(c) ) {//TA
-        token.tok[i++] = c;
-        c = fgetc(source);
-    }
+    const char *start = lex->cur;
 
-    ungetc(c, source);
-    token.tok[i] = '\0';
+    lex->cur = lex->ops->span_lower(start, lex->end);
+    set_token_text(&token, start, lex->cur);
 	token.type = Alphabet;
 	return token;
 
 }
 
 
-Token scanner( FILE *source )
+Token scanner( Lexer *lex )
 {
-    char c;
+    unsigned char c;
     Token token;
 
-    while( !feof(source) ){//why need?
-        c = fgetc(source);
-
-        while( isspace(c) ) c = fgetc(source);//c may be EOF, which is not space characer!
-
-        if( isdigit(c) )
-            return getNumericToken(source, c);
-		
-		token.tok[0] = c;
-        token.tok[1] = '\0';
-		switch(c){
-                    case '=':
-                            token.type = AssignmentOp;
-                            return token;
-                    case '+':
-                            token.type = PlusOp;
-                            return token;
-                    case '-':
-                            token.type = MinusOp;
-                            return token;
-                    case '*':
-                            token.type = MulOp;
-                            return token;
-                    case '/':
-                            token.type = DivOp;
-                            return token;
-                    case EOF:
-                            token.type = EOFsymbol;
-                            token.tok[0] = '\0';
-                            return token;
-                    default:
-							if(!islower(c)){
-								printf("Invalid character : %c\n", c);
-	                            exit(1);
-							}else{
-								token = getStringToken(source, c);
-								
-							}
-		} 
-			
-
-		if(strlen(token.tok)==1){
-			if( c == 'f' )
-                token.type = FloatDeclaration;
-			else if( c == 'i' )
-				token.type = IntegerDeclaration;
-			else if( c == 'p' )
-				token.type = PrintOp;
-		}
-		return token;
+    lex->tokens++;
+    lex->cur = lex->ops->skip_space(lex->cur, lex->end);
+    if( lex->cur == lex->end ){
+        set_token_text(&token, lex->end, lex->end);
+        token.type = EOFsymbol;
+        return token;
+    }
 
-    }//end while
+    c = *lex->cur;
+    switch(char_class[c]){
+        case CharDigit:
+            return getNumericToken(lex);
+        case CharLower:
+            token = getStringToken(lex);
+            if(token.length == 1){
+                if( c == 'f' )
+                    token.type = FloatDeclaration;
+                else if( c == 'i' )
+                    token.type = IntegerDeclaration;
+                else if( c == 'p' )
+                    token.type = PrintOp;
+            }
+            else if(token.length == 6 && memcmp(token.start, "repeat", 6) == 0)
+                token.type = Repeat;
+            return token;
+        case CharOperator:
+            break;
+        default:
+            fail("Invalid character : %c\n", c);
+    }
 
-    token.tok[0] = '\0';
-    token.type = EOFsymbol;
+    set_token_text(&token, lex->cur, lex->cur + 1);
+    lex->cur++;
+    switch(c){
+        case '=':
+            token.type = AssignmentOp;
+            break;
+        case '+':
+            token.type = PlusOp;
+            break;
+        case '-':
+            token.type = MinusOp;
+            break;
+        case '*':
+            token.type = MulOp;
+            break;
+        case '/':
+            token.type = DivOp;
+            break;
+        case '(':
+            token.type = LeftParen;
+            break;
+        case ')':
+            token.type = RightParen;
+            break;
+        case '{':
+            token.type = LeftBrace;
+            break;
+        case '}':
+            token.type = RightBrace;
+            break;
+    }
     return token;
 }
 
-
 /********************************************************
   Parsing
  *********************************************************/
-Declaration parseDeclaration( FILE *source, Token token )
+
+/* binding power of every binary operator, 0 for tokens that are not operators */
+static const OperatorInfo operators[EOFsymbol + 1] = {
+    [PlusOp]  = { 1, PlusNode,  Plus,  SumNode     },
+    [MinusOp] = { 1, MinusNode, Minus, SumNode     },
+    [MulOp]   = { 2, MulNode,   Mul,   ProductNode },
+    [DivOp]   = { 2, DivNode,   Div,   DivNode     },
+};
+
+/* look at the next token without consuming it */
+Token peekToken( Lexer *lex )
+{
+    if(!lex->hasPeek){
+        lex->peek = lex->ring ? pullToken(lex) : scanner(lex);
+        lex->hasPeek = true;
+    }
+    return lex->peek;
+}
+
+Token nextToken( Lexer *lex )
+{
+    if(lex->hasPeek){
+        lex->hasPeek = false;
+        return lex->peek;
+    }
+    return lex->ring ? pullToken(lex) : scanner(lex);
+}
+
+Declaration parseDeclaration( Lexer *lex, Token token )
 {
     Token token2;
     switch(token.type){
         case FloatDeclaration:
         case IntegerDeclaration:
-            token2 = scanner(source);
-			if(strlen(token2.tok)==1){//EDITED2
-            	if (strcmp(token2.tok, "f") == 0 ||
-                	    strcmp(token2.tok, "i") == 0 ||
-                    	strcmp(token2.tok, "p") == 0) {
-	                printf("Syntax Error: %s cannot be used as id\n", token2.tok);
-    	            exit(1);
+            token2 = nextToken(lex);
+			if(token2.length==1){//EDITED2
+            	if (*token2.start == 'f' ||
+                	    *token2.start == 'i' ||
+                    	*token2.start == 'p') {
+	                fail("Syntax Error: %.*s cannot be used as id\n", token2.length, token2.start);
         	    }
 			}
+            if(token2.type == Repeat)
+                fail("Syntax Error: %.*s cannot be used as id\n", token2.length, token2.start);
             return makeDeclarationNode( token, token2 );
         default:
-            printf("Syntax Error: Expect Declaration %s\n", token.tok);
-            exit(1);
+            fail("Syntax Error: Expect Declaration %.*s\n", token.length, token.start);
     }
 }
 
-Declarations *parseDeclarations( FILE *source )
+void parseDeclarations( Lexer *lex, Declarations *decls )
 {
-    Token token = scanner(source);
-    Declaration decl;
-    Declarations *decls;
-    switch(token.type){
-        case FloatDeclaration:
-        case IntegerDeclaration:
-            decl = parseDeclaration(source, token);
-            decls = parseDeclarations(source);
-            return makeDeclarationTree( decl, decls );
-        case PrintOp:
-        case Alphabet:
-			ungets(token.tok, source);//EDITED2
-//            ungetc(token.tok[0], source);
-            return NULL;
-        case EOFsymbol:
-            return NULL;
-        default:
-            printf("Syntax Error: Expect declarations %s\n", token.tok);
-            exit(1);
-    }
-}
-
-//EDITED2
-void ungets(char *str, FILE *source){
-	int i, len = strlen(str);
+    Token token;
 
-	for(i = len -1; i >= 0; i--)
-		ungetc(str[i], source);
+    while(1){
+        token = peekToken(lex);
+        switch(token.type){
+            case FloatDeclaration:
+            case IntegerDeclaration:
+                nextToken(lex);
+                addDeclaration(decls, parseDeclaration(lex, token));
+                break;
+            case PrintOp:
+            case Alphabet:
+            case Repeat:
+            case EOFsymbol:
+                return;
+            default:
+                fail("Syntax Error: Expect declarations %.*s\n", token.length, token.start);
+        }
+    }
 }
 
-Expression *parseValue( FILE *source )
+Expression *parseValue( Lexer *lex )
 {
-    Token token = scanner(source);
-    Expression *value = (Expression *)malloc( sizeof(Expression) );
-    value->leftOperand = value->rightOperand = NULL;
+    Token token = nextToken(lex);
+    Expression *value;
+
+    if(token.type == LeftParen){
+        value = parseExpression(lex, 1);
+        token = nextToken(lex);
+        if(token.type != RightParen){
+            fail("Syntax Error: Expect ) %.*s\n", token.length, token.start);
+        }
+        return value;
+    }
 
     switch(token.type){
         case Alphabet:
-            (value->v).type = Identifier;
+            value = makeExpressionNode(Identifier);
             //(value->v).val.id = token.tok[0];
-			memcpy((value->v).val.id, token.tok, strlen(token.tok)+1);//EDITED2
+			token_name(token, (value->v).val.id);//EDITED2
             break;
         case IntValue:
-            (value->v).type = IntConst;
-            (value->v).val.ivalue = atoi(token.tok);
+            value = makeExpressionNode(IntConst);
+            (value->v).val.ivalue = token.ivalue;
             break;
         case FloatValue:
-            (value->v).type = FloatConst;
-            (value->v).val.fvalue = atof(token.tok);
+            value = makeExpressionNode(FloatConst);
+            (value->v).val.fvalue = token.fvalue;
+            (value->v).scale = 1;
             break;
         default:
-            printf("Syntax Error: Expect Identifier or a Number %s\n", token.tok);
-            exit(1);
+            fail("Syntax Error: Expect Identifier or a Number %.*s\n", token.length, token.start);
     }
 
     return value;
 }
 
-Expression *parseExpressionTail( FILE *source, Expression *lvalue )
-{
-    Token token = scanner(source);
-    Expression *expr;
-
-    switch(token.type){
-        case PlusOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = PlusNode;
-            (expr->v).val.op = Plus;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpressionTail(source, expr);
-        case MinusOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = MinusNode;
-            (expr->v).val.op = Minus;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpressionTail(source, expr);
-        case Alphabet:
-        case PrintOp:
-            //ungetc(token.tok[0], source);
-            ungets(token.tok, source);//EDITED2
-            return lvalue;
-        case EOFsymbol:
-            return lvalue;
-        default:
-            printf("Syntax Error: Expect a numeric value or an identifier %s\n", token.tok);
-            exit(1);
-    }
-}
-
-Expression *parseExpressionPlus( FILE *source, Expression *lvalue )
+/* precedence climbing: operators binding tighter than minPrec stay in this subtree */
+Expression *parseExpression( Lexer *lex, int minPrec )
 {
-    Token token = scanner(source);
-    Expression *expr;
+    Expression *lvalue = parseValue(lex), *expr, *right;
+    const OperatorInfo *info;
+    Token token;
 
-    switch(token.type){
-        case MulOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = MulNode;
-            (expr->v).val.op = Mul;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpressionPlus(source, expr);
-        case DivOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = DivNode;
-            (expr->v).val.op = Div;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpressionPlus(source, expr);
-        case PlusOp:
-            ungetc(token.tok[0], source);
-            return lvalue;
-        case MinusOp:
-            ungetc(token.tok[0], source);
-            return lvalue;
-        case Alphabet:
-        case PrintOp:
-            //ungetc(token.tok[0], source);
-            ungets(token.tok, source);//EDITED2
-			
-            return lvalue;
-        case EOFsymbol:
+    while(1){
+        token = peekToken(lex);
+        info = &operators[token.type];
+
+        if(info->precedence == 0){
+            switch(token.type){
+                case Alphabet:
+                case PrintOp:
+                case RightParen:
+                case Repeat:
+                case RightBrace:
+                case EOFsymbol:
+                    return lvalue;
+                default:
+                    fail("Syntax Error: Expect a numeric value or an identifier %.*s\n", token.length, token.start);
+            }
+        }
+        if(info->precedence < minPrec)
             return lvalue;
-        default:
-            printf("Syntax Error: Expect a numeric value or an identifier %s\n", token.tok);
-            exit(1);
-    }
-}
-
-
-Expression *parseExpression( FILE *source, Expression *lvalue )
-{
-    Token token = scanner(source);
-    Expression *expr, *value;
-
-    switch(token.type){
-		case MulOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = MulNode;
-            (expr->v).val.op = Mul;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpression(source, expr);
 
-		case DivOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = DivNode;
-            (expr->v).val.op = Div;
-            expr->leftOperand = lvalue;
-            expr->rightOperand = parseValue(source);
-            return parseExpression(source, expr);
+        nextToken(lex);
+        right = parseExpression(lex, info->precedence + 1);//left associative
 
-        case PlusOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = PlusNode;
-            (expr->v).val.op = Plus;
+        if(info->chain == info->node){/* not associative, stays a binary node */
+            expr = makeExpressionNode(info->node);
+            (expr->v).val.op = info->op;
             expr->leftOperand = lvalue;
-			value = parseValue(source);
-			expr->rightOperand = parseExpressionPlus(source, value);
-			return parseExpression(source, expr);
-//            expr->rightOperand = parseValue(source);
-//            return parseExpressionTail(source, expr);
-
-        case MinusOp:
-            expr = (Expression *)malloc( sizeof(Expression) );
-            (expr->v).type = MinusNode;
-            (expr->v).val.op = Minus;
-            expr->leftOperand = lvalue;
-			value = parseValue(source);
-			expr->rightOperand = parseExpressionPlus(source, value);
-			return parseExpression(source, expr);
-
-//            expr->rightOperand = parseValue(source);
-//            return parseExpressionTail(source, expr);
-
-        case Alphabet:
-        case PrintOp:
-//            ungetc(token.tok[0], source);
-            ungets(token.tok, source);//EDITED2
-            return lvalue;
-//            return NULL;
-        case EOFsymbol:
-            return lvalue;
-//            return NULL;
-        default:
-            printf("Syntax Error: Expect a numeric value or an identifier %s\n", token.tok);
-            exit(1);
+            expr->rightOperand = right;
+            lvalue = expr;
+        }
+        else{/* a + b - c becomes one SumNode with three operands */
+            if((lvalue->v).type != info->chain){
+                expr = makeExpressionNode(info->chain);
+                (expr->v).val.op = info->op;
+                addOperand(expr, lvalue, false);
+                lvalue = expr;
+            }
+            addOperand(lvalue, right, info->node == MinusNode);
+        }
     }
 }
 
-Statement parseStatement( FILE *source, Token token )
+void parseStatement( Lexer *lex, Token token, Statements *stmts )
 {
     Token next_token;
-    Expression *value, *expr;
+    Expression *expr;
+    char registers[3], name[65];
+
     switch(token.type){
         case Alphabet:
-            next_token = scanner(source);
+            next_token = nextToken(lex);
             if(next_token.type == AssignmentOp){
-                value = parseValue(source);
-                expr = parseExpression(source, value);
+                token_name(token, name);
+                expr = parseExpression(lex, 1);
 //                return makeAssignmentNode(token.tok[0], expr);
-                return makeAssignmentNode(token.tok, expr);//EDITED
+                addAssignment(stmts, name, expr);//EDITED
+                return;
             }
             else{
-                printf("Syntax Error: Expect an assignment op %s\n", next_token.tok);//cloven foot?!
-                exit(1);
+                fail("Syntax Error: Expect an assignment op %.*s\n", next_token.length, next_token.start);//cloven foot?!
             }
         case PrintOp:
-            next_token = scanner(source);
-            if(next_token.type == Alphabet)
+            next_token = nextToken(lex);
+            if(next_token.type == Alphabet){
 //                return makePrintNode(next_token.tok[0]);
-                return makePrintNode(next_token.tok);//EDITED2
+                token_name(next_token, name);
+                addPrint(stmts, name);//EDITED2
+            }
             else{
-                printf("Syntax Error: Expect an identifier %s\n", next_token.tok);
-                exit(1);
+                fail("Syntax Error: Expect an identifier %.*s\n", next_token.length, next_token.start);
+            }
+            break;
+        case Repeat:/* repeat N { starts a loop, its body follows as statements of its own */
+            next_token = nextToken(lex);
+            if(next_token.type != IntValue || next_token.ivalue <= 0)
+                fail("Syntax Error: Expect a positive count %.*s\n", next_token.length, next_token.start);
+            expr = makeExpressionNode(IntConst);
+            (expr->v).val.ivalue = next_token.ivalue;
+            next_token = nextToken(lex);
+            if(next_token.type != LeftBrace){
+                FreeExpression(expr);
+                fail("Syntax Error: Expect { %.*s\n", next_token.length, next_token.start);
             }
+            if(lex->depth == MaxLoopDepth){
+                FreeExpression(expr);
+                fail("Syntax Error: Loops nested too deep %.*s\n", next_token.length, next_token.start);
+            }
+            registers[0] = LoopCounter(lex->depth);
+            registers[1] = LoopMacro(lex->depth);
+            registers[2] = '\0';
+            lex->depth++;
+            addRepeatStart(stmts, registers, expr);
+            break;
+        case RightBrace:
+            if(lex->depth == 0)
+                fail("Syntax Error: Expect a statement %.*s\n", token.length, token.start);
+            lex->depth--;
+            registers[0] = LoopCounter(lex->depth);
+            registers[1] = LoopMacro(lex->depth);
+            registers[2] = '\0';
+            addRepeatEnd(stmts, registers);
             break;
         default:
-            printf("Syntax Error: Expect a statement %s\n", token.tok);
-            exit(1);
+            fail("Syntax Error: Expect a statement %.*s\n", token.length, token.start);
     }
 }
 
-Statements *parseStatements( FILE * source )
+/* false at the end of the program */
+bool parseNextStatement( Lexer *lex, Statements *stmts )
 {
-
-    Token token = scanner(source);
-    Statement stmt;
-    Statements *stmts;
+    Token token = nextToken(lex);
 
     switch(token.type){
         case Alphabet:
         case PrintOp:
-            stmt = parseStatement(source, token);
-            stmts = parseStatements(source);
-            return makeStatementTree(stmt , stmts);
+        case Repeat:
+        case RightBrace:
+            parseStatement(lex, token, stmts);
+            return true;
         case EOFsymbol:
-            return NULL;
+            if(lex->depth > 0)
+                fail("Syntax Error: Expect } %.*s\n", token.length, token.start);
+            return false;
         default:
-            printf("Syntax Error: Expect statements %s\n", token.tok);
-            exit(1);
+            fail("Syntax Error: Expect statements %.*s\n", token.length, token.start);
     }
 }
 
+void parseStatements( Lexer *lex, Statements *stmts )
+{
+    while(parseNextStatement(lex, stmts));
+}
+
+/*
+   Parallel front-end for one large program. The declarations are parsed
+   first, then the statement section is cut into byte ranges that each
+   start at a statement and are parsed on their own threads.
+   A statement starts at every p, and at every identifier followed by =
+   unless it is the variable of a print, so a cut can be moved forward to
+   the next statement by looking at a few tokens. Inside a repeat loop it
+   could not tell how deep the cut is, so programs with loops parse serially.
+*/
+#define MinChunkSize (1 << 20)
+
+static bool is_number_char( char c )
+{
+    return char_class[(unsigned char)c] == CharDigit || c == '.';
+}
+
+/* the first statement at or after p, or end; never fails, errors are left to the parser */
+const char *statementBoundary( const char *text, const char *p, const char *end )
+{
+    const char *word, *q;
+    bool afterPrint;
+
+    /* finish the token p points into */
+    if(p > text && char_class[(unsigned char)p[-1]] == CharLower)
+        p = span_lower_scalar(p, end);
+    else if(p > text && is_number_char(p[-1]))
+        while(p < end && is_number_char(*p)) p++;
+
+    /* is the previous token a p */
+    for(q = p; q > text && char_class[(unsigned char)q[-1]] == CharSpace; q--);
+    afterPrint = (q > text && q[-1] == 'p' && (q - 1 == text || char_class[(unsigned char)q[-2]] != CharLower));
+
+    while(p < end){
+        switch(char_class[(unsigned char)*p]){
+            case CharSpace:
+                p++;
+                continue;
+            case CharLower:
+                word = p;
+                p = span_lower_scalar(p, end);
+                if(p - word == 1 && *word == 'p')
+                    return word;
+                q = skip_space_scalar(p, end);
+                if(q < end && *q == '=' && !afterPrint)
+                    return word;
+                break;
+            case CharDigit:
+                while(p < end && is_number_char(*p)) p++;
+                break;
+            default:
+                p++;
+                break;
+        }
+        afterPrint = false;
+    }
+    return end;
+}
+
+void *parseChunk( void *arg )
+{
+    Chunk *chunk = arg;
+    Context ctx;
+    Lexer lex;
+
+    joinPhase(&chunk->counting);
+    ctx.diag = NULL;/* the serial parse reports the error */
+    if(setjmp(ctx.fail)){
+        current = NULL;
+        chunk->failed = true;
+        return NULL;
+    }
+    current = &ctx;
+    InitializeLexer(&lex, chunk->begin, chunk->end - chunk->begin);
+    parseStatements(&lex, &chunk->statements);
+    countTokens(&lex);
+    current = NULL;
+    return NULL;
+}
+
+void parseStatementsParallel( Lexer *lex, Statements *stmts, int threads )
+{
+    Context *caller = current;
+    const char *start, *end = lex->end;
+    Chunk *chunks;
+    pthread_t *workers;
+    int i, j, n;
+    size_t size;
+
+    start = peekToken(lex).start;
+    size = end - start;
+    n = threads;
+    if(size / MinChunkSize < (size_t)n)
+        n = size / MinChunkSize;
+    if(n <= 1 || memchr(start, '{', size) != NULL){
+        parseStatements(lex, stmts);
+        return;
+    }
+
+    chunks = calloc(n, sizeof(Chunk));
+    workers = malloc(n * sizeof(pthread_t));
+    chunks[0].begin = start;
+    for(i = 1; i < n; i++){
+        chunks[i].begin = statementBoundary(start, start + size / n * i, end);
+        if(chunks[i].begin < chunks[i - 1].begin)
+            chunks[i].begin = chunks[i - 1].begin;
+        chunks[i - 1].end = chunks[i].begin;
+    }
+    chunks[n - 1].end = end;
+    for(i = 0; i < n; i++)
+        chunks[i].counting = counting();
+
+    for(i = 0; i < n; i++)
+        pthread_create(&workers[i], NULL, parseChunk, &chunks[i]);
+    for(i = 0; i < n; i++)
+        pthread_join(workers[i], NULL);
+    current = caller;
+
+    for(i = 0; i < n && !chunks[i].failed; i++);
+    if(i < n){
+        /* parse again from the first bad chunk, so the error is the one a serial parse reports */
+        for(j = i; j < n; j++)
+            FreeStatements(&chunks[j].statements);
+        lex->cur = chunks[i].begin;
+        lex->hasPeek = false;
+        n = i;
+    }
+    else
+        lex->cur = end;
+
+    /* statements of the good chunks, in order */
+    for(i = 0; i < n; i++){
+        Statements *part = &chunks[i].statements;
+        int base = stmts->count;
+        while(stmts->capacity < base + part->count){
+            stmts->capacity = stmts->capacity ? stmts->capacity * 2 : 64;
+            stmts->kind = reallocate(stmts->kind, stmts->capacity * sizeof(StmtType));
+            stmts->target = reallocate(stmts->target, stmts->capacity * sizeof(*stmts->target));
+            stmts->expr = reallocate(stmts->expr, stmts->capacity * sizeof(Expression *));
+            stmts->type = reallocate(stmts->type, stmts->capacity * sizeof(DataType));
+        }
+        memcpy(stmts->kind + base, part->kind, part->count * sizeof(StmtType));
+        memcpy(stmts->target + base, part->target, part->count * sizeof(*stmts->target));
+        memcpy(stmts->expr + base, part->expr, part->count * sizeof(Expression *));
+        memcpy(stmts->type + base, part->type, part->count * sizeof(DataType));
+        stmts->count += part->count;
+        releaseHeap(part->kind);/* a worker thread has no arena */
+        releaseHeap(part->target);
+        releaseHeap(part->expr);
+        releaseHeap(part->type);
+    }
+    free(chunks);
+    free(workers);
+
+    if(lex->cur != end)
+        parseStatements(lex, stmts);
+}
+
 
 /*********************************************************************
   Build AST
@@ -462,75 +1054,161 @@ Declaration makeDeclarationNode( Token declare_type, Token identifier )
             break;
     }
 //    tree_node.name = identifier.tok[0];
-    memcpy(tree_node.name, identifier.tok, strlen(identifier.tok)+1);//EDITED2
+    token_name(identifier, tree_node.name);//EDITED2
 
     return tree_node;
 }
 
-Declarations *makeDeclarationTree( Declaration decl, Declarations *decls )
+/* site is the function that wants the node, see the makeExpressionNode macro */
+Expression *makeExpressionNodeAt( ValueType type, const char *site )
 {
-    Declarations *new_tree = (Declarations *)malloc( sizeof(Declarations) );
-    new_tree->first = decl;
-    new_tree->rest = decls;
+    Expression *expr = allocateAt( sizeof(Expression), site );
 
-    return new_tree;
+    countStat(nodes[type], 1);
+    (expr->v).type = type;
+    expr->type = Notype;
+    return expr;
 }
 
+/* append one term to a SumNode or ProductNode */
+void addOperand( Expression *chain, Expression *operand, bool negate )
+{
+    if(chain->count == chain->capacity){
+        chain->capacity = chain->capacity ? chain->capacity * 2 : 4;
+        chain->operands = reallocate(chain->operands, chain->capacity * sizeof(Operand));
+    }
+    chain->operands[chain->count].expr = operand;
+    chain->operands[chain->count].negate = negate;
+    chain->count++;
+}
 
-//Statement makeAssignmentNode( char id, Expression *expr_tail )
-Statement makeAssignmentNode( char *id, Expression *expr_tail )
-{//EDITED2
-    Statement stmt;
-    AssignmentStatement assign;
-
-    stmt.type = Assignment;
-//    assign.id = id;
-    memcpy(assign.id, id, strlen(id)+1);//EDITED2
-    assign.expr = expr_tail;
-    stmt.stmt.assign = assign;
+void addDeclaration( Declarations *decls, Declaration decl )
+{
+    if(decls->count == decls->capacity){
+        decls->capacity = decls->capacity ? decls->capacity * 2 : 16;
+        decls->items = reallocate(decls->items, decls->capacity * sizeof(Declaration));
+    }
+    decls->items[decls->count++] = decl;
+}
 
-    return stmt;
+/* one slot at the end of every column, allocated for site, the function that adds the statement */
+static int growStatementsAt( Statements *stmts, const char *site )
+{
+    if(stmts->count == stmts->capacity){
+        stmts->capacity = stmts->capacity ? stmts->capacity * 2 : 64;
+        stmts->kind = reallocateAt(stmts->kind, stmts->capacity * sizeof(StmtType), site);
+        stmts->target = reallocateAt(stmts->target, stmts->capacity * sizeof(*stmts->target), site);
+        stmts->expr = reallocateAt(stmts->expr, stmts->capacity * sizeof(Expression *), site);
+        stmts->type = reallocateAt(stmts->type, stmts->capacity * sizeof(DataType), site);
+    }
+    return stmts->count++;
 }
+#define growStatements(stmts) growStatementsAt((stmts), __func__)
 
-//Statement makePrintNode( char id )
-//{
-//    Statement stmt;
-//    stmt.type = Print;
-//    stmt.stmt.variable = id;
-//
-//    return stmt;
-//}
+//EDITED2
+void addAssignment( Statements *stmts, char *id, Expression *expr_tail )
+{
+    int i = growStatements(stmts);
+
+    stmts->kind[i] = Assignment;
+    memcpy(stmts->target[i], id, strlen(id)+1);//EDITED2
+    stmts->expr[i] = expr_tail;
+    stmts->type[i] = Notype;
+}
 
 //EDITED2
-Statement makePrintNode( char *id )
+void addPrint( Statements *stmts, char *id )
 {
-    Statement stmt;
-    stmt.type = Print;
-	memcpy(stmt.stmt.variable, id, strlen(id)+1);//EDITED2
+    int i = growStatements(stmts);
 
-    return stmt;
+    stmts->kind[i] = Print;
+    memcpy(stmts->target[i], id, strlen(id)+1);//EDITED2
+    stmts->expr[i] = NULL;
+    stmts->type[i] = Notype;
 }
 
-Statements *makeStatementTree( Statement stmt, Statements *stmts )
+void addRepeatStart( Statements *stmts, char *registers, Expression *count )
 {
-    Statements *new_tree = (Statements *)malloc( sizeof(Statements) );
-    new_tree->first = stmt;
-    new_tree->rest = stmts;
+    int i = growStatements(stmts);
 
-    return new_tree;
+    stmts->kind[i] = RepeatStart;
+    memcpy(stmts->target[i], registers, strlen(registers)+1);
+    stmts->expr[i] = count;
+    stmts->type[i] = Notype;
+}
+
+void addRepeatEnd( Statements *stmts, char *registers )
+{
+    int i = growStatements(stmts);
+
+    stmts->kind[i] = RepeatEnd;
+    memcpy(stmts->target[i], registers, strlen(registers)+1);
+    stmts->expr[i] = NULL;
+    stmts->type[i] = Notype;
 }
 
 /* parser */
 Program parser( FILE *source )
 {
     Program program;
+    size_t len;
+    char *text = read_source(source, &len);
 
-    program.declarations = parseDeclarations(source);//makeDeclarationTree has malloc
-    program.statements = parseStatements(source);//makeStatementTree has malloc
+    program = parseText(text, len, 1);
+    free(text);
 
     return program;
 }
 
+Program parseText( const char *text, size_t len, int threads )
+{
+    Program program;
+    Lexer lex;
+
+    memset(&program, 0, sizeof(program));
+    InitializeLexer(&lex, text, len);
+    parseDeclarations(&lex, &program.declarations);
+    if(threads > 1)
+        parseStatementsParallel(&lex, &program.statements, threads);
+    else
+        parseStatements(&lex, &program.statements);
+    countTokens(&lex);
+
+    return program;
+}
+
+void FreeExpression( Expression *expr )
+{
+    int i;
+
+    if(expr == NULL)
+        return;
+    for(i = 0; i < expr->count; i++)
+        FreeExpression(expr->operands[i].expr);
+    release(expr->operands);
+    FreeExpression(expr->leftOperand);
+    FreeExpression(expr->rightOperand);
+    release(expr);
+}
+
+void FreeStatements( Statements *stmts )
+{
+    int i;
+
+    for(i = 0; i < stmts->count; i++)
+        FreeExpression(stmts->expr[i]);
+    release(stmts->kind);
+    release(stmts->target);
+    release(stmts->expr);
+    release(stmts->type);
+}
+
+void FreeProgram( Program *program )
+{
+    FreeStatements(&program->statements);
+    release(program->declarations.items);
+}
+
 
 /********************************************************
   Build symbol table
@@ -547,20 +1225,30 @@ void InitializeTable( SymbolTable *table )
 HashMap* InitializeMap(int size)
 {
 	/* create */	
-	HashMap *map = calloc(1, sizeof(HashMap));
+	HashMap *map = allocate(sizeof(HashMap));
 	map->size = size;
-	map->storage = calloc(size, sizeof(HashNode*));//HashNode allocate!!//error: expected expression before ‘HashNode’
+	map->storage = allocate(size * sizeof(HashNode*));//HashNode allocate!!//error: expected expression before ‘HashNode’
 
 	/* initialize */
 	int i;
 	for(i = 0; i < size; i++){
-		map->storage[i] = calloc(1, sizeof(HashNode));//important!! Modified. In order to initialize the value
+		map->storage[i] = allocate(sizeof(HashNode));//important!! Modified. In order to initialize the value
 //		map->storage[i]->key = calloc(65, sizeof(char));//BUG!!! don't forget to allocate space for it! (alternative solution)
 		map->storage[i]->type = Notype;//map->storage[i] is a pointer to HashNode
 	}
 	return map;
 }
 
+void FreeMap( HashMap *map )
+{
+	int i;
+
+	for(i = 0; i < map->size; i++)
+		release(map->storage[i]);
+	release(map->storage);
+	release(map);
+}
+
 //void add_table( SymbolTable *table, char c, DataType t )
 //{
 //    int index = (int)(c - 'a');
@@ -582,7 +1270,7 @@ void add_map( HashMap *map, char* key, DataType t )
 	while(map->storage[hashIdx]->type != Notype){//important!! Modified
 
 		if(strcmp(map->storage[hashIdx]->key, key) == 0){
-    	    printf("Error : id %s has been declared\n", key);//error
+    	    report("Error : id %s has been declared\n", key);//error
 			break;//original idea
 		}else{//collision
 			if(hashIdx <= map->size-2){
@@ -629,16 +1317,14 @@ int hash(HashMap *map, char *key)
 HashMap* mybuild( Program program )
 {
 	HashMap* map;
-    Declarations *decls = program.declarations;
-    Declaration current;
+    Declarations *decls = &program.declarations;
+    int i;
 
-    map = InitializeMap(NumsSize * 2);
+    /* at most half full, so probing always ends at an empty node */
+    map = InitializeMap(decls->count > NumsSize ? decls->count * 2 : NumsSize * 2);
 
-    while(decls !=NULL){
-        current = decls->first;
-        add_map(map, current.name, current.type);
-        decls = decls->rest;
-    }
+    for(i = 0; i < decls->count; i++)
+        add_map(map, decls->items[i].name, decls->items[i].type);
 
     return map;
 }
@@ -656,7 +1342,7 @@ HashMap* mybuild( Program program )
 //        return;
 //    }
 //    if(old->type == Int && type == Float){
-//        Expression *tmp = (Expression *)malloc( sizeof(Expression) );
+//        Expression *tmp = allocate( sizeof(Expression) );
 //        if(old->v.type == Identifier)
 //            printf("convert to float %c \n",old->v.val.id);
 //        else
@@ -680,21 +1366,22 @@ HashMap* mybuild( Program program )
 bool isConvertType( Expression * old, DataType type )
 {
     if(old->type == Float && type == Int){
-        printf("error : can't convert float to integer\n");
+        report("error : can't convert float to integer\n");
 //        return;
         return false;//EDITED3
     }
     if(old->type == Int && type == Float){
-        Expression *tmp = (Expression *)malloc( sizeof(Expression) );
+        Expression *tmp = allocate( sizeof(Expression) );
         if(old->v.type == Identifier)
 //            printf("convert to float %c \n",old->v.val.id);
-            printf("convert to float %s \n",old->v.val.id);//EDITED2
+            report("convert to float %s \n",old->v.val.id);//EDITED2
         else
-            printf("convert to float %d \n", old->v.val.ivalue);
-        tmp->v = old->v;
-        tmp->leftOperand = old->leftOperand;
-        tmp->rightOperand = old->rightOperand;
-        tmp->type = old->type;
+            report("convert to float %d \n", old->v.val.ivalue);
+        countStat(nodes[IntToFloatConvertNode], 1);
+        countStat(conversions, 1);
+        *tmp = *old;
+        old->operands = NULL;
+        old->count = old->capacity = 0;
 
         Value v;
         v.type = IntToFloatConvertNode;
@@ -712,10 +1399,10 @@ bool isConvertType( Expression * old, DataType type )
 DataType generalize( Expression *left, Expression *right )
 {
     if(left->type == Float || right->type == Float){
-        printf("generalize : float\n");
+        report("generalize : float\n");
         return Float;
     }
-    printf("generalize : int\n");
+    report("generalize : int\n");
     return Int;
 }
 
@@ -727,28 +1414,38 @@ DataType generalize( Expression *left, Expression *right )
 //    return table->table[id];
 //}
 
+/* the node of key, NULL if it is not declared */
+HashNode *find_map( HashMap *map, char *key )
+{
+	int hashIdx = hash(map, key), probes = 1;
+	HashNode *node = NULL;
+
+	while(map->storage[hashIdx]->type != Notype){
+		if(strcmp(map->storage[hashIdx]->key, key)==0){
+			node = map->storage[hashIdx];
+			break;
+		}
+		if(hashIdx<=map->size-2){
+			hashIdx++;
+		}else{
+			hashIdx = 0;
+		}
+		probes++;
+	}
+	if(stats)
+		countProbes(probes);
+	return node;
+}
+
 //HARD!!
 /*hash_get*/
 DataType lookup_map( HashMap *map, char *key )
 {
-	int hashIdx = hash(map, key);
-	/*important!!*/
-	HashNode *node;
-	while(map->storage[hashIdx]->type != Notype){//collision is not the issue here? No! important!!
-		node = map->storage[hashIdx];//has node
-		if(strcmp(node->key, key)==0){
-//			if(node->type != Int && node->type != Float) 
-//        		printf("Error : identifier %c is not declared\n", c);//error
-			return node->type;		
-		}else{
-			if(hashIdx<=map->size-2){
-				hashIdx++;
-			}else{
-				hashIdx = 0;
-			}
-		}
-	}	
-	printf("Error : identifier %s is not declared\n", key);//error
+	HashNode *node = find_map(map, key);
+
+	if(node != NULL)
+		return node->type;
+	report("Error : identifier %s is not declared\n", key);//error
     return Notype;//not correct, here is hash_get!
 }
 
@@ -789,23 +1486,234 @@ DataType lookup_map( HashMap *map, char *key )
 //    }
 //}
 
+/* the number dc reads for a constant operand, a converted int constant counts too */
+static bool constantNumber( Expression *expr, Number *n )
+{
+    if(expr->v.type == IntToFloatConvertNode)
+        expr = expr->leftOperand;
+    if(expr->v.type == IntConst){
+        number_from_int(n, expr->v.val.ivalue);
+        return true;
+    }
+    return expr->v.type == FloatConst && number_from_float(n, expr->v.val.fvalue, expr->v.scale);
+}
+
+static bool isConversion( Expression *expr )
+{
+    return expr->v.type == IntToFloatConvertNode;
+}
+
+/* the chain node takes over its only operand */
+static void collapseChain( Expression *expr )
+{
+    Expression *only = expr->operands[0].expr;
+    Operand *operands = expr->operands;
+
+    *expr = *only;
+    release(operands);
+    release(only);
+}
+
+/*
+   Int chains are exact in dc, so they may be regrouped: nested chains of the
+   same kind are spliced in and the constants are accumulated into one term,
+   which is placed first. A constant that would make it overflow stays a term.
+*/
+void fold_int_chain( Expression *expr )
+{
+    bool sum = (expr->v.type == SumNode);
+    int acc = sum ? 0 : 1, constants = 0;
+    Operand *old = expr->operands;
+    int i, j, n = expr->count;
+
+    expr->operands = NULL;
+    expr->count = expr->capacity = 0;
+    for(i = 0; i < n; i++){
+        Expression *term = old[i].expr;
+        if(term->v.type == expr->v.type && term->type == Int){
+            for(j = 0; j < term->count; j++)
+                addOperand(expr, term->operands[j].expr, term->operands[j].negate ^ old[i].negate);
+            release(term->operands);
+            release(term);
+        }
+        else if(term->v.type == IntConst &&
+                fold_int(!sum ? MulNode : old[i].negate ? MinusNode : PlusNode, acc, term->v.val.ivalue, &acc)){
+            constants++;
+            release(term);
+        }
+        else
+            addOperand(expr, term, old[i].negate);
+    }
+    release(old);
+    if(constants > 1)
+        countStat(folds, constants - 1);
+
+    if(expr->count == 0){
+        release(expr->operands);
+        expr->operands = NULL;
+        expr->count = expr->capacity = 0;
+        expr->v.type = IntConst;
+        expr->v.val.ivalue = acc;
+        return;
+    }
+
+    if(constants > 0 && acc != (sum ? 0 : 1)){
+        addOperand(expr, NULL, false);
+        memmove(expr->operands + 1, expr->operands, (expr->count - 1) * sizeof(Operand));
+        expr->operands[0].expr = makeExpressionNode(IntConst);
+        expr->operands[0].expr->v.val.ivalue = acc;
+        expr->operands[0].expr->type = Int;
+        expr->operands[0].negate = false;
+    }
+    else if(expr->operands[0].negate){/* dc has no unary minus, lead with a term that is added */
+        for(i = 1; i < expr->count && expr->operands[i].negate; i++);
+        if(i < expr->count){
+            Operand first = expr->operands[i];
+            memmove(expr->operands + 1, expr->operands, i * sizeof(Operand));
+            expr->operands[0] = first;
+        }
+        else{
+            addOperand(expr, NULL, false);
+            memmove(expr->operands + 1, expr->operands, (expr->count - 1) * sizeof(Operand));
+            expr->operands[0].expr = makeExpressionNode(IntConst);
+            expr->operands[0].expr->type = Int;
+            expr->operands[0].negate = false;
+        }
+    }
+
+    if(expr->count == 1)
+        collapseChain(expr);
+}
+
+/*
+   Float chains keep the left to right order of the source, (c1 + c2) + x may
+   be folded but c1 + (x + c2) may not, so only the leading constants are folded,
+   the first two at a time into the first one.
+*/
+static bool fold_float_pair( Expression *expr, int precision )
+{
+    Expression *term;
+    Number x, y;
+    Value v;
+    bool folded;
+
+    if(expr->count < 2)
+        return false;
+    InitializeNumber(&x);
+    InitializeNumber(&y);
+    folded = constantNumber(expr->operands[0].expr, &x) && constantNumber(expr->operands[1].expr, &y) &&
+        fold_number(expr->v.type == ProductNode ? MulNode : expr->operands[1].negate ? MinusNode : PlusNode,
+                Float, &x, &y, precision, &v);
+    FreeNumber(&x);
+    FreeNumber(&y);
+    if(!folded)
+        return false;
+    countStat(folds, 1);
+
+    term = expr->operands[0].expr;
+    if(term->v.type == IntToFloatConvertNode)
+        release(term->leftOperand);
+    term->v = v;
+    term->leftOperand = NULL;
+    term->type = Float;
+
+    term = expr->operands[1].expr;
+    if(term->v.type == IntToFloatConvertNode)
+        release(term->leftOperand);
+    release(term);
+    expr->count--;
+    memmove(expr->operands + 1, expr->operands + 2, (expr->count - 1) * sizeof(Operand));
+    return true;
+}
+
+/* what does not depend on k, the rest is left to fold_in_order */
+void fold_float_chain( Expression *expr )
+{
+    while(expr->count >= 2 && !isConversion(expr->operands[0].expr) && !isConversion(expr->operands[1].expr) &&
+            fold_float_pair(expr, AnyPrecision));
+
+    if(expr->count == 1)
+        collapseChain(expr);
+}
+
+/* type checking of a SumNode or ProductNode */
+void mycheckchain( Expression *expr, HashMap *map )
+{
+    int i, first = -1;
+    Expression *prefix;
+
+    for(i = 0; i < expr->count; i++){
+        mycheckexpression(expr->operands[i].expr, map);
+        if(first < 0 && expr->operands[i].expr->type == Float)
+            first = i;
+    }
+
+    if(first < 0){
+        report("generalize : int\n");
+        expr->type = Int;
+        fold_int_chain(expr);
+        return;
+    }
+
+    report("generalize : float\n");
+    expr->type = Float;
+
+    /* terms before the first float one are evaluated in int and then converted */
+    if(first > 1){
+        prefix = makeExpressionNode(expr->v.type);
+        prefix->v.val.op = expr->v.val.op;
+        prefix->type = Int;
+        for(i = 0; i < first; i++)
+            addOperand(prefix, expr->operands[i].expr, expr->operands[i].negate);
+        fold_int_chain(prefix);
+        expr->operands[0].expr = prefix;
+        expr->operands[0].negate = false;
+        memmove(expr->operands + 1, expr->operands + first, (expr->count - first) * sizeof(Operand));
+        expr->count -= first - 1;
+    }
+
+    for(i = 0; i < expr->count; i++)
+        isConvertType(expr->operands[i].expr, Float);
+    fold_float_chain(expr);
+}
+
+/* a folded node keeps its value, not its operands */
+static void dropOperands( Expression *expr )
+{
+    FreeExpression(expr->leftOperand);
+    FreeExpression(expr->rightOperand);
+    expr->leftOperand = NULL;
+    expr->rightOperand = NULL;
+}
+
 //EDITED3
 void mycheckexpression( Expression * expr, HashMap *map )
 {
     char str[65];//EDITED2
-    if(expr->leftOperand == NULL && expr->rightOperand == NULL){
+    HashNode *node;
+    if(expr->v.type == SumNode || expr->v.type == ProductNode){
+        mycheckchain(expr, map);
+    }
+    else if(expr->leftOperand == NULL && expr->rightOperand == NULL){
         switch(expr->v.type){
             case Identifier:
                 memcpy(str, expr->v.val.id, strlen(expr->v.val.id)+1);//EDITED2
-                printf("identifier : %s\n",str);//EDITED2
-                expr->type = lookup_map(map, str);//EDITED2
+                report("identifier : %s\n",str);//EDITED2
+                node = find_map(map, str);
+                if(node == NULL)
+                    expr->type = lookup_map(map, str);//EDITED2
+                else{
+                    expr->type = node->type;
+                    if(node->bound)/* a constant from -D, folded like one written in the source */
+                        expr->v = node->value;
+                }
                 break;
             case IntConst:
-                printf("constant : int\n");
+                report("constant : int\n");
                 expr->type = Int;
                 break;
             case FloatConst:
-                printf("constant : float\n");
+                report("constant : float\n");
                 expr->type = Float;
                 break;
                 //case PlusNode: case MinusNode: case MulNode: case DivNode:
@@ -831,35 +1739,144 @@ void mycheckexpression( Expression * expr, HashMap *map )
 		lFlag = isConvertType(left, type);//left->type = type;//EDITED3
 		rFlag = isConvertType(right, type);//right->type = type;//EDITED3
 
-		if(lFlag==true || rFlag==true){
-			if(lFlag && left->leftOperand->v.type == IntConst && right->v.type == FloatConst){
-				calculate_op(expr, lFlag, rFlag); 
-				expr->v.type = FloatConst;
-				expr->leftOperand = NULL;
-				expr->rightOperand = NULL;
-			}
-			if(rFlag && right->leftOperand->v.type == IntConst && left->v.type == FloatConst){
-				calculate_op(expr, lFlag, rFlag); 
-				expr->v.type = FloatConst;
-				expr->leftOperand = NULL;
-				expr->rightOperand = NULL;
+		/* what depends on k or takes a conversion away is left to fold_in_order */
+		if(!lFlag && !rFlag && calculate_op(expr, AnyPrecision))
+			dropOperands(expr);
+    }
+}
 
-			}
-		}else{
-			if(left->v.type == IntConst && right->v.type == IntConst){
-				calculate_op(expr, lFlag, rFlag); 
-				expr->v.type = IntConst;
-				expr->leftOperand = NULL;
-				expr->rightOperand = NULL;
+/*
+   A * or / of floats and an int / depend on k, which is 0 when a statement
+   starts and 5 from its first conversion on, see fprint_expr. They are
+   folded once the statement is checked, walking it in the order it is
+   printed. Folding a conversion away takes its 5k away as well, so that is
+   only done when k was 5 already, or when the next * or / printed after
+   it comes after another 5k or not at all.
+*/
+typedef struct FoldFrame{
+    Expression *expr;
+    int next;                   /* the operands from next on are printed after the one being walked */
+    struct FoldFrame *up;
+}FoldFrame;
 
-			}
-			if(left->v.type == FloatConst && right->v.type == FloatConst){
-				calculate_op(expr, lFlag, rFlag); 
-				expr->v.type = FloatConst;
-				expr->leftOperand = NULL;
-				expr->rightOperand = NULL;
-			}
-		}
+/* a * of floats or a /, what it computes depends on k; an int * does not */
+static bool scales( Expression *expr )
+{
+    return expr->v.type == DivNode || ((expr->v.type == MulNode || expr->v.type == ProductNode) && expr->type == Float);
+}
+
+/* 1 if expr prints a * or / that scales before any 5k, -1 if a 5k comes first, 0 if it prints neither */
+static int firstScaling( Expression *expr )
+{
+    int i, first;
+
+    if(expr->v.type == SumNode || expr->v.type == ProductNode){
+        for(i = 0; i < expr->count; i++){
+            if((first = firstScaling(expr->operands[i].expr)) != 0)
+                return first;
+            if(i > 0 && scales(expr))
+                return 1;
+        }
+        return 0;
+    }
+    if(expr->leftOperand != NULL && (first = firstScaling(expr->leftOperand)) != 0)
+        return first;
+    if(expr->rightOperand != NULL && (first = firstScaling(expr->rightOperand)) != 0)
+        return first;
+    if(scales(expr))
+        return 1;
+    return expr->v.type == IntToFloatConvertNode ? -1 : 0;
+}
+
+/* the same for the operands of a chain from the one at from on, with the operator printed after each */
+static int firstScalingFrom( Expression *chain, int from )
+{
+    int i, first;
+
+    for(i = from; i < chain->count; i++){
+        if((first = firstScaling(chain->operands[i].expr)) != 0)
+            return first;
+        if(scales(chain))
+            return 1;
+    }
+    return 0;
+}
+
+/* is a * or / that scales printed after the operand being walked before k is 5 again */
+static bool scalesAfter( FoldFrame *frame )
+{
+    Expression *expr;
+    int first = 0;
+
+    for(; frame != NULL && first == 0; frame = frame->up){
+        expr = frame->expr;
+        if(expr->v.type == ProductNode && frame->next > 1 && scales(expr))/* the * after the operand */
+            first = 1;
+        else if(expr->v.type == SumNode || expr->v.type == ProductNode)
+            first = firstScalingFrom(expr, frame->next);
+        else if(expr->v.type == IntToFloatConvertNode)
+            first = -1;
+        else if(frame->next == 1 && (first = firstScaling(expr->rightOperand)) == 0)
+            first = scales(expr);
+        else if(frame->next == 2)
+            first = scales(expr);
+    }
+    return first > 0;
+}
+
+/* the same for the first two operands of a chain, which are folded into one */
+static bool scalesAfterPair( Expression *chain, FoldFrame *up )
+{
+    int first = firstScalingFrom(chain, 2);
+
+    return first != 0 ? first > 0 : scalesAfter(up);
+}
+
+/* precision tells whether a 5k has been printed in the statement so far */
+static void fold_in_order( Expression *expr, bool *precision, FoldFrame *up )
+{
+    FoldFrame frame = { expr, 1, up };
+    bool before = *precision, consumes, changed = false, wasConst;
+    int i;
+
+    if(expr->v.type == SumNode || expr->v.type == ProductNode){
+        wasConst = expr->operands[0].expr->v.type == IntConst;
+        fold_in_order(expr->operands[0].expr, precision, &frame);
+        changed = !wasConst && expr->operands[0].expr->v.type == IntConst;
+        for(i = 1; i < expr->count; ){
+            frame.next = i + 1;
+            wasConst = expr->operands[i].expr->v.type == IntConst;
+            fold_in_order(expr->operands[i].expr, precision, &frame);
+            changed |= !wasConst && expr->operands[i].expr->v.type == IntConst;
+            if(i == 1 && expr->type == Float){
+                consumes = isConversion(expr->operands[0].expr) || isConversion(expr->operands[1].expr);
+                if((!consumes || before || !scalesAfterPair(expr, up)) && fold_float_pair(expr, *precision ? 5 : 0)){
+                    if(consumes)
+                        *precision = before;
+                    continue;
+                }
+            }
+            i++;
+        }
+        if(expr->count == 1)
+            collapseChain(expr);
+        else if(changed && expr->type == Int)/* an int / became a constant */
+            fold_int_chain(expr);
+    }
+    else if(expr->leftOperand != NULL && expr->rightOperand != NULL){
+        fold_in_order(expr->leftOperand, precision, &frame);
+        frame.next = 2;
+        fold_in_order(expr->rightOperand, precision, &frame);
+        consumes = isConversion(expr->leftOperand) || isConversion(expr->rightOperand);
+        if((!consumes || before || !scalesAfter(up)) && calculate_op(expr, *precision ? 5 : 0)){
+            dropOperands(expr);
+            if(consumes)
+                *precision = before;
+        }
+    }
+    else if(expr->leftOperand != NULL){
+        fold_in_order(expr->leftOperand, precision, &frame);
+        *precision = true;
     }
 }
 
@@ -884,24 +1901,41 @@ void mycheckexpression( Expression * expr, HashMap *map )
 //}
 
 //EDITED
-void mycheckstmt( Statement *stmt, HashMap * map )
-{
-    if(stmt->type == Assignment){
-        AssignmentStatement assign = stmt->stmt.assign;
-        printf("assignment : %s \n",assign.id);//EDITED2
-        mycheckexpression(assign.expr, map);
-        stmt->stmt.assign.type = lookup_map(map, assign.id);
-        if (assign.expr->type == Float && stmt->stmt.assign.type == Int) {
-            printf("error : can't convert float to integer\n");
+void mycheckstmt( Statements *stmts, int i, HashMap * map )
+{
+    HashNode *node;
+    bool precision;
+
+    if(stmts->kind[i] == Assignment){
+        Expression *expr = stmts->expr[i];
+        report("assignment : %s \n",stmts->target[i]);//EDITED2
+        mycheckexpression(expr, map);
+        stmts->type[i] = lookup_map(map, stmts->target[i]);
+        node = find_map(map, stmts->target[i]);
+        if(node != NULL && node->bound)
+            report("Error : id %s is bound at compile time\n", stmts->target[i]);
+        if (expr->type == Float && stmts->type[i] == Int) {
+            report("error : can't convert float to integer\n");
         } else {
-            isConvertType(assign.expr, stmt->stmt.assign.type);//EDITED3
+            isConvertType(expr, stmts->type[i]);//EDITED3
         }
+        precision = false;
+        fold_in_order(expr, &precision, NULL);
     }
-    else if (stmt->type == Print){
-        printf("print : %s \n",stmt->stmt.variable);//EDITED2
-        lookup_map(map, stmt->stmt.variable);
+    else if (stmts->kind[i] == Print){
+        report("print : %s \n",stmts->target[i]);//EDITED2
+        lookup_map(map, stmts->target[i]);
+        node = find_map(map, stmts->target[i]);
+        if(node != NULL && node->bound && stmts->expr[i] == NULL){/* print the constant itself */
+            stmts->expr[i] = makeExpressionNode(node->value.type);
+            stmts->expr[i]->v = node->value;
+            stmts->expr[i]->type = node->type;
+        }
     }
-    else printf("error : statement error\n");//error
+    else if (stmts->kind[i] == RepeatStart)
+        report("repeat : %d \n", stmts->expr[i]->v.val.ivalue);
+    else if (stmts->kind[i] != RepeatEnd)
+        report("error : statement error\n");//error
 }
 
 
@@ -916,10 +1950,13 @@ void mycheckstmt( Statement *stmt, HashMap * map )
 
 void mycheck( Program *program, HashMap * map )
 {
-    Statements *stmts = program->statements;
-    while(stmts != NULL){
-        mycheckstmt(&stmts->first,map);
-        stmts = stmts->rest;
+    Statements *stmts = &program->statements;
+    int i;
+
+    for(i = 0; i < stmts->count; i++){
+        if(i + 8 < stmts->count && stmts->expr[i + 8] != NULL)
+            __builtin_prefetch(stmts->expr[i + 8]);
+        mycheckstmt(stmts, i, map);
     }
 }
 
@@ -949,82 +1986,132 @@ void fprint_op( FILE *target, ValueType op )
 }
 
 //EDITED3
-void calculate_op( Expression *expr, bool lFlag, bool rFlag )
-{
-	Expression *left = expr->leftOperand;
-	Expression *right = expr->rightOperand;
-	bool isInt;
-	if(expr->type==Int){
-		isInt = true;
-	}else if(expr->type==Float){
-		isInt = false;
-	}
-    switch(expr->v.type){
-		case MulNode://EDITED1
-			if(!(lFlag^rFlag)){
-				(isInt)?\
-				(expr->v.val.ivalue = left->v.val.ivalue * right->v.val.ivalue):\
-				(expr->v.val.fvalue = left->v.val.fvalue * right->v.val.fvalue); 
-			}else if(lFlag){
-				expr->v.val.fvalue = left->leftOperand->v.val.ivalue * right->v.val.fvalue;
-			}else{
-				expr->v.val.fvalue = left->v.val.fvalue * right->leftOperand->v.val.ivalue;
-			}	
-            break;
-        case DivNode://EDITED1
-			if(!(lFlag^rFlag)){
-				(isInt)?\
-				(expr->v.val.ivalue = left->v.val.ivalue / right->v.val.ivalue):\
-				(expr->v.val.fvalue = left->v.val.fvalue / right->v.val.fvalue); 
-			}else if(lFlag){
-				expr->v.val.fvalue = left->leftOperand->v.val.ivalue / right->v.val.fvalue;
-			}else{
-				expr->v.val.fvalue = left->v.val.fvalue / right->leftOperand->v.val.ivalue;
-			}	
-            break;
-        case MinusNode:
-			if(!(lFlag^rFlag)){
-				(isInt)?\
-				(expr->v.val.ivalue = left->v.val.ivalue - right->v.val.ivalue):\
-				(expr->v.val.fvalue = left->v.val.fvalue - right->v.val.fvalue); 
-			}else if(lFlag){
-				expr->v.val.fvalue = left->leftOperand->v.val.ivalue - right->v.val.fvalue;
-			}else{
-				expr->v.val.fvalue = left->v.val.fvalue - right->leftOperand->v.val.ivalue;
-			}	
-            break;
-        case PlusNode:
-			if(!(lFlag^rFlag)){
-				(isInt)?\
-				(expr->v.val.ivalue = left->v.val.ivalue + right->v.val.ivalue):\
-				(expr->v.val.fvalue = left->v.val.fvalue + right->v.val.fvalue); 
-			}else if(lFlag){
-				expr->v.val.fvalue = left->leftOperand->v.val.ivalue + right->v.val.fvalue;
-			}else{
-				expr->v.val.fvalue = left->v.val.fvalue + right->leftOperand->v.val.ivalue;
-			}	
-            break;
+/* x op y if it fits in an int; dc does not wrap around, so the rest is left to it */
+bool fold_int( ValueType op, int x, int y, int *r )
+{
+    int value;
+    bool overflow;
+
+    switch(op){
+        case PlusNode: overflow = __builtin_add_overflow(x, y, &value); break;
+        case MinusNode: overflow = __builtin_sub_overflow(x, y, &value); break;
+        case MulNode: overflow = __builtin_mul_overflow(x, y, &value); break;
         default:
-            printf("Error in calculate_op ValueType = %d\n",expr->v.type);
+            overflow = (y == 0 || (x == INT_MIN && y == -1));
+            if(!overflow) value = x / y;
             break;
     }
+    if(!overflow)/* r is written only when the result fits */
+        *r = value;
+    return !overflow;
+}
+
+/* x op y as dc computes it at the precision into a constant of type, false if no constant prints as that */
+static bool fold_at( ValueType op, DataType type, const Number *x, const Number *y, int precision, Value *result )
+{
+    Number r;
+    bool folded = true;
+
+    InitializeNumber(&r);
+    switch(op){
+        case PlusNode: number_add(&r, x, y); break;
+        case MinusNode: number_sub(&r, x, y); break;
+        case MulNode: number_mul(&r, x, y, precision); break;
+        default: folded = number_div(&r, x, y, precision); break;
+    }
+    if(type == Int){
+        result->type = IntConst;
+        result->scale = 0;
+        folded = folded && number_to_int(&r, &result->val.ivalue);
+    }
+    else{
+        result->type = FloatConst;
+        folded = folded && number_to_float(&r, &result->val.fvalue, &result->scale);
+    }
+    FreeNumber(&r);
+    return folded;
+}
+
+/* precision is 0, 5 or AnyPrecision when it is not known which */
+bool fold_number( ValueType op, DataType type, const Number *x, const Number *y, int precision, Value *result )
+{
+    Value low, high;
+
+    if(precision != AnyPrecision)
+        return fold_at(op, type, x, y, precision, result);
+    if(!fold_at(op, type, x, y, 0, &low) || !fold_at(op, type, x, y, 5, &high) ||
+            (type == Int ? low.val.ivalue != high.val.ivalue :
+                low.val.fvalue != high.val.fvalue || low.scale != high.scale))
+        return false;
+    *result = low;
+    return true;
+}
+
+/* a binary node of two constants becomes the constant dc computes for it; false if it is left as it is */
+bool calculate_op( Expression *expr, int precision )
+{
+    Number x, y;
+    Value v;
+    bool folded;
+
+    InitializeNumber(&x);
+    InitializeNumber(&y);
+    folded = constantNumber(expr->leftOperand, &x) && constantNumber(expr->rightOperand, &y) &&
+        fold_number(expr->v.type, expr->type, &x, &y, precision, &v);
+    FreeNumber(&x);
+    FreeNumber(&y);
+    if(folded){
+        expr->v = v;
+        countStat(folds, 1);
+    }
+    return folded;
+}
+
+
+/* dc reads a leading _ as the sign, - would subtract */
+void fprint_int( FILE *target, int value )
+{
+    if(value < 0)
+        fprintf(target,"_%ld\n",-(long)value);
+    else
+        fprintf(target,"%d\n",value);
 }
 
+/* with the digits after the point dc has for it, which are part of its value for * */
+void fprint_float( FILE *target, float value, int scale )
+{
+    if(value < 0)
+        fprintf(target,"_%.*f\n", scale, -value);
+    else
+        fprintf(target,"%.*f\n", scale, value);
+}
 
 void fprint_expr( FILE *target, Expression *expr)
 {
+    int i;
 
-    if(expr->leftOperand == NULL){
+    if((expr->v).type == SumNode || (expr->v).type == ProductNode){
+        for(i = 0; i < expr->count; i++){
+            fprint_expr(target, expr->operands[i].expr);
+            if(i == 0)
+                continue;
+            if((expr->v).type == ProductNode)
+                fprint_op(target, MulNode);
+            else
+                fprint_op(target, expr->operands[i].negate ? MinusNode : PlusNode);
+        }
+    }
+    else if(expr->leftOperand == NULL){
         switch( (expr->v).type ){
             case Identifier:
 //                fprintf(target,"l%c\n",(expr->v).val.id);
                 fprintf(target,"l%s\n",(expr->v).val.id);//EDITED2
                 break;
             case IntConst:
-                fprintf(target,"%d\n",(expr->v).val.ivalue);
+                fprint_int(target, (expr->v).val.ivalue);
                 break;
             case FloatConst:
-                fprintf(target,"%.1f\n", (expr->v).val.fvalue);
+                fprint_float(target, (expr->v).val.fvalue, (expr->v).scale);
                 break;
             default:
                 fprintf(target,"Error In fprint_left_expr. (expr->v).type=%d\n",(expr->v).type);
@@ -1044,36 +2131,766 @@ void fprint_expr( FILE *target, Expression *expr)
     }
 }
 
+/* the end of a loop's macro; dc reuses the frame of a macro that calls one as its last command */
+void fprint_repeat_end( FILE *target, char counter, char macro )
+{
+    fprintf(target,"l%c\n1\n-\ns%c\nl%c\n0<%c]s%c\nl%cx\n", counter, counter, counter, macro, macro, macro);
+}
+
+void gencodeStatement( Statements *stmts, int i, FILE *target )
+{
+    switch(stmts->kind[i]){
+        case Print:
+            //fprintf(target,"l%c\n",stmt.stmt.variable);
+            if(stmts->expr[i] != NULL)/* bound, see bind.c */
+                fprint_expr(target, stmts->expr[i]);
+            else
+                fprintf(target,"l%s\n",stmts->target[i]);//EDITED2
+            fprintf(target,"p\n");
+            break;
+        case Assignment:
+            fprint_expr(target, stmts->expr[i]);
+            /*
+               if(stmt.stmt.assign.type == Int){
+               fprintf(target,"0 k\n");
+               }
+               else if(stmt.stmt.assign.type == Float){
+               fprintf(target,"5 k\n");
+               }*/
+            //fprintf(target,"s%c\n",stmt.stmt.assign.id);
+            fprintf(target,"s%s\n",stmts->target[i]);//EDITED2
+            fprintf(target,"0 k\n");
+            break;
+        case RepeatStart:/* the body up to the RepeatEnd is the macro */
+            fprint_int(target, stmts->expr[i]->v.val.ivalue);
+            fprintf(target,"s%c\n[\n", stmts->target[i][0]);
+            break;
+        case RepeatEnd:/* count down, the macro runs itself again as its last command while the counter is above 0 */
+            fprint_repeat_end(target, stmts->target[i][0], stmts->target[i][1]);
+            break;
+    }
+}
+
+/* one statement to dc on its own, right below -O2 where nothing crosses statements */
+void emitStatement( IRProgram *ir, Statements *stmts, int i, FILE *code, int level )
+{
+    if(level == 0)
+        gencodeStatement(stmts, i, code);
+    else{
+        ir->count = 0;
+        lower_statement(ir, stmts, i);
+        run_passes(ir, level);
+        ir_gencode(ir, code);
+    }
+}
+
 void gencode(Program prog, FILE * target)
 {
-    Statements *stmts = prog.statements;
-    Statement stmt;
+    Statements *stmts = &prog.statements;
+    int i;
 
-    while(stmts != NULL){
-        stmt = stmts->first;
-        switch(stmt.type){
-            case Print:
-                //fprintf(target,"l%c\n",stmt.stmt.variable);
-                fprintf(target,"l%s\n",stmt.stmt.variable);//EDITED2
-                fprintf(target,"p\n");
-                break;
-            case Assignment:
-                fprint_expr(target, stmt.stmt.assign.expr);
-                /*
-                   if(stmt.stmt.assign.type == Int){
-                   fprintf(target,"0 k\n");
-                   }
-                   else if(stmt.stmt.assign.type == Float){
-                   fprintf(target,"5 k\n");
-                   }*/
-                //fprintf(target,"s%c\n",stmt.stmt.assign.id);
-                fprintf(target,"s%s\n",stmt.stmt.assign.id);//EDITED2
-                fprintf(target,"0 k\n");
+    for(i = 0; i < stmts->count; i++)
+        gencodeStatement(stmts, i, target);
+
+}
+
+
+/***********************************************************************
+  Parallel back-end
+  Checking and printing a statement only reads the symbol table and its
+  own tree, so statements are handed out as tasks. Every worker owns a
+  range of statements and takes StealGrain of them at a time from the
+  front; a worker without work steals the back half of another worker's
+  range. Each task records where its output starts in the worker's
+  streams, and the pieces are written out in statement order at the end.
+ ************************************************************************/
+#define StealGrain 8
+
+/* next task of worker w, taken from its own range or stolen from another; false if all work is gone */
+static bool nextTask( Backend *backend, int w, int *begin, int *end )
+{
+    Worker *self = &backend->workers[w], *victim;
+    int i, mid, hi;
+
+    pthread_mutex_lock(&self->lock);
+    if(self->lo < self->hi){
+        *begin = self->lo;
+        *end = self->lo + StealGrain < self->hi ? self->lo + StealGrain : self->hi;
+        self->lo = *end;
+        pthread_mutex_unlock(&self->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    /* never holds two locks: an empty range is left alone by thieves until it is refilled here */
+    for(i = 1; i < backend->count; i++){
+        victim = &backend->workers[(w + i) % backend->count];
+        pthread_mutex_lock(&victim->lock);
+        hi = victim->hi;
+        mid = hi - (hi - victim->lo) / 2;
+        if(mid == hi)
+            mid = victim->lo;
+        victim->hi = mid;
+        pthread_mutex_unlock(&victim->lock);
+        if(mid < hi){
+            pthread_mutex_lock(&self->lock);
+            self->lo = mid;
+            self->hi = hi;
+            pthread_mutex_unlock(&self->lock);
+            return nextTask(backend, w, begin, end);
+        }
+    }
+    return false;
+}
+
+void *backendWorker( void *arg )
+{
+    Worker *worker = arg;
+    Backend *backend = worker->backend;
+    Statements *stmts = &backend->program->statements;
+    Context ctx;
+    Segment *segment;
+    int begin, end, i;
+
+    joinPhase(&backend->counting);
+    ctx.diag = worker->diag;
+    current = &ctx;
+    while(nextTask(backend, worker->id, &begin, &end)){
+        if(worker->count == worker->capacity){
+            worker->capacity = worker->capacity ? worker->capacity * 2 : 64;
+            worker->segments = realloc(worker->segments, worker->capacity * sizeof(Segment));
+        }
+        segment = &worker->segments[worker->count++];
+        segment->begin = begin;
+        segment->worker = worker->id;
+        segment->diagOffset = ftell(worker->diag);
+        segment->codeOffset = worker->code ? ftell(worker->code) : 0;
+
+        for(i = begin; i < end; i++){
+            if(i + 8 < end && stmts->expr[i + 8] != NULL)
+                __builtin_prefetch(stmts->expr[i + 8]);
+            mycheckstmt(stmts, i, backend->map);
+            if(worker->code)
+                gencodeStatement(stmts, i, worker->code);
+        }
+
+        segment->diagLength = ftell(worker->diag) - segment->diagOffset;
+        segment->codeLength = worker->code ? ftell(worker->code) - segment->codeOffset : 0;
+    }
+    current = NULL;
+    return NULL;
+}
+
+static int compareSegments( const void *a, const void *b )
+{
+    return ((const Segment *)a)->begin - ((const Segment *)b)->begin;
+}
+
+/* mycheck, and gencode if code is not NULL, on threads workers */
+void parallelBackend( Program *program, HashMap *map, FILE *code, int threads )
+{
+    Context *caller = current;
+    Backend backend;
+    Worker *worker;
+    Segment *all;
+    pthread_t *tids;
+    int i, n = program->statements.count, total = 0;
+
+    backend.program = program;
+    backend.map = map;
+    backend.count = threads;
+    backend.counting = counting();
+    backend.workers = calloc(threads, sizeof(Worker));
+    tids = malloc(threads * sizeof(pthread_t));
+    for(i = 0; i < threads; i++){
+        worker = &backend.workers[i];
+        worker->id = i;
+        worker->backend = &backend;
+        worker->lo = (long)n * i / threads;
+        worker->hi = (long)n * (i + 1) / threads;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->diag = open_memstream(&worker->diagText, &worker->diagLength);
+        worker->code = code ? open_memstream(&worker->codeText, &worker->codeLength) : NULL;
+    }
+    for(i = 0; i < threads; i++)
+        pthread_create(&tids[i], NULL, backendWorker, &backend.workers[i]);
+    for(i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+    current = caller;
+
+    for(i = 0; i < threads; i++){
+        worker = &backend.workers[i];
+        fclose(worker->diag);
+        if(worker->code)
+            fclose(worker->code);
+        total += worker->count;
+    }
+    all = malloc(total * sizeof(Segment));
+    for(i = 0, total = 0; i < threads; i++){
+        memcpy(all + total, backend.workers[i].segments, backend.workers[i].count * sizeof(Segment));
+        total += backend.workers[i].count;
+    }
+    qsort(all, total, sizeof(Segment), compareSegments);
+
+    for(i = 0; i < total; i++){
+        worker = &backend.workers[all[i].worker];
+        report("%.*s", (int)all[i].diagLength, worker->diagText + all[i].diagOffset);
+    }
+    if(code)
+        for(i = 0; i < total; i++){
+            worker = &backend.workers[all[i].worker];
+            fwrite(worker->codeText + all[i].codeOffset, 1, all[i].codeLength, code);
+        }
+
+    for(i = 0; i < threads; i++){
+        worker = &backend.workers[i];
+        free(worker->diagText);
+        free(worker->codeText);
+        free(worker->segments);
+        pthread_mutex_destroy(&worker->lock);
+    }
+    free(backend.workers);
+    free(all);
+    free(tids);
+}
+
+
+/***********************************************************************
+  Pipeline
+  The scanner, the parser with the checker, and the emitter run at the
+  same time on three threads. Tokens and checked statements are handed
+  on through single producer, single consumer rings. Each side only
+  writes its own index, so no lock is needed.
+ ************************************************************************/
+#define RingSpin 64
+
+void InitializeRing( Ring *ring, size_t slotSize, unsigned long capacity )
+{
+    ring->slots = malloc(slotSize * capacity);
+    ring->slotSize = slotSize;
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->closed, false);
+}
+
+void FreeRing( Ring *ring )
+{
+    free(ring->slots);
+}
+
+/* spin a little, then let the other stage run */
+static void ringWait( int *spins )
+{
+    if(++*spins > RingSpin)
+        sched_yield();
+}
+
+/* the next free slot, waits while the ring is full; NULL once the consumer has closed the ring */
+void *ringProduce( Ring *ring )
+{
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+
+    while(tail - atomic_load_explicit(&ring->head, memory_order_acquire) == ring->capacity){
+        if(atomic_load_explicit(&ring->closed, memory_order_relaxed))
+            return NULL;
+        ringWait(&spins);
+    }
+    if(atomic_load_explicit(&ring->closed, memory_order_relaxed))
+        return NULL;
+    return ring->slots + (tail & (ring->capacity - 1)) * ring->slotSize;
+}
+
+/* hand the filled slot to the consumer */
+void ringPublish( Ring *ring )
+{
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->tail, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/* the oldest filled slot, waits while the ring is empty */
+void *ringConsume( Ring *ring )
+{
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+
+    while(atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+        ringWait(&spins);
+    return ring->slots + (head & (ring->capacity - 1)) * ring->slotSize;
+}
+
+/* give the consumed slot back to the producer */
+void ringRelease( Ring *ring )
+{
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/* token i of a batch as the scanner returned it */
+static Token batchToken( TokenBatch *batch, int i )
+{
+    TokenSlice *slice = &batch->tokens[i];
+    Token token;
+
+    token.start = batch->base + slice->offset;
+    token.length = slice->length;
+    token.type = slice->type;
+    token.ivalue = slice->value.ivalue;
+    token.fvalue = slice->value.fvalue;
+    return token;
+}
+
+/* next token from the scanner thread, a scanning error is raised where it happened in the token stream */
+Token pullToken( Lexer *lex )
+{
+    char message[1100];
+
+    while(lex->batch == NULL || lex->next == lex->batch->count){
+        if(lex->batch != NULL){
+            if(lex->batch->error != NULL){
+                snprintf(message, sizeof(message), "%s", lex->batch->error);
+                free(lex->batch->error);
+                lex->batch->error = NULL;
+                fail("%s", message);
+            }
+            if(lex->batch->last)/* only EOFsymbol is left */
+                return batchToken(lex->batch, lex->batch->count - 1);
+            ringRelease(lex->ring);
+        }
+        lex->batch = ringConsume(lex->ring);
+        lex->next = 0;
+    }
+    return batchToken(lex->batch, lex->next++);
+}
+
+void *scanStage( void *arg )
+{
+    Pipeline *pipeline = arg;
+    Context ctx;
+    Lexer lex;
+    TokenBatch *batch;
+    TokenSlice *slice;
+    Token token;
+    char *log;
+    size_t logLength;
+    bool last, pending;
+
+    joinPhase(&pipeline->counting);
+    InitializeLexer(&lex, pipeline->text, pipeline->len);
+    ctx.diag = open_memstream(&log, &logLength);
+    if(setjmp(ctx.fail)){
+        current = NULL;
+        fclose(ctx.diag);
+        batch = ringProduce(&pipeline->tokens);/* the slot that was being filled */
+        if(batch == NULL){
+            free(log);
+            return NULL;
+        }
+        batch->error = log;
+        batch->last = true;
+        ringPublish(&pipeline->tokens);
+        return NULL;
+    }
+    current = &ctx;
+
+    last = false;
+    pending = false;
+    while(!last && (batch = ringProduce(&pipeline->tokens)) != NULL){
+        batch->count = 0;
+        batch->last = false;
+        batch->error = NULL;
+        while(!last && batch->count < TokenBatchSize){
+            if(!pending)
+                token = scanner(&lex);
+            if(batch->count == 0)
+                batch->base = token.start;
+            else if(token.start + token.length - batch->base > UINT32_MAX){/* too far for an offset, starts the next batch */
+                pending = true;
                 break;
+            }
+            pending = false;
+            slice = &batch->tokens[batch->count++];
+            slice->offset = token.start - batch->base;
+            slice->length = token.length;
+            slice->type = token.type;
+            if(token.type == FloatValue)
+                slice->value.fvalue = token.fvalue;
+            else
+                slice->value.ivalue = token.ivalue;
+            last = (token.type == EOFsymbol);
+        }
+        batch->last = last;
+        ringPublish(&pipeline->tokens);
+    }
+    countTokens(&lex);
+    current = NULL;
+    fclose(ctx.diag);
+    free(log);
+    return NULL;
+}
+
+/* parse and check one statement at a time, the diagnostics are kept until the parse is known to succeed */
+void *parseStage( void *arg )
+{
+    Pipeline *pipeline = arg;
+    Context ctx;
+    Lexer lex;
+    StatementRecord *record;
+    Statements *one = &pipeline->one;
+
+    joinPhase(&pipeline->counting);
+    memset(&lex, 0, sizeof(lex));
+    lex.ring = &pipeline->tokens;
+    ctx.diag = pipeline->log;
+    pipeline->errorOffset = 0;
+    if(setjmp(ctx.fail)){
+        current = NULL;
+        pipeline->failed = true;
+        atomic_store_explicit(&pipeline->tokens.closed, true, memory_order_relaxed);
+        if(one->count > 0)
+            FreeExpression(one->expr[0]);
+        record = ringProduce(&pipeline->statements);
+        record->last = true;
+        ringPublish(&pipeline->statements);
+        return NULL;
+    }
+    current = &ctx;
+
+    parseDeclarations(&lex, &pipeline->program.declarations);
+    pipeline->map = mybuild(pipeline->program);
+    bind_map(pipeline->map, pipeline->opt);
+    while(1){
+        pipeline->errorOffset = ftell(pipeline->log);
+        one->count = 0;
+        if(!parseNextStatement(&lex, one))
+            break;
+        mycheckstmt(one, 0, pipeline->map);
+
+        record = ringProduce(&pipeline->statements);
+        record->kind = one->kind[0];
+        memcpy(record->target, one->target[0], sizeof(record->target));
+        record->expr = one->expr[0];
+        record->type = one->type[0];
+        record->last = false;
+        one->count = 0;
+        ringPublish(&pipeline->statements);
+    }
+    record = ringProduce(&pipeline->statements);
+    record->last = true;
+    ringPublish(&pipeline->statements);
+    current = NULL;
+    return NULL;
+}
+
+/*
+   Compile text into code with the emitter on this thread. -O0 and -O1
+   print each statement as it arrives. -O2 works on the whole program,
+   so its statements are collected and optimized after the last one.
+*/
+void runPipeline( const char *text, size_t len, FILE *code, Options *opt )
+{
+    Pipeline pipeline;
+    pthread_t scanner_tid, parser_tid;
+    StatementRecord *record;
+    Statements one, *all;
+    IRProgram ir;
+    char message[1100];
+    int n;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.text = text;
+    pipeline.len = len;
+    pipeline.opt = opt;
+    pipeline.counting = counting();
+    pipeline.log = open_memstream(&pipeline.logText, &pipeline.logLength);
+    InitializeRing(&pipeline.tokens, sizeof(TokenBatch), 16);
+    InitializeRing(&pipeline.statements, sizeof(StatementRecord), 256);
+    InitializeIR(&ir);
+    all = &pipeline.program.statements;
+
+    pthread_create(&scanner_tid, NULL, scanStage, &pipeline);
+    pthread_create(&parser_tid, NULL, parseStage, &pipeline);
+
+    while(1){
+        record = ringConsume(&pipeline.statements);
+        if(record->last)
+            break;
+        if(ir.symCount == 0)/* declarations are complete before the first statement is sent */
+            lower_declarations(&ir, &pipeline.program.declarations);
+
+        /* a one row view of the record */
+        one.kind = &record->kind;
+        one.target = &record->target;
+        one.expr = &record->expr;
+        one.type = &record->type;
+        one.count = one.capacity = 1;
+
+        if(opt->optimize < 2)
+            emitStatement(&ir, &one, 0, code, opt->optimize);
+        else{
+            n = all->count;
+            if(record->kind == Assignment)
+                addAssignment(all, record->target, record->expr);
+            else if(record->kind == RepeatStart)
+                addRepeatStart(all, record->target, record->expr);
+            else if(record->kind == RepeatEnd)
+                addRepeatEnd(all, record->target);
+            else{
+                addPrint(all, record->target);
+                all->expr[n] = record->expr;
+            }
+            all->type[n] = record->type;
+            record->expr = NULL;
+        }
+        FreeExpression(record->expr);
+        ringRelease(&pipeline.statements);
+    }
+    ringRelease(&pipeline.statements);
+    pthread_join(scanner_tid, NULL);
+    pthread_join(parser_tid, NULL);
+    fclose(pipeline.log);
+
+    /* batches the parser never got to, if it failed first */
+    while(atomic_load(&pipeline.tokens.head) != atomic_load(&pipeline.tokens.tail)){
+        free(((TokenBatch *)ringConsume(&pipeline.tokens))->error);
+        ringRelease(&pipeline.tokens);
+    }
+
+    if(!pipeline.failed){
+        report("%.*s", (int)pipeline.logLength, pipeline.logText);
+        if(opt->optimize >= 2){
+            FreeIR(&ir);
+            InitializeIR(&ir);
+            lower_program(&ir, &pipeline.program);
+            run_passes(&ir, opt->optimize);
+            ir_gencode(&ir, code);
+        }
+    }
+    else/* the serial compiler prints only the error */
+        snprintf(message, sizeof(message), "%.*s", (int)(pipeline.logLength - pipeline.errorOffset),
+                pipeline.logText + pipeline.errorOffset);
+
+    FreeIR(&ir);
+    FreeRing(&pipeline.tokens);
+    FreeRing(&pipeline.statements);
+    free(pipeline.logText);
+    if(pipeline.map)
+        FreeMap(pipeline.map);
+    FreeProgram(&pipeline.program);
+    releaseHeap(pipeline.one.kind);/* allocated on the parse thread, which has no arena */
+    releaseHeap(pipeline.one.target);
+    releaseHeap(pipeline.one.expr);
+    releaseHeap(pipeline.one.type);
+    if(pipeline.failed)
+        fail("%s", message);
+}
+
+
+/***********************************************************************
+  Macro factoring
+  Repeated runs of dc instructions are hoisted into macros: the run is
+  stored once as [...]sM and every occurrence becomes lMx.
+ ************************************************************************/
+#define MacroMaxLength 32
+
+/* returns the id of the instruction, barriers always get a fresh id */
+int intern_instr( InstrTable *table, char *text, int len )
+{
+    unsigned long hashval = 5381;
+    bool barrier = (memchr(text, '[', len) != NULL || memchr(text, ']', len) != NULL);
+    int i, idx;
+
+    for(i = 0; i < len; i++)
+        hashval = ((hashval<<5) + hashval) + text[i];
+    idx = hashval % table->slotCount;
+
+    while(!barrier && table->slots[idx] != -1){
+        i = table->slots[idx];
+        if(table->length[i] == len && memcmp(table->text[i], text, len) == 0)
+            return i;
+        idx = (idx + 1) % table->slotCount;
+    }
+
+    if(table->count == table->capacity){
+        table->capacity *= 2;
+        table->text = realloc(table->text, table->capacity * sizeof(char *));
+        table->length = realloc(table->length, table->capacity * sizeof(int));
+        table->barrier = realloc(table->barrier, table->capacity * sizeof(bool));
+    }
+    i = table->count++;
+    table->text[i] = malloc(len + 1);
+    memcpy(table->text[i], text, len);
+    table->text[i][len] = '\0';
+    table->length[i] = len;
+    table->barrier[i] = barrier;
+    if(!barrier)
+        table->slots[idx] = i;
+    return i;
+}
+
+/* bytes saved when count copies of a run of length lines (size bytes without newlines) become one macro */
+static long macro_savings( long count, long length, long size )
+{
+    return (count - 1) * (size + length) - 4 * count - 4;
+}
+
+void factor_macros( char *code, size_t len, FILE *target )
+{
+    InstrTable table;
+    Macro macros[26];
+    int nmacros = 0;
+    bool used[26] = { false };
+    int *seq, *next_barrier, n = 0;
+    size_t pos, end;
+    int i, j, L;
+
+    /* registers already used by the program cannot hold macros */
+    for(pos = 0; pos < len; pos++)
+        if(code[pos] >= 'A' && code[pos] <= 'Z')
+            used[code[pos] - 'A'] = true;
+
+    /* split the code into instruction lines */
+    for(pos = 0, i = 0; pos < len; pos++)
+        if(code[pos] == '\n') i++;
+    seq = malloc((i + 1) * sizeof(int));
+    table.count = 0;
+    table.capacity = 64;
+    table.text = malloc(table.capacity * sizeof(char *));
+    table.length = malloc(table.capacity * sizeof(int));
+    table.barrier = malloc(table.capacity * sizeof(bool));
+    table.slotCount = 2 * (i + 1) + 26;
+    table.slots = malloc(table.slotCount * sizeof(int));
+    for(j = 0; j < table.slotCount; j++)
+        table.slots[j] = -1;
+
+    for(pos = 0; pos < len; pos = end + 1){
+        for(end = pos; end < len && code[end] != '\n'; end++);
+        if(end > pos)
+            seq[n++] = intern_instr(&table, code + pos, end - pos);
+    }
+
+    /* hash table over windows, reused for every length */
+    int slotCount = 1;
+    while(slotCount < 2 * n) slotCount <<= 1;
+    int *slots = malloc(slotCount * sizeof(int));
+    int *entStart = malloc((n + 1) * sizeof(int));
+    int *entCount = malloc((n + 1) * sizeof(int));
+    int *entLast = malloc((n + 1) * sizeof(int));
+    unsigned long *entHash = malloc((n + 1) * sizeof(unsigned long));
+    next_barrier = malloc((n + 1) * sizeof(int));
+
+    while(nmacros < 26){
+        long best = 0;
+        int bestStart = -1, bestLength = 0;
+        char reg;
+
+        next_barrier[n] = n;
+        for(i = n - 1; i >= 0; i--)
+            next_barrier[i] = table.barrier[seq[i]] ? i : next_barrier[i + 1];
+
+        for(L = 2; L <= MacroMaxLength && L <= n; L++){
+            unsigned long h = 0, top = 1;
+            int nent = 0, e;
+
+            for(j = 0; j < slotCount; j++) slots[j] = -1;
+            for(j = 0; j < L - 1; j++) top *= 1000003UL;
+            for(j = 0; j < L; j++) h = h * 1000003UL + seq[j];
+
+            for(i = 0; i + L <= n; i++){
+                if(i > 0)
+                    h = (h - seq[i - 1] * top) * 1000003UL + seq[i + L - 1];
+                if(next_barrier[i] < i + L)
+                    continue;
+
+                int idx = h & (slotCount - 1);
+                while((e = slots[idx]) != -1){
+                    if(entHash[e] == h && memcmp(seq + entStart[e], seq + i, L * sizeof(int)) == 0)
+                        break;
+                    idx = (idx + 1) & (slotCount - 1);
+                }
+                if(e == -1){
+                    e = nent++;
+                    slots[idx] = e;
+                    entHash[e] = h;
+                    entStart[e] = i;
+                    entCount[e] = 1;
+                    entLast[e] = i + L;
+                }else if(i >= entLast[e]){/* occurrences must not overlap */
+                    entCount[e]++;
+                    entLast[e] = i + L;
+                }
+            }
+
+            for(e = 0; e < nent; e++){
+                long size = 0, saved;
+                if(entCount[e] < 2) continue;
+                for(j = 0; j < L; j++)
+                    size += table.length[seq[entStart[e] + j]];
+                saved = macro_savings(entCount[e], L, size);
+                if(saved > best){
+                    best = saved;
+                    bestStart = entStart[e];
+                    bestLength = L;
+                }
+            }
+        }
+        if(bestStart < 0)
+            break;/* nothing left that makes the output smaller */
+
+        for(reg = 'A'; reg <= 'Z' && used[reg - 'A']; reg++);
+        if(reg > 'Z')
+            break;
+        used[reg - 'A'] = true;
+
+        Macro *macro = &macros[nmacros++];
+        char call[4] = { 'l', reg, 'x', '\0' };
+        int id = intern_instr(&table, call, 3);
+
+        macro->reg = reg;
+        macro->length = bestLength;
+        macro->body = malloc(bestLength * sizeof(int));
+        memcpy(macro->body, seq + bestStart, bestLength * sizeof(int));
+
+        /* replace every occurrence from left to right */
+        for(i = 0, j = 0; i < n; ){
+            if(i + bestLength <= n && next_barrier[i] >= i + bestLength &&
+                    memcmp(seq + i, macro->body, bestLength * sizeof(int)) == 0){
+                seq[j++] = id;
+                i += bestLength;
+            }else{
+                seq[j++] = seq[i++];
+            }
+        }
+        n = j;
+    }
+
+    /* macros first, a macro body may call an earlier macro */
+    for(i = 0; i < nmacros; i++){
+        fputc('[', target);
+        for(j = 0; j < macros[i].length; j++){
+            if(j > 0) fputc(' ', target);
+            fwrite(table.text[macros[i].body[j]], 1, table.length[macros[i].body[j]], target);
         }
-        stmts=stmts->rest;
+        fprintf(target, "]s%c\n", macros[i].reg);
+        free(macros[i].body);
+    }
+    for(i = 0; i < n; i++){
+        fwrite(table.text[seq[i]], 1, table.length[seq[i]], target);
+        fputc('\n', target);
     }
 
+    for(i = 0; i < table.count; i++)
+        free(table.text[i]);
+    free(table.text);
+    free(table.length);
+    free(table.barrier);
+    free(table.slots);
+    free(slots);
+    free(entStart);
+    free(entCount);
+    free(entLast);
+    free(entHash);
+    free(next_barrier);
+    free(seq);
 }
 
 
@@ -1083,8 +2900,17 @@ void gencode(Program prog, FILE * target)
  ****************************************/
 void print_expr(Expression *expr)
 {
+    int i;
+
     if(expr == NULL)
         return;
+    else if((expr->v).type == SumNode || (expr->v).type == ProductNode){
+        for(i = 0; i < expr->count; i++){
+            if(i > 0)
+                printf("%s ", (expr->v).type == ProductNode ? "*" : (expr->operands[i].negate ? "-" : "+"));
+            print_expr(expr->operands[i].expr);
+        }
+    }
     else{
         print_expr(expr->leftOperand);
         switch((expr->v).type){
@@ -1126,37 +2952,34 @@ void test_parser( FILE *source )
     Declarations *decls;
     Statements *stmts;
     Declaration decl;
-    Statement stmt;
     Program program = parser(source);
+    int i;
 
-    decls = program.declarations;
+    decls = &program.declarations;
 
-    while(decls != NULL){
-        decl = decls->first;
+    for(i = 0; i < decls->count; i++){
+        decl = decls->items[i];
         if(decl.type == Int)
             printf("i ");
         if(decl.type == Float)
             printf("f ");
 //        printf("%c ",decl.name);
         printf("%s ",decl.name);//EDITED2
-        decls = decls->rest;
     }
 
-    stmts = program.statements;
+    stmts = &program.statements;
 
-    while(stmts != NULL){
-        stmt = stmts->first;
-        if(stmt.type == Print){
+    for(i = 0; i < stmts->count; i++){
+        if(stmts->kind[i] == Print){
 //            printf("p %c ", stmt.stmt.variable);
-            printf("p %s ", stmt.stmt.variable);//EDITED2
+            printf("p %s ", stmts->target[i]);//EDITED2
         }
 
-        if(stmt.type == Assignment){
+        if(stmts->kind[i] == Assignment){
 //            printf("%c = ", stmt.stmt.assign.id);
-            printf("%s = ", stmt.stmt.assign.id);//EDITED2
-            print_expr(stmt.stmt.assign.expr);
+            printf("%s = ", stmts->target[i]);//EDITED2
+            print_expr(stmts->expr[i]);
         }
-        stmts = stmts->rest;
     }
 
 }
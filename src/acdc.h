@@ -0,0 +1,39 @@
+#ifndef ACDC_H_INCLUDED
+#define ACDC_H_INCLUDED
+
+#include <stddef.h>
+
+/* the library is built with hidden symbols, these are the ones it exports */
+#if defined(__GNUC__)
+#define ACDC_EXPORT __attribute__((visibility("default")))
+#else
+#define ACDC_EXPORT
+#endif
+
+/*
+   libacdc: compile AC source in memory to dc code in memory.
+
+   acdc_compile is reentrant: every call keeps its state to itself and
+   may run on any thread at the same time as others. Errors come back
+   as the return value, the process never exits.
+*/
+
+/* NULL options mean -O1 without macros, like the command line */
+typedef struct acdc_options{
+    int optimize;           /* 0, 1 or 2, like -O0, -O1 and -O2 */
+    int macros;             /* non zero like --macros */
+}acdc_options;
+
+/* both buffers end with a '\0' that is not counted, free them with acdc_free_output */
+typedef struct acdc_output{
+    char *code;             /* the dc program, empty unless the call returned 0 */
+    size_t code_length;
+    char *diag;             /* what the compiler printed */
+    size_t diag_length;
+}acdc_output;
+
+/* 0 when compiled, 1 on an error in the source, 2 on bad options; like the exit status of AcDc */
+ACDC_EXPORT int acdc_compile( const char *src, size_t len, acdc_output *out, const acdc_options *options );
+ACDC_EXPORT void acdc_free_output( acdc_output *out );
+
+#endif
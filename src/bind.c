@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <float.h>
+#include "header.h"
+
+/*
+   Compile-time bindings, AcDc -D name=value and --bindings FILE.
+
+   A bound variable is a constant of the program: its value is put in
+   the symbol table next to its type, and the checker puts the constant
+   in place of every use, so the usual folding of the checker and of the
+   IR passes sees it at every -O level. A print of a bound variable
+   prints the constant. The variable must be declared, and assigning it
+   is an error.
+
+   A bindings file has one name=value per line; empty lines and lines
+   starting with # are skipped.
+*/
+
+/* "name=value", value an int or a float constant with an optional -, that fits its type */
+bool addBinding( Options *opt, const char *text )
+{
+    const char *equals = strchr(text, '='), *p;
+    Binding *binding;
+    size_t digits, fraction = 1;
+    long ivalue = 0;
+    double fvalue = 0;
+
+    if(equals == NULL || equals == text || equals - text > 64)
+        return false;
+    for(p = text; p < equals; p++)
+        if(*p < 'a' || *p > 'z')
+            return false;
+    p = equals + 1 + (equals[1] == '-');
+    digits = strspn(p, "0123456789");
+    p += digits;
+    if(*p == '.'){
+        fraction = strspn(p + 1, "0123456789");
+        p += 1 + fraction;
+    }
+    if(digits == 0 || fraction == 0 || *p != '\0')
+        return false;
+    errno = 0;
+    if(strchr(equals, '.') != NULL){
+        fvalue = strtod(equals + 1, NULL);
+        if(errno == ERANGE || fvalue > FLT_MAX || fvalue < -FLT_MAX ||
+           (fvalue != 0 && (float)fvalue == 0))/* a float would make it inf or 0 */
+            return false;
+    }
+    else{
+        ivalue = strtol(equals + 1, NULL, 10);
+        if(errno == ERANGE || ivalue > INT_MAX || ivalue < INT_MIN)
+            return false;
+    }
+
+    opt->bindings = realloc(opt->bindings, (opt->bindingCount + 1) * sizeof(Binding));
+    binding = &opt->bindings[opt->bindingCount++];
+    memset(binding, 0, sizeof(Binding));
+    memcpy(binding->name, text, equals - text);
+    if(strchr(equals, '.') != NULL){
+        binding->value.type = FloatConst;
+        binding->value.val.fvalue = fvalue;
+        binding->value.scale = 1;
+    }
+    else{
+        binding->value.type = IntConst;
+        binding->value.val.ivalue = ivalue;
+    }
+    return true;
+}
+
+bool readBindings( Options *opt, const char *path )
+{
+    FILE *file = fopen(path, "r");
+    char *line = NULL;
+    size_t size = 0, len;
+    bool valid = true;
+
+    if(!file)
+        return false;
+    while(valid && getline(&line, &size, file) != -1){
+        len = strcspn(line, "\r\n");
+        line[len] = '\0';
+        if(len == 0 || line[0] == '#')
+            continue;
+        valid = addBinding(opt, line);
+    }
+    free(line);
+    fclose(file);
+    return valid;
+}
+
+/* give the declared variables their bound values; a later binding of the same name wins */
+void bind_map( HashMap *map, Options *opt )
+{
+    Binding *binding;
+    HashNode *node;
+    int i;
+
+    for(i = 0; i < opt->bindingCount; i++){
+        binding = &opt->bindings[i];
+        node = find_map(map, binding->name);
+        if(node == NULL)
+            report("Error : bound id %s is not declared\n", binding->name);
+        else if(node->type == Int && binding->value.type == FloatConst)
+            report("error : can't convert float to integer\n");
+        else{
+            node->bound = true;
+            node->value = binding->value;
+            if(node->type == Float && binding->value.type == IntConst){
+                node->value.type = FloatConst;
+                node->value.val.fvalue = binding->value.val.ivalue;
+                node->value.scale = 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "header.h"
+
+/*
+   On-disk compilation cache.
+
+   A fragment is the dc code and the diagnostics produced for one
+   statement (or for a whole program at -O2), stored in
+   DIR/xx/yyyy... where xxyyyy... is the hash of its key. The key is
+   the compiler version, the -O level, the hash of the declarations and
+   the statement written out canonically, so spacing and the spelling of
+   numbers do not matter. The full key is kept in the fragment and
+   compared on every load, a hash collision is a miss.
+
+   Loading a fragment touches it; when the directory grows past its
+   limit the fragments used longest ago are removed first, down to 3/4
+   of the limit. DIR/size holds the bytes of all fragments: every store
+   adds to it under a lock, so only a run that takes it past the limit
+   looks at the fragments themselves. An eviction writes the exact
+   total it found, which also repairs the file if it was lost.
+*/
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void InitializeCache( Cache *cache, char *dir, long limit )
+{
+    cache->dir = dir;
+    cache->limit = limit;
+    atomic_init(&cache->stored, false);
+    atomic_init(&cache->total, -1);
+    mkdir(dir, 0777);
+}
+
+/* add delta to the bytes in DIR/size, or with set make it delta; the new total, -1 while the file has none */
+static long cache_account( Cache *cache, long delta, bool set )
+{
+    char path[4096], text[32];
+    long total = -1;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/size", cache->dir);
+    fd = open(path, O_RDWR | O_CREAT, 0666);
+    if(fd < 0)
+        return -1;
+    flock(fd, LOCK_EX);
+    n = pread(fd, text, sizeof(text) - 1, 0);
+    if(set)
+        total = delta;
+    else if(n > 0){
+        text[n] = '\0';
+        if(sscanf(text, "%ld", &total) == 1)
+            total += delta;
+        else
+            total = -1;
+    }
+    if(total >= 0){
+        n = snprintf(text, sizeof(text), "%ld\n", total);
+        if(pwrite(fd, text, n, 0) != n || ftruncate(fd, n) != 0)
+            total = -1;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    return total;
+}
+
+/* 128 bits from two FNV-1a passes with different bases */
+void cache_hash( const char *key, size_t len, char hex[33] )
+{
+    unsigned long h1 = 14695981039346656037UL, h2 = 0x6a09e667f3bcc909UL;
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        h1 = (h1 ^ (unsigned char)key[i]) * 1099511628211UL;
+        h2 = (h2 ^ (unsigned char)key[i]) * 0x100000001b3UL;
+        h2 ^= h2 >> 29;
+    }
+    sprintf(hex, "%016lx%016lx", h1, h2);
+}
+
+/* operands in evaluation order, constants exactly */
+void serialize_expression( FILE *key, Expression *expr )
+{
+    int i;
+
+    switch(expr->v.type){
+        case Identifier:
+            fprintf(key, "l%s ", expr->v.val.id);
+            return;
+        case IntConst:
+            fprintf(key, "%d ", expr->v.val.ivalue);
+            return;
+        case FloatConst:
+            fprintf(key, "%a.%d ", expr->v.val.fvalue, expr->v.scale);
+            return;
+        case SumNode:
+        case ProductNode:
+            fprintf(key, "%c%d( ", expr->v.type == SumNode ? 'S' : 'P', expr->count);
+            for(i = 0; i < expr->count; i++){
+                if(expr->operands[i].negate)
+                    fputc('~', key);
+                serialize_expression(key, expr->operands[i].expr);
+            }
+            fputs(") ", key);
+            return;
+        default:
+            fprintf(key, "B%d( ", expr->v.type);
+            serialize_expression(key, expr->leftOperand);
+            if(expr->rightOperand)
+                serialize_expression(key, expr->rightOperand);
+            fputs(") ", key);
+            return;
+    }
+}
+
+/* the declarations and the bindings, hashed once per program and put in every key */
+void cache_declarations( Declarations *decls, Options *opt, char hex[33] )
+{
+    char *text;
+    size_t len;
+    FILE *key = open_memstream(&text, &len);
+    int i;
+
+    for(i = 0; i < decls->count; i++)
+        fprintf(key, "%c %s\n", decls->items[i].type == Int ? 'i' : 'f', decls->items[i].name);
+    for(i = 0; i < opt->bindingCount; i++){
+        if(opt->bindings[i].value.type == IntConst)
+            fprintf(key, "= %s %d\n", opt->bindings[i].name, opt->bindings[i].value.val.ivalue);
+        else
+            fprintf(key, "= %s %a\n", opt->bindings[i].name, opt->bindings[i].value.val.fvalue);
+    }
+    fclose(key);
+    cache_hash(text, len, hex);
+    free(text);
+}
+
+/* what every key starts with */
+void cache_key_header( FILE *key, const char *declarations, int level )
+{
+    fprintf(key, "%s\n-O%d\n%s\n", AcDcVersion, level, declarations);
+}
+
+/* statement i as it was parsed, before it is checked */
+void cache_statement_key( FILE *key, Statements *stmts, int i )
+{
+    if(stmts->kind[i] == Print)
+        fprintf(key, "p %s\n", stmts->target[i]);
+    else if(stmts->kind[i] == RepeatStart)
+        fprintf(key, "repeat %s %d {\n", stmts->target[i], stmts->expr[i]->v.val.ivalue);
+    else if(stmts->kind[i] == RepeatEnd)
+        fprintf(key, "} %s\n", stmts->target[i]);
+    else{
+        fprintf(key, "%s = ", stmts->target[i]);
+        serialize_expression(key, stmts->expr[i]);
+        fputc('\n', key);
+    }
+}
+
+static void cache_path( Cache *cache, const char *hex, char *path, size_t size )
+{
+    snprintf(path, size, "%s/%.2s/%s", cache->dir, hex, hex + 2);
+}
+
+/* true on a hit, *diag and *code are malloced */
+bool cache_load( Cache *cache, const char *key, size_t keyLength,
+        char **diag, size_t *diagLength, char **code, size_t *codeLength )
+{
+    char hex[33], path[4096], *stored = NULL;
+    size_t storedLength;
+    FILE *file;
+    bool hit = false;
+
+    cache_hash(key, keyLength, hex);
+    cache_path(cache, hex, path, sizeof(path));
+    file = fopen(path, "rb");
+    if(!file)
+        return false;
+    *diag = *code = NULL;
+    if(fscanf(file, "AcDc cache %zu %zu %zu", &storedLength, diagLength, codeLength) == 3 && fgetc(file) == '\n'
+            && storedLength == keyLength){
+        stored = malloc(keyLength + 1);
+        *diag = malloc(*diagLength + 1);
+        *code = malloc(*codeLength + 1);
+        hit = fread(stored, 1, keyLength, file) == keyLength && memcmp(stored, key, keyLength) == 0 &&
+            fread(*diag, 1, *diagLength, file) == *diagLength &&
+            fread(*code, 1, *codeLength, file) == *codeLength;
+    }
+    fclose(file);
+    free(stored);
+    if(!hit){
+        free(*diag);
+        free(*code);
+        return false;
+    }
+    utimes(path, NULL);/* most recently used */
+    return true;
+}
+
+/* written to a temporary name and renamed, readers never see half a fragment */
+void cache_store( Cache *cache, const char *key, size_t keyLength,
+        const char *diag, size_t diagLength, const char *code, size_t codeLength )
+{
+    char hex[33], path[4096], tmp[4200];
+    FILE *file;
+    struct stat st;
+    long size, replaced;
+
+    cache_hash(key, keyLength, hex);
+    snprintf(path, sizeof(path), "%s/%.2s", cache->dir, hex);
+    mkdir(path, 0777);
+    cache_path(cache, hex, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, (int)getpid(), (unsigned long)pthread_self());
+    file = fopen(tmp, "wb");
+    if(!file)
+        return;
+    fprintf(file, "AcDc cache %zu %zu %zu\n", keyLength, diagLength, codeLength);
+    fwrite(key, 1, keyLength, file);
+    fwrite(diag, 1, diagLength, file);
+    fwrite(code, 1, codeLength, file);
+    size = ftell(file);
+    replaced = stat(path, &st) == 0 ? st.st_size : 0;
+    if(fclose(file) == 0 && rename(tmp, path) == 0){
+        atomic_store(&cache->total, cache_account(cache, size - replaced, false));
+        atomic_store(&cache->stored, true);
+    }
+    else
+        unlink(tmp);
+}
+
+static int compare_entries( const void *a, const void *b )
+{
+    const CacheEntry *x = a, *y = b;
+
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* if the directory is past its limit, remove the least recently used fragments until it is at 3/4 of it */
+void cache_evict( Cache *cache )
+{
+    CacheEntry *entries = NULL;
+    int count = 0, capacity = 0, i;
+    long total = 0, target;
+    char path[4096];
+    DIR *top, *sub;
+    struct dirent *d, *e;
+    struct stat st;
+
+    if(!atomic_load(&cache->stored))
+        return;
+    pthread_mutex_lock(&cache_lock);
+    total = atomic_load(&cache->total);
+    if(total >= 0 && total <= cache->limit){
+        atomic_store(&cache->stored, false);
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    total = 0;
+    top = opendir(cache->dir);
+    while(top && (d = readdir(top)) != NULL){
+        if(strlen(d->d_name) != 2 || d->d_name[0] == '.')/* not .. either, that is the parent of the cache */
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, d->d_name);
+        sub = opendir(path);
+        while(sub && (e = readdir(sub)) != NULL){
+            if(e->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s/%s", cache->dir, d->d_name, e->d_name);
+            if(stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            if(count == capacity){
+                capacity = capacity ? capacity * 2 : 256;
+                entries = realloc(entries, capacity * sizeof(CacheEntry));
+            }
+            entries[count].path = strdup(path);
+            entries[count].size = st.st_size;
+            entries[count].mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+            total += st.st_size;
+            count++;
+        }
+        if(sub)
+            closedir(sub);
+    }
+    if(top)
+        closedir(top);
+
+    target = total > cache->limit ? cache->limit / 4 * 3 : total;
+    qsort(entries, count, sizeof(CacheEntry), compare_entries);
+    for(i = 0; i < count; i++){
+        if(total > target && unlink(entries[i].path) == 0)
+            total -= entries[i].size;
+        free(entries[i].path);
+    }
+    free(entries);
+    atomic_store(&cache->total, cache_account(cache, total, true));
+    atomic_store(&cache->stored, false);
+    pthread_mutex_unlock(&cache_lock);
+}
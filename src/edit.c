@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+
+/*
+   Incremental compilation.
+
+   A Document keeps a program parsed, checked and printed between edits.
+   Every statement remembers where its first token is and what checking
+   and printing it produced. Below -O2 a statement compiles on its own,
+   so the output is those pieces one after the other.
+
+   An edit replaces a byte range with new text. Parsing starts again at
+   the last statement that starts before the range. The first character
+   of that statement is kept, so it is still a statement start, and the
+   statements before it end where they did. Parsing stops at the first
+   statement past the range that starts where an old statement started:
+   from there on the text, and so the parse, is the same as before, as
+   long as it is inside as many repeat loops as it was.
+   Only the statements in between are checked and printed again.
+   An edit that reaches into the declarations rebuilds everything,
+   because every statement depends on the symbol table.
+*/
+
+/* the tree, the symbol table and the pieces, not the text */
+static void clearDocument( Document *doc )
+{
+    int i;
+
+    for(i = 0; i < doc->program.statements.count; i++){
+        free(doc->code[i].text);
+        free(doc->log[i].text);
+    }
+    FreeProgram(&doc->program);
+    memset(&doc->program, 0, sizeof(doc->program));
+    FreeStatements(&doc->fresh);
+    memset(&doc->fresh, 0, sizeof(doc->fresh));
+    if(doc->map)
+        FreeMap(doc->map);
+    doc->map = NULL;
+    FreeIR(&doc->ir);
+    InitializeIR(&doc->ir);
+    free(doc->build.text);
+    free(doc->whole.text);
+    doc->build.text = doc->whole.text = NULL;
+    doc->build.length = doc->whole.length = 0;
+}
+
+/* capacity for count statements in the program and in the pieces */
+static void reserveStatements( Document *doc, int count )
+{
+    Statements *stmts = &doc->program.statements;
+
+    if(count > stmts->capacity){
+        stmts->capacity = count > stmts->capacity * 2 ? count : stmts->capacity * 2;
+        stmts->kind = reallocate(stmts->kind, stmts->capacity * sizeof(StmtType));
+        stmts->target = reallocate(stmts->target, stmts->capacity * sizeof(*stmts->target));
+        stmts->expr = reallocate(stmts->expr, stmts->capacity * sizeof(Expression *));
+        stmts->type = reallocate(stmts->type, stmts->capacity * sizeof(DataType));
+    }
+    if(count > doc->capacity){
+        doc->capacity = stmts->capacity;
+        doc->start = realloc(doc->start, doc->capacity * sizeof(size_t));
+        doc->code = realloc(doc->code, doc->capacity * sizeof(Fragment));
+        doc->log = realloc(doc->log, doc->capacity * sizeof(Fragment));
+    }
+}
+
+/* the old statement that starts at offset, or -1 */
+static int findStart( Document *doc, size_t offset )
+{
+    int lo = 0, hi = doc->program.statements.count - 1, mid;
+
+    while(lo <= hi){
+        mid = (lo + hi) / 2;
+        if(doc->start[mid] == offset)
+            return mid;
+        if(doc->start[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+/* repeat loops open before statement i */
+static int loopDepth( Statements *stmts, int i )
+{
+    int depth = 0;
+
+    while(i-- > 0)
+        depth += stmts->kind[i] == RepeatStart ? 1 : stmts->kind[i] == RepeatEnd ? -1 : 0;
+    return depth;
+}
+
+/*
+   parse into doc->fresh, starting at old statement first, until the text
+   ends or, at or after resync, a statement starts where old statement j
+   did before the text moved by delta and is as deep in loops as j was;
+   returns that j, or the old count at the end of the text
+*/
+static int parseUntilResync( Document *doc, Lexer *lex, int first, size_t resync, long delta )
+{
+    Statements *old = &doc->program.statements;
+    size_t start;
+    int j, k = first, depth = lex->depth;
+
+    while(1){
+        start = peekToken(lex).start - doc->text;
+        if(lex->peek.type == EOFsymbol){
+            parseNextStatement(lex, &doc->fresh);/* an unclosed loop is an error */
+            return old->count;
+        }
+        if(start >= resync && (j = findStart(doc, start - delta)) >= 0){
+            for(; k < j; k++)
+                depth += old->kind[k] == RepeatStart ? 1 : old->kind[k] == RepeatEnd ? -1 : 0;
+            if(depth == lex->depth)
+                return j;
+        }
+        if(doc->fresh.count == doc->freshCapacity){
+            doc->freshCapacity = doc->freshCapacity ? doc->freshCapacity * 2 : 16;
+            doc->freshStart = realloc(doc->freshStart, doc->freshCapacity * sizeof(size_t));
+        }
+        doc->freshStart[doc->fresh.count] = start;
+        parseNextStatement(lex, &doc->fresh);
+    }
+}
+
+static void checkStatement( Document *doc, Context *ctx, int i )
+{
+    FILE *diag = ctx->diag, *code;
+
+    ctx->diag = open_memstream(&doc->log[i].text, &doc->log[i].length);
+    mycheckstmt(&doc->program.statements, i, doc->map);
+    fclose(ctx->diag);
+    ctx->diag = diag;
+
+    doc->code[i].text = NULL;
+    doc->code[i].length = 0;
+    if(doc->opt->optimize < 2){
+        code = open_memstream(&doc->code[i].text, &doc->code[i].length);
+        emitStatement(&doc->ir, &doc->program.statements, i, code, doc->opt->optimize);
+        fclose(code);
+    }
+}
+
+/* old statements [at, at + removed) give way to doc->fresh; the ones after them moved by delta */
+static void spliceStatements( Document *doc, Context *ctx, int at, int removed, long delta )
+{
+    Statements *stmts = &doc->program.statements, *fresh = &doc->fresh;
+    int tail = stmts->count - at - removed, added = fresh->count, i;
+
+    for(i = at; i < at + removed; i++){
+        FreeExpression(stmts->expr[i]);
+        free(doc->code[i].text);
+        free(doc->log[i].text);
+    }
+    reserveStatements(doc, stmts->count - removed + added);
+
+    memmove(stmts->kind + at + added, stmts->kind + at + removed, tail * sizeof(StmtType));
+    memmove(stmts->target + at + added, stmts->target + at + removed, tail * sizeof(*stmts->target));
+    memmove(stmts->expr + at + added, stmts->expr + at + removed, tail * sizeof(Expression *));
+    memmove(stmts->type + at + added, stmts->type + at + removed, tail * sizeof(DataType));
+    memmove(doc->start + at + added, doc->start + at + removed, tail * sizeof(size_t));
+    memmove(doc->code + at + added, doc->code + at + removed, tail * sizeof(Fragment));
+    memmove(doc->log + at + added, doc->log + at + removed, tail * sizeof(Fragment));
+    for(i = at + added; i < at + added + tail; i++)
+        doc->start[i] += delta;
+
+    memcpy(stmts->kind + at, fresh->kind, added * sizeof(StmtType));
+    memcpy(stmts->target + at, fresh->target, added * sizeof(*stmts->target));
+    memcpy(stmts->expr + at, fresh->expr, added * sizeof(Expression *));
+    memcpy(stmts->type + at, fresh->type, added * sizeof(DataType));
+    memcpy(doc->start + at, doc->freshStart, added * sizeof(size_t));
+    stmts->count += added - removed;
+    fresh->count = 0;/* the trees belong to the program now */
+
+    for(i = at; i < at + added; i++)
+        checkStatement(doc, ctx, i);
+}
+
+/* at -O2 the passes see the whole program, its code is made again after every edit */
+static void emitWhole( Document *doc )
+{
+    IRProgram ir;
+    FILE *code;
+
+    if(doc->opt->optimize < 2)
+        return;
+    free(doc->whole.text);
+    code = open_memstream(&doc->whole.text, &doc->whole.length);
+    InitializeIR(&ir);
+    lower_program(&ir, &doc->program);
+    run_passes(&ir, doc->opt->optimize);
+    ir_gencode(&ir, code);
+    FreeIR(&ir);
+    fclose(code);
+}
+
+/* parse again from first on, everything when first is -1; returns the status like compile */
+static int update( Document *doc, int first, size_t resync, long delta )
+{
+    Context ctx, *caller;
+    Lexer lex;
+    FILE *diag;
+    int j;
+
+    free(doc->error.text);
+    ctx.diag = open_memstream(&doc->error.text, &doc->error.length);
+    caller = enterContext(&ctx);
+    if(setjmp(ctx.fail)){
+        enterContext(caller);
+        fclose(ctx.diag);
+        FreeStatements(&doc->fresh);
+        memset(&doc->fresh, 0, sizeof(doc->fresh));
+        doc->broken = true;
+        return 1;
+    }
+
+    if(first < 0){
+        clearDocument(doc);
+        InitializeLexer(&lex, doc->text, doc->length);
+        parseDeclarations(&lex, &doc->program.declarations);
+        parseUntilResync(doc, &lex, 0, doc->length + 1, 0);
+
+        diag = ctx.diag;
+        ctx.diag = open_memstream(&doc->build.text, &doc->build.length);
+        doc->map = mybuild(doc->program);
+        bind_map(doc->map, doc->opt);
+        fclose(ctx.diag);
+        ctx.diag = diag;
+        lower_declarations(&doc->ir, &doc->program.declarations);
+        spliceStatements(doc, &ctx, 0, 0, 0);
+    }
+    else{
+        InitializeLexer(&lex, doc->text + doc->start[first], doc->length - doc->start[first]);
+        lex.depth = loopDepth(&doc->program.statements, first);
+        j = parseUntilResync(doc, &lex, first, resync, delta);
+        spliceStatements(doc, &ctx, first, j - first, delta);
+    }
+    emitWhole(doc);
+
+    enterContext(caller);
+    fclose(ctx.diag);
+    doc->broken = false;
+    return 0;
+}
+
+int InitializeDocument( Document *doc, const char *text, size_t len, Options *opt )
+{
+    memset(doc, 0, sizeof(Document));
+    InitializeIR(&doc->ir);
+    doc->opt = opt;
+    doc->size = len + 1;
+    doc->text = malloc(doc->size);
+    memcpy(doc->text, text, len);
+    doc->length = len;
+    return update(doc, -1, 0, 0);
+}
+
+/* replace bytes [from, to) by len bytes of text; 2 if the range is not in the text */
+int editDocument( Document *doc, size_t from, size_t to, const char *text, size_t len )
+{
+    Statements *stmts = &doc->program.statements;
+    long delta = (long)len - (long)(to - from);
+    int lo, hi, mid;
+
+    if(from > to || to > doc->length)
+        return 2;
+    if(doc->length + delta + 1 > doc->size){
+        doc->size = (doc->length + delta + 1) * 2;
+        doc->text = realloc(doc->text, doc->size);
+    }
+    memmove(doc->text + from + len, doc->text + to, doc->length - to);
+    memcpy(doc->text + from, text, len);
+    doc->length += delta;
+
+    if(doc->broken || stmts->count == 0 || from <= doc->start[0])
+        return update(doc, -1, 0, 0);
+
+    /* the last statement that starts before the edit */
+    lo = 0;
+    hi = stmts->count - 1;
+    while(lo < hi){
+        mid = (lo + hi + 1) / 2;
+        if(doc->start[mid] < from)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return update(doc, lo, from + len, delta);
+}
+
+/* a fragment that was never printed to has no text at all */
+static void writeFragment( Fragment *fragment, FILE *out )
+{
+    if(fragment->length > 0)
+        fwrite(fragment->text, 1, fragment->length, out);
+}
+
+/* what compiling the current text from scratch would print */
+void writeDocument( Document *doc, FILE *code, FILE *diag )
+{
+    FILE *target = code;
+    char *buf;
+    size_t codeLength;
+    int i;
+
+    if(doc->broken){
+        writeFragment(&doc->error, diag);
+        return;
+    }
+    if(doc->opt->factor)
+        code = open_memstream(&buf, &codeLength);
+    writeFragment(&doc->build, diag);
+    for(i = 0; i < doc->program.statements.count; i++){
+        writeFragment(&doc->log[i], diag);
+        writeFragment(&doc->code[i], code);
+    }
+    writeFragment(&doc->whole, code);
+    if(doc->opt->factor){
+        fclose(code);
+        factor_macros(buf, codeLength, target);
+        free(buf);
+    }
+}
+
+void FreeDocument( Document *doc )
+{
+    clearDocument(doc);
+    FreeIR(&doc->ir);
+    free(doc->text);
+    free(doc->start);
+    free(doc->code);
+    free(doc->log);
+    free(doc->freshStart);
+    free(doc->error.text);
+}
+
+/*
+   --edits: compile source_file, apply the edits in the edit file one after
+   the other and write what the last version compiles to. Every edit is a
+   line "FROM TO LEN" and then LEN bytes that replace bytes [FROM, TO).
+*/
+int compileEdits( Context *ctx, const char *source_file, const char *target_file, Options *opt )
+{
+    FILE *source, *edits, *target;
+    Document doc;
+    char line[256], *text;
+    size_t len, from, to;
+    int status;
+
+    source = fopen(source_file, "r");
+    edits = fopen(opt->edits, "r");
+    if( !source || !edits ){
+        fprintf(ctx->diag, !source ? "can't open the source file\n" : "can't open the edit file\n");
+        if(source)
+            fclose(source);
+        if(edits)
+            fclose(edits);
+        return 2;
+    }
+    text = read_source(source, &len);
+    fclose(source);
+    status = InitializeDocument(&doc, text, len, opt);
+    free(text);
+
+    while(status != 2 && fgets(line, sizeof(line), edits) != NULL){
+        if(sscanf(line, "%zu %zu %zu", &from, &to, &len) != 3){
+            status = 2;
+            break;
+        }
+        text = malloc(len + 1);
+        if(fread(text, 1, len, edits) != len)
+            status = 2;
+        else
+            status = editDocument(&doc, from, to, text, len);
+        free(text);
+    }
+    fclose(edits);
+
+    if(status == 2)
+        fprintf(ctx->diag, "bad edit : %s", line);
+    else if( (target = fopen(target_file, "w")) == NULL ){
+        fprintf(ctx->diag, "can't open the target file\n");
+        status = 2;
+    }
+    else{
+        writeDocument(&doc, target, ctx->diag);
+        fclose(target);
+    }
+    FreeDocument(&doc);
+    return status;
+}
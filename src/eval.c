@@ -0,0 +1,1324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "header.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+   Columnar evaluation, AcDc --eval INPUT source_file target_file.
+
+   Instead of printing dc code, AcDc runs the checked and optimized IR of
+   the program itself, once for every row of the input. Declared
+   variables are bound to input columns by name, either the fields of a
+   csv file whose first line names them, or binary files of native 32 bit
+   ints or floats given as "a=a.bin,b=b.bin". Variables without a column
+   start at 0. Every p statement gives a column of the csv written to
+   target_file, headed by the name of the variable it prints.
+
+   Rows are evaluated a block at a time: each instruction computes its
+   value for all rows of the block with the widest vector instructions
+   the cpu has. Values live in slots that are reused once their last
+   user has run, so the memory does not grow with the length of the program.
+   With -j N the statements that do not depend on each other are shared
+   between N threads, see planEvaluation. Repeat loops are written out
+   as often as they run before anything is planned. source_file may be
+   an image of --emit=image, its IR is then run as the passes left it.
+
+   Ints are exact like in dc, also the int divisions that dc runs at 5k
+   after a conversion, see promoteFractions. The value ranges of the IR
+   tell which ones surely fit in 32 bits: those are computed 32 bits at a
+   time with the vector routines, the others in 64 bits, and a block
+   where one does not fit in 64 bits either is evaluated again a row at a
+   time with the Numbers of number.c. The rest is the machine's
+   arithmetic, not dc's: an int division at 0k truncates and gives 0 for
+   a division by zero, floats are single precision with no 5k truncation,
+   and a float assigned to an int is truncated to 32 bits.
+*/
+
+#define MaxBlockRows 1024
+#define MaxEvalCells (1 << 22)
+#define MinParallelWork 64
+#define MaxEvalInstructions (1 << 24)
+
+/****  Column operations ****/
+
+static void add_int_scalar( int32_t *r, const int32_t *a, const int32_t *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+}
+
+static void sub_int_scalar( int32_t *r, const int32_t *a, const int32_t *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = (int32_t)((uint32_t)a[i] - (uint32_t)b[i]);
+}
+
+static void mul_int_scalar( int32_t *r, const int32_t *a, const int32_t *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = (int32_t)((uint32_t)a[i] * (uint32_t)b[i]);
+}
+
+/* no vector unit divides ints, every set of operations uses this one */
+static void div_int_scalar( int32_t *r, const int32_t *a, const int32_t *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++)
+        r[i] = b[i] == 0 ? 0 : b[i] == -1 ? (int32_t)(0u - (uint32_t)a[i]) : a[i] / b[i];
+}
+
+static void add_float_scalar( float *r, const float *a, const float *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i] + b[i];
+}
+
+static void sub_float_scalar( float *r, const float *a, const float *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i] - b[i];
+}
+
+static void mul_float_scalar( float *r, const float *a, const float *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i] * b[i];
+}
+
+static void div_float_scalar( float *r, const float *a, const float *b, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i] / b[i];
+}
+
+static void int_to_float_scalar( float *r, const int32_t *a, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i];
+}
+
+/* truncates, out of range and nan give INT32_MIN like the vector conversions */
+static void float_to_int_scalar( int32_t *r, const float *a, int n )
+{
+    int i;
+    for(i = 0; i < n; i++)
+        r[i] = a[i] > -2147483904.0f && a[i] < 2147483648.0f ? (int32_t)a[i] : INT32_MIN;
+}
+
+/* widening runs backwards, so a may be r */
+static void widen_int( int64_t *r, const int32_t *a, int n )
+{
+    int i;
+    for(i = n - 1; i >= 0; i--) r[i] = a[i];
+}
+
+/* the values fit, a may be r */
+static void narrow_int( int32_t *r, const int64_t *a, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = (int32_t)a[i];
+}
+
+static void wide_to_float( float *r, const int64_t *a, int n )
+{
+    int i;
+    for(i = 0; i < n; i++) r[i] = a[i];
+}
+
+/* 64 bit ints for the values whose range does not fit in 32 bits, true if one does not fit in 64 either */
+static bool wide_int( IROp op, int64_t *r, const int64_t *a, const int64_t *b, int n )
+{
+    bool overflow = false;
+    int i;
+
+    switch(op){
+        case IRAdd:
+            for(i = 0; i < n; i++) overflow |= __builtin_add_overflow(a[i], b[i], &r[i]);
+            break;
+        case IRSub:
+            for(i = 0; i < n; i++) overflow |= __builtin_sub_overflow(a[i], b[i], &r[i]);
+            break;
+        case IRMul:
+            for(i = 0; i < n; i++) overflow |= __builtin_mul_overflow(a[i], b[i], &r[i]);
+            break;
+        default:
+            for(i = 0; i < n; i++){
+                overflow |= (a[i] == INT64_MIN && b[i] == -1);
+                r[i] = b[i] == 0 ? 0 : b[i] == -1 ? (int64_t)(0ull - (uint64_t)a[i]) : a[i] / b[i];
+            }
+            break;
+    }
+    return overflow;
+}
+
+static const EvalOps eval_scalar = { "scalar", add_int_scalar, sub_int_scalar, mul_int_scalar, div_int_scalar,
+    add_float_scalar, sub_float_scalar, mul_float_scalar, div_float_scalar, int_to_float_scalar, float_to_int_scalar };
+
+#if defined(__x86_64__) || defined(__i386__)
+/* whole vectors of width rows, then the scalar routine for the rest */
+#define IntLoop(name, isa, vec, width, load, store, op, tail) \
+__attribute__((target(isa))) \
+static void name( int32_t *r, const int32_t *a, const int32_t *b, int n ) \
+{ \
+    int i; \
+    for(i = 0; i + (width) <= n; i += (width)) \
+        store((vec *)(r + i), op(load((const vec *)(a + i)), load((const vec *)(b + i)))); \
+    tail(r + i, a + i, b + i, n - i); \
+}
+#define FloatLoop(name, isa, width, load, store, op, tail) \
+__attribute__((target(isa))) \
+static void name( float *r, const float *a, const float *b, int n ) \
+{ \
+    int i; \
+    for(i = 0; i + (width) <= n; i += (width)) \
+        store(r + i, op(load(a + i), load(b + i))); \
+    tail(r + i, a + i, b + i, n - i); \
+}
+
+/* sse2 has no 32 bit multiply that keeps the low halves, build it from two 64 bit ones */
+__attribute__((target("sse2")))
+static inline __m128i mullo_epi32_sse2( __m128i x, __m128i y )
+{
+    __m128i even = _mm_mul_epu32(x, y);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+IntLoop(add_int_sse2, "sse2", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32, add_int_scalar)
+IntLoop(sub_int_sse2, "sse2", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_sub_epi32, sub_int_scalar)
+IntLoop(mul_int_sse2, "sse2", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, mullo_epi32_sse2, mul_int_scalar)
+FloatLoop(add_float_sse2, "sse2", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, add_float_scalar)
+FloatLoop(sub_float_sse2, "sse2", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_sub_ps, sub_float_scalar)
+FloatLoop(mul_float_sse2, "sse2", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps, mul_float_scalar)
+FloatLoop(div_float_sse2, "sse2", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_div_ps, div_float_scalar)
+
+__attribute__((target("sse2")))
+static void int_to_float_sse2( float *r, const int32_t *a, int n )
+{
+    int i;
+    for(i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_ps(r + i, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(a + i))));
+    int_to_float_scalar(r + i, a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void float_to_int_sse2( int32_t *r, const float *a, int n )
+{
+    int i;
+    for(i = 0; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(r + i), _mm_cvttps_epi32(_mm_loadu_ps(a + i)));
+    float_to_int_scalar(r + i, a + i, n - i);
+}
+
+IntLoop(add_int_avx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32, add_int_scalar)
+IntLoop(sub_int_avx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_sub_epi32, sub_int_scalar)
+IntLoop(mul_int_avx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_mullo_epi32, mul_int_scalar)
+FloatLoop(add_float_avx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, add_float_scalar)
+FloatLoop(sub_float_avx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_sub_ps, sub_float_scalar)
+FloatLoop(mul_float_avx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps, mul_float_scalar)
+FloatLoop(div_float_avx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_div_ps, div_float_scalar)
+
+__attribute__((target("avx2")))
+static void int_to_float_avx2( float *r, const int32_t *a, int n )
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(a + i))));
+    int_to_float_scalar(r + i, a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void float_to_int_avx2( int32_t *r, const float *a, int n )
+{
+    int i;
+    for(i = 0; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *)(r + i), _mm256_cvttps_epi32(_mm256_loadu_ps(a + i)));
+    float_to_int_scalar(r + i, a + i, n - i);
+}
+
+static const EvalOps eval_sse2 = { "sse2", add_int_sse2, sub_int_sse2, mul_int_sse2, div_int_scalar,
+    add_float_sse2, sub_float_sse2, mul_float_sse2, div_float_sse2, int_to_float_sse2, float_to_int_sse2 };
+static const EvalOps eval_avx2 = { "avx2", add_int_avx2, sub_int_avx2, mul_int_avx2, div_int_scalar,
+    add_float_avx2, sub_float_avx2, mul_float_avx2, div_float_avx2, int_to_float_avx2, float_to_int_avx2 };
+#endif
+
+static const EvalOps *selected_eval_ops;
+static pthread_once_t eval_ops_once = PTHREAD_ONCE_INIT;
+
+static void detect_eval_ops( void )
+{
+    selected_eval_ops = &eval_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        selected_eval_ops = &eval_avx2;
+    else if(__builtin_cpu_supports("sse2"))
+        selected_eval_ops = &eval_sse2;
+#endif
+}
+
+/* like select_scan_ops, the widest column routines the running cpu supports */
+const EvalOps *select_eval_ops( void )
+{
+    pthread_once(&eval_ops_once, detect_eval_ops);
+    return selected_eval_ops;
+}
+
+
+/****  Planning ****/
+
+/* the type an instruction reads its operands as */
+static DataType operand_type( IRInst *inst )
+{
+    return inst->op == IRIntToFloat ? Int : inst->type;
+}
+
+/*
+   The checker lets a float be assigned to an int after reporting it, and
+   propagation then hands the float on to whatever reads the int. Such
+   operands are converted before use, into the instruction's own slot for
+   a store or a print and into a scratch slot for anything else.
+*/
+static bool converts( IRProgram *ir, IRInst *inst, int operand )
+{
+    return operand >= 0 && ir->insts[operand].type != operand_type(inst);
+}
+
+static bool computes( IRProgram *ir, IRInst *inst )
+{
+    return inst->op == IRConstInt || inst->op == IRConstFloat || (inst->op >= IRAdd && inst->op <= IRIntToFloat) ||
+        ((inst->op == IRStore || inst->op == IRPrint) && converts(ir, inst, inst->a));
+}
+
+/*
+   dc runs an int division that comes after a 5k in its statement with 5
+   digits after the point, and the int arithmetic on such a quotient keeps
+   them. They only reach a float in practice: the int part of a float
+   expression is converted once it is computed. Such a fraction is then
+   computed as a float from its int operands, like the rest of the float
+   arithmetic, and the conversion of it is the value itself. False if a
+   fraction reaches anything but a conversion, it is then left as it is
+   and only the exact evaluation, which runs it at 5k, gets it right.
+*/
+static bool promoteFractions( IRProgram *ir, const bool *at5k )
+{
+    bool *fraction = allocateHeap((ir->count + 1) * sizeof(bool));
+    bool *stuck = allocateHeap((ir->count + 1) * sizeof(bool));
+    int *replace = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    bool promoted = true;
+    IRInst *inst;
+    int i, k, x;
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        fraction[i] = inst->type == Int && at5k[i] && (inst->op == IRDiv ||
+            (inst->op >= IRAdd && inst->op <= IRMul && (fraction[inst->a] || fraction[inst->b])));
+    }
+    for(i = ir->count - 1; i >= 0; i--){/* the users of an instruction come after it */
+        inst = &ir->insts[i];
+        for(k = 0; k < 2 && inst->op != IRIntToFloat; k++){
+            x = k == 0 ? inst->a : inst->b;
+            if(x >= 0 && fraction[x] && (!fraction[i] || stuck[i]))
+                stuck[x] = promoted = false;
+        }
+    }
+    for(i = 0; i < ir->count && promoted; i++){
+        inst = &ir->insts[i];
+        replace[i] = i;
+        if(inst->a >= 0) inst->a = replace[inst->a];
+        if(inst->b >= 0) inst->b = replace[inst->b];
+        if(fraction[i])
+            inst->type = Float;
+        else if(inst->op == IRIntToFloat && fraction[inst->a]){
+            replace[i] = inst->a;
+            inst->op = IRNop;
+            inst->a = -1;
+        }
+    }
+    releaseHeap(fraction);
+    releaseHeap(stuck);
+    releaseHeap(replace);
+    return promoted;
+}
+
+/* split the parallel segments between the threads, evenly by instructions but never inside a statement */
+static void planParts( EvalPlan *plan, int *stmt )
+{
+    int threads = plan->threads, s, t, p, *parts;
+    EvalSegment *seg;
+
+    plan->parts = reallocateHeap(NULL, (plan->segmentCount * (threads + 1) + 1) * sizeof(int));
+    for(s = 0; s < plan->segmentCount; s++){
+        seg = &plan->segments[s];
+        parts = plan->parts + s * (threads + 1);
+        parts[0] = seg->start;
+        parts[threads] = seg->end;
+        for(t = 1; t < threads; t++){
+            p = seg->start + (long)(seg->end - seg->start) * t / threads;
+            if(p < parts[t - 1])
+                p = parts[t - 1];
+            while(p > seg->start && p < seg->end && stmt[plan->order[p]] == stmt[plan->order[p - 1]])
+                p++;
+            parts[t] = p;
+        }
+    }
+}
+
+/*
+   Slots are handed out in the order the instructions run and taken back
+   after the last use of their value; printed values are kept to the end.
+   As far as slots go, the instructions of a parallel segment all run at
+   once: they get their slots before it and give them back after it.
+*/
+static void planSlots( IRProgram *ir, EvalPlan *plan, int *owner )
+{
+    int n = plan->orderCount;
+    int *stamp = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *lastUse = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *head = reallocateHeap(NULL, (n + 1) * sizeof(int));
+    int *next = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *freeSlots = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int freeCount = 0, s, p, i, j, k, x, rows;
+    EvalSegment *seg;
+
+    for(s = 0; s < plan->segmentCount; s++){
+        seg = &plan->segments[s];
+        for(p = seg->start; p < seg->end; p++)
+            stamp[plan->order[p]] = seg->parallel ? seg->end - 1 : p;
+    }
+    for(p = 0; p < n; p++){
+        head[p] = -1;
+        lastUse[plan->order[p]] = stamp[plan->order[p]];
+    }
+    for(p = 0; p < n; p++){
+        i = plan->order[p];
+        for(k = 0; k < 2; k++){
+            x = k == 0 ? ir->insts[i].a : ir->insts[i].b;
+            if(x >= 0 && owner[x] >= 0 && lastUse[owner[x]] < stamp[i])
+                lastUse[owner[x]] = stamp[i];
+        }
+    }
+    for(i = 0; i < ir->count; i++)
+        if(ir->insts[i].op == IRPrint && owner[i] >= 0)
+            lastUse[owner[i]] = n;
+    for(p = 0; p < n; p++){
+        i = plan->order[p];
+        if(lastUse[i] < n){
+            next[i] = head[lastUse[i]];
+            head[lastUse[i]] = i;
+        }
+    }
+
+    for(s = 0; s < plan->segmentCount; s++){
+        seg = &plan->segments[s];
+        if(seg->parallel){
+            for(p = seg->start; p < seg->end; p++)
+                plan->location[plan->order[p]] = freeCount > 0 ? freeSlots[--freeCount] : plan->slotCount++;
+            for(j = head[seg->end - 1]; j >= 0; j = next[j])
+                freeSlots[freeCount++] = plan->location[j];
+            continue;
+        }
+        /* an operand's slot may be the result's, the routines work row by row */
+        for(p = seg->start; p < seg->end; p++){
+            i = plan->order[p];
+            for(j = head[p]; j >= 0; j = next[j])
+                if(j != i)
+                    freeSlots[freeCount++] = plan->location[j];
+            plan->location[i] = freeCount > 0 ? freeSlots[--freeCount] : plan->slotCount++;
+            if(lastUse[i] == p)
+                freeSlots[freeCount++] = plan->location[i];
+        }
+    }
+    for(i = 0; i < ir->count; i++)
+        if(owner[i] != i)
+            plan->location[i] = owner[i] >= 0 ? plan->location[owner[i]] : owner[i];
+
+    plan->scratch = plan->slotCount;
+    plan->slotCount += 2 * plan->threads;
+    rows = MaxEvalCells / (plan->slotCount + 1) & ~7;
+    plan->blockRows = rows < 8 ? 8 : rows > MaxBlockRows ? MaxBlockRows : rows;
+
+    releaseHeap(stamp);
+    releaseHeap(lastUse);
+    releaseHeap(head);
+    releaseHeap(next);
+    releaseHeap(freeSlots);
+}
+
+/* a binary int column is scanned for its smallest and largest value, a csv one may hold any 32 bit int */
+static void inputRanges( IRProgram *ir, EvalInput *in, IRRange *inputs )
+{
+    EvalColumn *column;
+    const int32_t *values;
+    long k;
+    int i;
+
+    for(i = 0; i < ir->symCount; i++){/* the variables without a column are 0 */
+        inputs[i].lo = inputs[i].hi = 0;
+        inputs[i].bounded = true;
+    }
+    for(i = 0; i < in->count; i++){
+        column = &in->columns[i];
+        if(ir->syms[column->sym].type != Int)
+            continue;
+        if(in->csv != NULL){
+            inputs[column->sym].lo = INT32_MIN;
+            inputs[column->sym].hi = INT32_MAX;
+            continue;
+        }
+        values = column->base;
+        for(k = 0; k < in->rows; k++){
+            if(k == 0 || values[k] < inputs[column->sym].lo)
+                inputs[column->sym].lo = values[k];
+            if(k == 0 || values[k] > inputs[column->sym].hi)
+                inputs[column->sym].hi = values[k];
+        }
+    }
+}
+
+/*
+   Follow the variables through the program once, the same for every
+   block: a load is the value last stored to its variable, or its input
+   column, and a statement depends on the statements whose values it
+   reads. Stores make a new version of their variable instead of
+   overwriting it, so reading is the only dependence there is.
+
+   With one thread the instructions run in program order. With more, a
+   statement's level is one more than that of the statements it reads
+   from, and the statements of a level do not depend on each other: a
+   level with enough work is split between the threads, narrow levels
+   run one after the other on the first thread. A program then takes as
+   many steps as its longest chain of statements.
+*/
+void planEvaluation( IRProgram *ir, EvalPlan *plan, EvalInput *in, int threads )
+{
+    IRRange *inputs = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(IRRange));
+    IRRange *range = reallocateHeap(NULL, (ir->count + 1) * sizeof(IRRange));
+    int *current = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(int));
+    int *owner = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *stmt = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *level = allocateHeap((ir->count + 1) * sizeof(int));
+    int *levelStart, *levelWork, *levelStmts;
+    int stmtCount = 0, levelCount = 1, i, l, x, o, k;
+    IRInst *inst;
+
+    plan->location = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    plan->wide = reallocateHeap(NULL, (ir->count + 1) * sizeof(bool));
+    plan->prints = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    plan->printCount = 0;
+    plan->slotCount = 0;
+
+    /* the instruction that computes each value, or the location of a column */
+    for(i = 0; i < ir->symCount; i++)
+        current[i] = -1;
+    for(i = 0; i < in->count; i++)
+        current[in->columns[i].sym] = -2 - i;
+    inputRanges(ir, in, inputs);
+    ir_ranges(ir, inputs, range);
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        stmt[i] = stmtCount;
+        if(computes(ir, inst))
+            owner[i] = i;
+        else if(inst->op == IRLoad)
+            owner[i] = current[inst->sym];
+        else if(inst->op == IRStore || inst->op == IRPrint)
+            owner[i] = owner[inst->a];
+        else
+            owner[i] = -1;
+        if(owner[i] != i)/* a converted store or print is truncated to 32 bits */
+            plan->wide[i] = owner[i] >= 0 && plan->wide[owner[i]];
+        else
+            plan->wide[i] = inst->type == Int && inst->op != IRStore && inst->op != IRPrint && !ir_fits32(range[i]);
+        for(k = 0; k < 2 && threads > 1; k++){
+            x = k == 0 ? inst->a : inst->b;
+            o = x >= 0 ? owner[x] : -1;
+            if(o >= 0 && stmt[o] != stmtCount && level[stmtCount] <= level[stmt[o]])
+                level[stmtCount] = level[stmt[o]] + 1;
+        }
+        if(inst->op == IRStore)
+            current[inst->sym] = owner[i];
+        if(inst->op == IRPrint)
+            plan->prints[plan->printCount++] = i;
+        if(inst->op == IRStore || inst->op == IRPrint){
+            if(level[stmtCount] >= levelCount)
+                levelCount = level[stmtCount] + 1;
+            stmtCount++;
+        }
+    }
+
+    /* the instructions that compute, level by level and in program order within a level */
+    levelStart = allocateHeap((levelCount + 1) * sizeof(int));
+    levelWork = allocateHeap((levelCount + 1) * sizeof(int));
+    levelStmts = allocateHeap((levelCount + 1) * sizeof(int));
+    for(i = 0; i < ir->count; i++){
+        if(computes(ir, &ir->insts[i]))
+            levelWork[level[stmt[i]]]++;
+        if(ir->insts[i].op == IRStore || ir->insts[i].op == IRPrint)
+            levelStmts[level[stmt[i]]]++;
+    }
+    for(l = 0; l < levelCount; l++)
+        levelStart[l + 1] = levelStart[l] + levelWork[l];
+    plan->orderCount = levelStart[levelCount];
+    plan->order = reallocateHeap(NULL, (plan->orderCount + 1) * sizeof(int));
+    for(i = 0; i < ir->count; i++)
+        if(computes(ir, &ir->insts[i]))
+            plan->order[levelStart[level[stmt[i]]]++] = i;
+    for(l = levelCount; l > 0; l--)
+        levelStart[l] = levelStart[l - 1];
+    levelStart[0] = 0;
+
+    plan->threads = threads;
+    plan->segments = reallocateHeap(NULL, (levelCount + 1) * sizeof(EvalSegment));
+    plan->segmentCount = 0;
+    for(l = 0; l < levelCount; l++){
+        bool parallel = threads > 1 && levelStmts[l] > 1 && levelWork[l] >= MinParallelWork;
+        EvalSegment *last = &plan->segments[plan->segmentCount - 1];
+
+        if(plan->segmentCount > 0 && !parallel && !last->parallel)
+            last->end = levelStart[l + 1];
+        else{
+            last = &plan->segments[plan->segmentCount++];
+            last->start = levelStart[l];
+            last->end = levelStart[l + 1];
+            last->parallel = parallel;
+        }
+    }
+    for(k = 0; k < plan->segmentCount && !plan->segments[k].parallel; k++);
+    if(k == plan->segmentCount)/* nothing wide enough to share */
+        plan->threads = 1;
+    planParts(plan, stmt);
+    planSlots(ir, plan, owner);
+
+    releaseHeap(inputs);
+    releaseHeap(range);
+    releaseHeap(current);
+    releaseHeap(owner);
+    releaseHeap(stmt);
+    releaseHeap(level);
+    releaseHeap(levelStart);
+    releaseHeap(levelWork);
+    releaseHeap(levelStmts);
+}
+
+void FreePlan( EvalPlan *plan )
+{
+    releaseHeap(plan->location);
+    releaseHeap(plan->wide);
+    releaseHeap(plan->order);
+    releaseHeap(plan->segments);
+    releaseHeap(plan->parts);
+    releaseHeap(plan->prints);
+    releaseHeap(plan->names);
+    releaseHeap(plan->at5k);
+}
+
+
+/****  Input ****/
+
+static int find_symbol( IRProgram *ir, const char *name )
+{
+    int i;
+
+    for(i = 0; i < ir->symCount; i++)
+        if(strcmp(ir->syms[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static bool bound( EvalInput *in, int sym )
+{
+    int i;
+
+    for(i = 0; i < in->count; i++)
+        if(in->columns[i].sym == sym)
+            return true;
+    return false;
+}
+
+/* "a=a.bin,b=b.bin", every file the rows of one variable as native 32 bit ints or floats */
+bool openColumns( Context *ctx, IRProgram *ir, char *spec, EvalInput *in )
+{
+    char *binding, *path, *rest;
+    EvalColumn *column;
+    struct stat st;
+    int fd, sym;
+
+    memset(in, 0, sizeof(EvalInput));
+    in->columns = allocateHeap((ir->symCount + 1) * sizeof(EvalColumn));
+    in->rows = -1;
+    for(binding = strtok_r(spec, ",", &rest); binding != NULL; binding = strtok_r(NULL, ",", &rest)){
+        path = strchr(binding, '=');
+        if(path == NULL){
+            fprintf(ctx->diag, "bad column %s, expected variable=file\n", binding);
+            return false;
+        }
+        *path++ = '\0';
+        sym = find_symbol(ir, binding);
+        if(sym < 0 || bound(in, sym)){
+            fprintf(ctx->diag, sym < 0 ? "%s is not a declared variable\n" : "%s is bound twice\n", binding);
+            return false;
+        }
+        fd = open(path, O_RDONLY);
+        if(fd < 0 || fstat(fd, &st) != 0 || st.st_size % 4 != 0){
+            fprintf(ctx->diag, fd < 0 ? "can't open the column %s\n" : "%s is not a column of 32 bit values\n", path);
+            if(fd >= 0)
+                close(fd);
+            return false;
+        }
+        if(in->rows >= 0 && in->rows != st.st_size / 4){
+            fprintf(ctx->diag, "%s has %ld rows, the other columns %ld\n", path, (long)(st.st_size / 4), in->rows);
+            close(fd);
+            return false;
+        }
+        column = &in->columns[in->count++];
+        column->sym = sym;
+        column->size = st.st_size;
+        if(column->size > 0){
+            column->base = mmap(NULL, column->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(column->base == MAP_FAILED){
+                column->base = NULL;
+                fprintf(ctx->diag, "can't map the column %s\n", path);
+                close(fd);
+                return false;
+            }
+        }
+        close(fd);
+        in->rows = st.st_size / 4;
+    }
+    if(in->rows < 0)
+        in->rows = 0;
+    return true;
+}
+
+/* trims the field in place */
+static char *csv_field( char **p )
+{
+    char *start = *p, *end;
+
+    *p = strchr(start, ',');
+    if(*p != NULL)
+        *(*p)++ = '\0';
+    while(*start == ' ' || *start == '\t')
+        start++;
+    end = start + strlen(start);
+    while(end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        end--;
+    *end = '\0';
+    return start;
+}
+
+/* the first line names the fields, fields that are no variable are skipped */
+bool openCsv( Context *ctx, IRProgram *ir, const char *path, EvalInput *in )
+{
+    char *p, *name;
+    int sym;
+
+    memset(in, 0, sizeof(EvalInput));
+    in->columns = allocateHeap((ir->symCount + 1) * sizeof(EvalColumn));
+    in->csv = fopen(path, "r");
+    if(in->csv == NULL){
+        fprintf(ctx->diag, "can't open the input %s\n", path);
+        return false;
+    }
+    if(getline(&in->text, &in->textSize, in->csv) < 0){
+        fprintf(ctx->diag, "%s has no header line\n", path);
+        return false;
+    }
+    in->line = 1;
+    for(p = in->text; p != NULL; in->fieldCount++){
+        in->fields = reallocateHeap(in->fields, (in->fieldCount + 1) * sizeof(int));
+        name = csv_field(&p);
+        sym = find_symbol(ir, name);
+        if(sym >= 0 && bound(in, sym)){
+            fprintf(ctx->diag, "%s : the field %s is there twice\n", path, name);
+            return false;
+        }
+        in->fields[in->fieldCount] = sym >= 0 ? in->count : -1;
+        if(sym >= 0)
+            in->columns[in->count++].sym = sym;
+    }
+    return true;
+}
+
+void FreeInput( EvalInput *in )
+{
+    int i;
+
+    for(i = 0; i < in->count; i++){
+        if(in->columns[i].base != NULL)
+            munmap(in->columns[i].base, in->columns[i].size);
+        releaseHeap(in->columns[i].rows);
+    }
+    if(in->csv != NULL)
+        fclose(in->csv);
+    releaseHeap(in->columns);
+    releaseHeap(in->fields);
+    free(in->text);
+}
+
+/* the rows from first on, at most rows of them; the number there are, or -1 after a bad line */
+int readBlock( Context *ctx, IRProgram *ir, EvalInput *in, long first, int rows )
+{
+    EvalColumn *column;
+    char *p, *field, *end;
+    int n = 0, i, col;
+    long value;
+
+    if(in->csv == NULL)
+        return in->rows - first < rows ? in->rows - first : rows;
+
+    for(i = 0; i < in->count; i++)
+        if(in->columns[i].rows == NULL)
+            in->columns[i].rows = reallocateHeap(NULL, rows * sizeof(int32_t));
+    while(n < rows && getline(&in->text, &in->textSize, in->csv) >= 0){
+        in->line++;
+        if(strspn(in->text, " \t\r\n") == strlen(in->text))
+            continue;
+        p = in->text;
+        for(i = 0; i < in->fieldCount; i++){
+            if(p == NULL){
+                fprintf(ctx->diag, "line %ld : %d fields, the header has %d\n", in->line, i, in->fieldCount);
+                return -1;
+            }
+            field = csv_field(&p);
+            if((col = in->fields[i]) < 0)
+                continue;
+            column = &in->columns[col];
+            errno = 0;
+            if(ir->syms[column->sym].type == Int){
+                value = strtol(field, &end, 10);
+                if(value < INT32_MIN || value > INT32_MAX)
+                    errno = ERANGE;
+                ((int32_t *)column->rows)[n] = value;
+            }
+            else
+                ((float *)column->rows)[n] = strtof(field, &end);
+            if(end == field || *end != '\0' || errno == ERANGE){
+                fprintf(ctx->diag, "line %ld : %s is not a value of %s\n", in->line, field, ir->syms[column->sym].name);
+                return -1;
+            }
+        }
+        n++;
+    }
+    return n;
+}
+
+
+/****  Evaluation ****/
+
+static void *locate( Evaluation *run, int location )
+{
+    EvalColumn *column;
+
+    if(location >= 0)
+        return run->slots[location];
+    if(location == -1)
+        return run->zeros;
+    column = &run->in->columns[-2 - location];
+    return run->in->csv != NULL ? column->rows : (char *)column->base + run->first * 4;
+}
+
+static void convert( const EvalOps *ops, DataType type, void *r, void *a, bool wide, int rows )
+{
+    if(type == Int)
+        ops->float_to_int(r, a, rows);
+    else if(wide)
+        wide_to_float(r, a, rows);
+    else
+        ops->int_to_float(r, a, rows);
+}
+
+/* the instructions at positions from up to to of the order, over every row of the block */
+void evaluateRange( Evaluation *run, int from, int to, int thread )
+{
+    const EvalOps *ops = run->ops;
+    IRProgram *ir = run->ir;
+    EvalPlan *plan = run->plan;
+    void *scratch[2] = { run->slots[plan->scratch + 2 * thread], run->slots[plan->scratch + 2 * thread + 1] };
+    int rows = run->rows, p, k, i;
+    IRInst *inst;
+    void *r, *a, *b;
+    bool wideA, wideB;
+
+    for(p = from; p < to; p++){
+        i = plan->order[p];
+        inst = &ir->insts[i];
+        r = run->slots[plan->location[i]];
+        a = inst->a >= 0 ? locate(run, plan->location[inst->a]) : NULL;
+        b = inst->b >= 0 ? locate(run, plan->location[inst->b]) : NULL;
+        wideA = inst->a >= 0 && plan->wide[inst->a];
+        wideB = inst->b >= 0 && plan->wide[inst->b];
+        if(inst->op == IRStore || inst->op == IRPrint){
+            convert(ops, inst->type, r, a, wideA, rows);
+            continue;
+        }
+        if(converts(ir, inst, inst->a)){
+            convert(ops, operand_type(inst), scratch[0], a, wideA, rows);
+            a = scratch[0];
+            wideA = false;
+        }
+        if(converts(ir, inst, inst->b)){
+            convert(ops, operand_type(inst), scratch[1], b, wideB, rows);
+            b = scratch[1];
+            wideB = false;
+        }
+        if(inst->type == Int && inst->op >= IRAdd && inst->op <= IRDiv && (plan->wide[i] || wideA || wideB)){
+            if(!wideA){
+                widen_int(scratch[0], a, rows);
+                a = scratch[0];
+            }
+            if(!wideB){
+                widen_int(scratch[1], b, rows);
+                b = scratch[1];
+            }
+            if(wide_int(inst->op, r, a, b, rows))
+                run->workers[thread].overflow = true;
+            if(!plan->wide[i])
+                narrow_int(r, r, rows);
+            continue;
+        }
+        switch(inst->op){
+            case IRConstInt:
+                for(k = 0; k < rows; k++) ((int32_t *)r)[k] = inst->imm.ivalue;
+                break;
+            case IRConstFloat:
+                for(k = 0; k < rows; k++) ((float *)r)[k] = inst->imm.fvalue;
+                break;
+            case IRAdd:
+                if(inst->type == Int) ops->add_int(r, a, b, rows); else ops->add_float(r, a, b, rows);
+                break;
+            case IRSub:
+                if(inst->type == Int) ops->sub_int(r, a, b, rows); else ops->sub_float(r, a, b, rows);
+                break;
+            case IRMul:
+                if(inst->type == Int) ops->mul_int(r, a, b, rows); else ops->mul_float(r, a, b, rows);
+                break;
+            case IRDiv:
+                if(inst->type == Int) ops->div_int(r, a, b, rows); else ops->div_float(r, a, b, rows);
+                break;
+            default:
+                convert(ops, Float, r, a, wideA, rows);
+                break;
+        }
+    }
+}
+
+/* this thread's share of the block, all threads wait for each other after every segment */
+void evaluateSegments( Evaluation *run, int thread )
+{
+    EvalPlan *plan = run->plan;
+    EvalSegment *seg;
+    int *parts, s;
+
+    if(plan->threads == 1){
+        evaluateRange(run, 0, plan->orderCount, 0);
+        return;
+    }
+    for(s = 0; s < plan->segmentCount; s++){
+        seg = &plan->segments[s];
+        parts = plan->parts + s * (plan->threads + 1);
+        if(seg->parallel)
+            evaluateRange(run, parts[thread], parts[thread + 1], thread);
+        else if(thread == 0)
+            evaluateRange(run, seg->start, seg->end, 0);
+        pthread_barrier_wait(&run->barrier);
+    }
+}
+
+/* the other threads start a block when the first one has read it */
+void *evaluationWorker( void *arg )
+{
+    EvalThread *self = arg;
+    Evaluation *run = self->run;
+
+    for(;;){
+        pthread_barrier_wait(&run->barrier);
+        if(run->rows == 0)
+            return NULL;
+        evaluateSegments(run, self->index);
+    }
+}
+
+/* the digits of value ending at end, printf is most of the time of a run */
+static char *format_int( int64_t value, char *end )
+{
+    uint64_t u = value < 0 ? 0ull - (uint64_t)value : (uint64_t)value;
+
+    do{
+        *--end = '0' + u % 10;
+        u /= 10;
+    }while(u != 0);
+    if(value < 0)
+        *--end = '-';
+    return end;
+}
+
+/* one csv line per row, the values in the order of the p statements */
+void writeRows( Evaluation *run, FILE *target )
+{
+    EvalPlan *plan = run->plan;
+    void **columns = reallocateHeap(NULL, (plan->printCount + 1) * sizeof(void *));
+    char *line = reallocateHeap(NULL, plan->printCount * 24 + 1), *p, digits[21], *d;
+    int i, k;
+
+    for(i = 0; i < plan->printCount; i++)
+        columns[i] = locate(run, plan->location[plan->prints[i]]);
+    for(k = 0; k < run->rows; k++){
+        p = line;
+        for(i = 0; i < plan->printCount; i++){
+            if(i > 0)
+                *p++ = ',';
+            if(run->ir->insts[plan->prints[i]].type == Int){
+                if(plan->wide[plan->prints[i]])
+                    d = format_int(((int64_t *)columns[i])[k], digits + sizeof(digits));
+                else
+                    d = format_int(((int32_t *)columns[i])[k], digits + sizeof(digits));
+                memcpy(p, d, digits + sizeof(digits) - d);
+                p += digits + sizeof(digits) - d;
+            }
+            else
+                p += sprintf(p, "%.7g", ((float *)columns[i])[k]);
+        }
+        *p++ = '\n';
+        fwrite(line, 1, p - line, target);
+    }
+    releaseHeap(columns);
+    releaseHeap(line);
+}
+
+/*
+   A block where an int did not fit in 64 bits, again a row at a time and
+   an instruction after the other, ints as Numbers and floats as before.
+*/
+static const Number *exactInt( IRProgram *ir, Number *ints, float *floats, int x, Number *spare )
+{
+    int32_t value;
+
+    if(ir->insts[x].type == Int)
+        return &ints[x];
+    float_to_int_scalar(&value, &floats[x], 1);
+    number_from_int(spare, value);
+    return spare;
+}
+
+static float exactFloat( IRProgram *ir, Number *ints, float *floats, int x )
+{
+    char digits[32], *text = digits;
+    size_t length;
+    float value;
+
+    if(ir->insts[x].type == Float)
+        return floats[x];
+    length = number_text(&ints[x], digits, sizeof(digits));
+    if(length >= sizeof(digits)){
+        text = reallocateHeap(NULL, length + 1);
+        number_text(&ints[x], text, length + 1);
+    }
+    if(text[0] == '_')
+        text[0] = '-';
+    value = strtof(text, NULL);
+    if(text != digits)
+        releaseHeap(text);
+    return value;
+}
+
+void writeRowsExact( Evaluation *run, FILE *target )
+{
+    IRProgram *ir = run->ir;
+    Number *ints = reallocateHeap(NULL, (ir->count + 1) * sizeof(Number));
+    Number *vars = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(Number));
+    float *floats = reallocateHeap(NULL, (ir->count + 1) * sizeof(float));
+    float *varFloats = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(float));
+    bool *stored = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(bool));
+    size_t textSize = 32, length;
+    char *text = reallocateHeap(NULL, textSize);
+    const Number *a, *b;
+    Number spare[2];
+    IRInst *inst;
+    void *column;
+    int i, k, printed;
+    float x, y;
+
+    for(i = 0; i < ir->count; i++)
+        InitializeNumber(&ints[i]);
+    for(i = 0; i < ir->symCount; i++)
+        InitializeNumber(&vars[i]);
+    InitializeNumber(&spare[0]);
+    InitializeNumber(&spare[1]);
+
+    for(k = 0; k < run->rows; k++){
+        memset(stored, 0, ir->symCount * sizeof(bool));
+        printed = 0;
+        for(i = 0; i < ir->count; i++){
+            inst = &ir->insts[i];
+            switch(inst->op){
+                case IRConstInt:
+                    number_from_int(&ints[i], inst->imm.ivalue);
+                    break;
+                case IRConstFloat:
+                    floats[i] = inst->imm.fvalue;
+                    break;
+                case IRLoad:
+                    if(stored[inst->sym] && inst->type == Int)
+                        number_copy(&ints[i], &vars[inst->sym]);
+                    else if(stored[inst->sym])
+                        floats[i] = varFloats[inst->sym];
+                    else{/* the column, or the zeros of an unbound variable */
+                        column = locate(run, run->plan->location[i]);
+                        if(inst->type == Int)
+                            number_from_int(&ints[i], ((int32_t *)column)[k]);
+                        else
+                            floats[i] = ((float *)column)[k];
+                    }
+                    break;
+                case IRAdd:
+                case IRSub:
+                case IRMul:
+                case IRDiv:
+                    if(inst->type == Int){
+                        a = exactInt(ir, ints, floats, inst->a, &spare[0]);
+                        b = exactInt(ir, ints, floats, inst->b, &spare[1]);
+                        if(inst->op == IRAdd)
+                            number_add(&ints[i], a, b);
+                        else if(inst->op == IRSub)
+                            number_sub(&ints[i], a, b);
+                        else if(inst->op == IRMul)
+                            number_mul(&ints[i], a, b, run->plan->at5k[i] ? 5 : 0);
+                        else if(!number_div(&ints[i], a, b, run->plan->at5k[i] ? 5 : 0))
+                            number_from_int(&ints[i], 0);
+                        break;
+                    }
+                    x = exactFloat(ir, ints, floats, inst->a);
+                    y = exactFloat(ir, ints, floats, inst->b);
+                    floats[i] = inst->op == IRAdd ? x + y : inst->op == IRSub ? x - y : inst->op == IRMul ? x * y : x / y;
+                    break;
+                case IRIntToFloat:
+                    floats[i] = exactFloat(ir, ints, floats, inst->a);
+                    break;
+                case IRStore:
+                    if(inst->type == Int)
+                        number_copy(&vars[inst->sym], exactInt(ir, ints, floats, inst->a, &spare[0]));
+                    else
+                        varFloats[inst->sym] = exactFloat(ir, ints, floats, inst->a);
+                    stored[inst->sym] = true;
+                    break;
+                case IRPrint:
+                    if(printed++ > 0)
+                        fputc(',', target);
+                    if(inst->type == Float){
+                        fprintf(target, "%.7g", exactFloat(ir, ints, floats, inst->a));
+                        break;
+                    }
+                    a = exactInt(ir, ints, floats, inst->a, &spare[0]);
+                    if((length = number_text(a, text, textSize)) >= textSize){
+                        textSize = length + 1;
+                        text = reallocateHeap(text, textSize);
+                        number_text(a, text, textSize);
+                    }
+                    if(text[0] == '_')
+                        text[0] = '-';
+                    fputs(text, target);
+                    break;
+                default:
+                    break;
+            }
+        }
+        if(printed > 0)
+            fputc('\n', target);
+    }
+
+    for(i = 0; i < ir->count; i++)
+        FreeNumber(&ints[i]);
+    for(i = 0; i < ir->symCount; i++)
+        FreeNumber(&vars[i]);
+    FreeNumber(&spare[0]);
+    FreeNumber(&spare[1]);
+    releaseHeap(ints);
+    releaseHeap(vars);
+    releaseHeap(floats);
+    releaseHeap(varFloats);
+    releaseHeap(stored);
+    releaseHeap(text);
+}
+
+/* returns the exit status like compile, 1 for an error in the program and 2 for one in the input */
+int evaluate( Context *ctx, const char *source_file, const char *target_file, Options *opt )
+{
+    FILE *source, *target;
+    Program program;
+    HashMap *symmap;
+    IRProgram looped, ir;
+    EvalPlan plan;
+    EvalInput in;
+    Evaluation run;
+    Image image;
+    Context *previous;
+    char *text, *spec;
+    size_t len;
+    int rows, i, n, status, *origin;
+    bool fromImage = isImage(source_file), unrolled, *at5k;
+
+    if(fromImage){/* checked and optimized already */
+        if(!loadImage(source_file, &image)){
+            fprintf(ctx->diag, "%s is not an image of this compiler\n", source_file);
+            return 2;
+        }
+        looped = image.ir;
+    }
+    else{
+        if( (source = fopen(source_file, "r")) == NULL ){
+            fprintf(ctx->diag, "can't open the source file\n");
+            return 2;
+        }
+        text = read_source(source, &len);
+        fclose(source);
+
+        previous = enterContext(ctx);
+        if(setjmp(ctx->fail)){
+            enterContext(previous);
+            free(text);
+            return 1;
+        }
+        program = parseText(text, len, 1);
+        symmap = mybuild(program);
+        bind_map(symmap, opt);
+        mycheck(&program, symmap);
+        InitializeIR(&looped);
+        lower_program(&looped, &program);
+        FreeMap(symmap);
+        FreeProgram(&program);
+        run_passes(&looped, opt->optimize);
+        enterContext(previous);
+        free(text);
+    }
+
+    /* the precision every instruction runs at in the dc code, then the loops written out */
+    at5k = allocateHeap((looped.count + 1) * sizeof(bool));
+    ir_precisions(&looped, at5k);
+    InitializeIR(&ir);
+    unrolled = ir_unroll(&looped, &ir, &origin, MaxEvalInstructions);
+    if(fromImage)
+        FreeImage(&image);
+    else
+        FreeIR(&looped);
+    if(!unrolled){
+        fprintf(ctx->diag, "error : loops too long to evaluate\n");
+        releaseHeap(at5k);
+        releaseHeap(origin);
+        FreeIR(&ir);
+        return 1;
+    }
+    plan.at5k = reallocateHeap(NULL, (ir.count + 1) * sizeof(bool));
+    for(i = 0; i < ir.count; i++)
+        plan.at5k[i] = at5k[origin[i]];
+    plan.fractions = !promoteFractions(&ir, plan.at5k);
+    releaseHeap(at5k);
+    releaseHeap(origin);
+
+    /* every p statement names the variable it prints */
+    plan.names = reallocateHeap(NULL, (ir.count + 1) * sizeof(char *));
+    for(i = 0, n = 0; i < ir.count; i++)
+        if(ir.insts[i].op == IRPrint)
+            plan.names[n++] = ir.syms[ir.insts[i].sym].name;
+
+    spec = strdup(opt->eval);
+    if( !(strchr(spec, '=') != NULL ? openColumns(ctx, &ir, spec, &in) : openCsv(ctx, &ir, spec, &in)) ){
+        free(spec);
+        FreeInput(&in);
+        releaseHeap(plan.names);
+        releaseHeap(plan.at5k);
+        FreeIR(&ir);
+        return 2;
+    }
+    free(spec);
+    if( (target = fopen(target_file, "w")) == NULL ){
+        fprintf(ctx->diag, "can't open the target file\n");
+        FreeInput(&in);
+        releaseHeap(plan.names);
+        releaseHeap(plan.at5k);
+        FreeIR(&ir);
+        return 2;
+    }
+
+    planEvaluation(&ir, &plan, &in, opt->jobs);
+    run.ops = select_eval_ops();
+    run.ir = &ir;
+    run.plan = &plan;
+    run.in = &in;
+    run.slots = reallocateHeap(NULL, (plan.slotCount + 1) * sizeof(void *));
+    for(i = 0; i < plan.slotCount; i++)
+        run.slots[i] = aligned_alloc(32, plan.blockRows * sizeof(int64_t));
+    run.zeros = aligned_alloc(32, plan.blockRows * sizeof(int32_t));
+    memset(run.zeros, 0, plan.blockRows * sizeof(int32_t));
+    status = 0;
+    run.first = 0;
+    run.rows = 0;
+    run.workers = allocateHeap(plan.threads * sizeof(EvalThread));
+    if(plan.threads > 1){
+        pthread_barrier_init(&run.barrier, NULL, plan.threads);
+        for(i = 1; i < plan.threads; i++){
+            run.workers[i].run = &run;
+            run.workers[i].index = i;
+            pthread_create(&run.workers[i].tid, NULL, evaluationWorker, &run.workers[i]);
+        }
+    }
+
+    for(i = 0; i < plan.printCount; i++)
+        fprintf(target, i > 0 ? ",%s" : "%s", plan.names[i]);
+    if(plan.printCount > 0)
+        fputc('\n', target);
+    while((rows = readBlock(ctx, &ir, &in, run.first, plan.blockRows)) > 0){
+        run.rows = rows;
+        if(plan.fractions){/* ints with digits after the point are only kept exactly */
+            if(plan.printCount > 0)
+                writeRowsExact(&run, target);
+            run.first += rows;
+            continue;
+        }
+        if(plan.threads > 1)
+            pthread_barrier_wait(&run.barrier);
+        evaluateSegments(&run, 0);
+        for(i = 0; i < plan.threads && !run.workers[i].overflow; i++);
+        if(i < plan.threads){
+            for(i = 0; i < plan.threads; i++)
+                run.workers[i].overflow = false;
+            if(plan.printCount > 0)
+                writeRowsExact(&run, target);
+        }
+        else if(plan.printCount > 0)
+            writeRows(&run, target);
+        run.first += rows;
+    }
+    if(rows < 0){
+        status = 2;
+        fflush(target);
+        ftruncate(fileno(target), 0);
+    }
+
+    if(plan.threads > 1){
+        run.rows = 0;
+        pthread_barrier_wait(&run.barrier);
+        for(i = 1; i < plan.threads; i++)
+            pthread_join(run.workers[i].tid, NULL);
+        pthread_barrier_destroy(&run.barrier);
+    }
+    fclose(target);
+    for(i = 0; i < plan.slotCount; i++)
+        free(run.slots[i]);
+    releaseHeap(run.slots);
+    free(run.zeros);
+    releaseHeap(run.workers);
+    FreePlan(&plan);
+    FreeInput(&in);
+    FreeIR(&ir);
+    return status;
+}
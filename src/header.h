@@ -1,23 +1,33 @@
 #ifndef HEADER_H_INCLUDED
 #define HEADER_H_INCLUDED
 
+#include <setjmp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
 /******************************************************************************************************************************************
     All enumeration literals
        TokenType : Specify the type of the token scanner returns
+	   CharClass : The class of one source byte, the scanner looks it up in a 256-entry table
 	   DataType  : The data type of the declared variable
-	   StmtType  : Indicate one statement in AcDc program is print or assignment statement.
+	   StmtType  : Indicate one statement in AcDc program is print or assignment statement, or where a repeat loop starts or ends.
 	   ValueType : The node types of the expression tree that represents the expression on the right hand side of the assignment statement.
 	               Identifier, IntConst, FloatConst must be the leaf nodes ex: a, b, c , 1.5 , 3.
-				   PlusNode, MinusNode, MulNode, DivNode are the operations in AcDc. They must be the internal nodes.
+				   PlusNode, MinusNode, MulNode, DivNode are the operations in AcDc. They must be the internal nodes.
                    Note that IntToFloatConvertNode to represent the type coercion may appear after finishing type checking. 			  
+                   SumNode and ProductNode hold a whole chain a + b - c or a * b * c as one array of operands.
 	   Operation : Specify all arithematic expression, including +, - , *, / and type coercion.
 *******************************************************************************************************************************************/
 
 typedef enum TokenType { FloatDeclaration, IntegerDeclaration, PrintOp, AssignmentOp, PlusOp, MinusOp,
-             MulOp, DivOp, Alphabet, IntValue, FloatValue, EOFsymbol } TokenType;
+             MulOp, DivOp, Alphabet, IntValue, FloatValue, LeftParen, RightParen, Repeat, LeftBrace, RightBrace,
+             EOFsymbol } TokenType;
+typedef enum CharClass { CharInvalid, CharSpace, CharDigit, CharLower, CharOperator } CharClass;
 typedef enum DataType { Int, Float, Notype }DataType;
-typedef enum StmtType { Print, Assignment } StmtType;
-typedef enum ValueType { Identifier, IntConst, FloatConst, PlusNode, MinusNode, MulNode, DivNode, IntToFloatConvertNode }ValueType;
+typedef enum StmtType { Print, Assignment, RepeatStart, RepeatEnd } StmtType;
+typedef enum ValueType { Identifier, IntConst, FloatConst, PlusNode, MinusNode, MulNode, DivNode, IntToFloatConvertNode,
+             SumNode, ProductNode }ValueType;
 typedef enum Operation { Plus, Minus, Mul, Div, Assign, IntToFloatConvert } Operation;
 
 //EDITED3
@@ -30,12 +40,92 @@ typedef enum{ false, true }bool;//won't conflict with C99?!
 *****************************************************************************************/
 
 
-/* For scanner */
+/* For scanner: a token is a slice of the source text, which outlives all of its tokens */
 typedef struct Token{
+    const char *start;  /* the text of the token, not terminated */
     TokenType type;
-    char tok[1025];
+    int length;
+    int ivalue;         /* value of IntValue, accumulated while scanning */
+    float fvalue;       /* value of FloatValue */
 }Token;
 
+/* For scanner: routines that find the end of a run of one class, chosen by cpu at start up */
+typedef struct ScanOps{
+    const char *name;
+    const char *(*skip_space)( const char *p, const char *end );
+    const char *(*span_lower)( const char *p, const char *end );
+    const char *(*span_digit)( const char *p, const char *end );
+}ScanOps;
+
+/* For columnar evaluation, see eval.c: arithmetic on n rows of a column at once, chosen by cpu at start up */
+typedef struct EvalOps{
+    const char *name;
+    void (*add_int)( int32_t *r, const int32_t *a, const int32_t *b, int n );
+    void (*sub_int)( int32_t *r, const int32_t *a, const int32_t *b, int n );
+    void (*mul_int)( int32_t *r, const int32_t *a, const int32_t *b, int n );
+    void (*div_int)( int32_t *r, const int32_t *a, const int32_t *b, int n );
+    void (*add_float)( float *r, const float *a, const float *b, int n );
+    void (*sub_float)( float *r, const float *a, const float *b, int n );
+    void (*mul_float)( float *r, const float *a, const float *b, int n );
+    void (*div_float)( float *r, const float *a, const float *b, int n );
+    void (*int_to_float)( float *r, const int32_t *a, int n );
+    void (*float_to_int)( int32_t *r, const float *a, int n );
+}EvalOps;
+
+/* For the pipeline: a lock-free ring between exactly one producer thread and one consumer thread */
+typedef struct Ring{
+    char *slots;
+    size_t slotSize;
+    unsigned long capacity;         /* a power of two */
+    _Atomic unsigned long head;     /* next slot the consumer reads */
+    _Atomic unsigned long tail;     /* next slot the producer fills */
+    _Atomic bool closed;            /* the consumer stopped, the producer should too */
+}Ring;
+
+/* For the pipeline: one token in a batch, its text found by offset in the source both threads share */
+typedef struct TokenSlice{
+    uint32_t offset;        /* from the base of the batch */
+    uint32_t length;
+    TokenType type;
+    union{
+        int ivalue;
+        float fvalue;
+    }value;
+}TokenSlice;
+
+/* For the pipeline: tokens travel from the scanner thread to the parser thread in batches */
+#define TokenBatchSize 64
+typedef struct TokenBatch{
+    int count;
+    bool last;              /* the EOFsymbol is in this batch */
+    char *error;            /* the scanner failed after the tokens of this batch, with this message */
+    const char *base;       /* where the first token starts */
+    TokenSlice tokens[TokenBatchSize];
+}TokenBatch;
+
+/* For scanner and parser: the source held in memory, plus one token of look-ahead
+   so no token is ever pushed back and scanned again */
+typedef struct Lexer{
+    const char *cur;
+    const char *end;
+    const ScanOps *ops;
+    Token peek;
+    bool hasPeek;
+    Ring *ring;             /* if set, tokens come from a scanner thread instead */
+    TokenBatch *batch;
+    int next;
+    int depth;              /* repeat loops the parser is inside of */
+    long tokens;            /* scanned so far, for --stats */
+}Lexer;
+
+/* For parser: how a binary operator token binds and which node it builds */
+typedef struct OperatorInfo{
+    int precedence;     /* 0 if the token is not a binary operator */
+    ValueType node;
+    Operation op;
+    ValueType chain;    /* n-ary node the operator extends, or node itself if it is not associative */
+}OperatorInfo;
+
 /*** The following are nodes of the AST. ***/
 
 /* For decl production or say one declaration statement */
@@ -48,12 +138,13 @@ typedef struct Declaration{
 /* 
     For decls production or say all declarations. (
 	You can view it as the subtree for decls in AST,
-	or just view it as the linked list that stores 
-	all declarations. ) 
+	or just view it as the array that stores 
+	all declarations in source order. ) 
 */
 typedef struct Declarations{
-    Declaration first;
-    struct Declarations *rest;
+    Declaration *items;
+    int count;
+    int capacity;
 }Declarations;
 
 /* For the nodes of the expression on the right hand side of one assignment statement */
@@ -66,12 +157,13 @@ typedef struct Value{
         int ivalue;                /* for integer constant in the expression */
         float fvalue;              /* for float constant */
     }val;
+    int scale;                     /* FloatConst: digits dc gets after the point, 1 for a constant of the source */
 }Value;
 
 
 /* 
-   The data structure of the expression tree.
-   Recall how to deal with expression by tree 
+   The data structure of the expression tree.
+   Recall how to deal with expression by tree 
    in data structure course.   
 */
 typedef struct Expression{
@@ -79,40 +171,64 @@ typedef struct Expression{
     struct Expression *leftOperand;
     struct Expression *rightOperand;
     DataType type;
+    struct Operand *operands;   /* SumNode, ProductNode: every term of the chain in evaluation order */
+    int count;
+    int capacity;
 }Expression;
 
-
-/* For one assignment statement */
-typedef struct AssignmentStatement{
-//    char id;
-    char id[65];//EDITED2
+/* One term of a SumNode or ProductNode */
+typedef struct Operand{
     Expression *expr;
-    DataType type;      /* For type checking to store the type of all expression on the right. */
-}AssignmentStatement;
-
+    bool negate;                /* SumNode: the term is subtracted */
+}Operand;
 
-/* For stmt production or say one statement*/
-typedef struct Statement{
-    StmtType type;
-    union{
-//        char variable;              /* print statement */
-        char variable[65];             //EDITED2
-        AssignmentStatement assign;
-    }stmt;
-}Statement;
 
-/* For stmts production or say all productions */
+/* 
+    For stmts production or say all statements.
+    One column per field, statement i is kind[i], target[i], expr[i] and type[i],
+    so every pass walks plain arrays in program order.
+    A repeat loop is a RepeatStart, its body and a RepeatEnd.
+*/
 typedef struct Statements{
-    struct Statement first;
-    struct Statements *rest;
+    StmtType *kind;
+    char (*target)[65];     /* the assigned variable, the variable of a print statement, or the counter and macro registers of a loop */
+    Expression **expr;      /* right hand side of an assignment, the IntConst count of a RepeatStart, NULL otherwise */
+    DataType *type;         /* For type checking to store the type of the assigned variable. */
+    int count;
+    int capacity;
 }Statements;
 
+/* For --stats and --trace-alloc: what the work of one thread is counted in, see useCounting and joinPhase */
+typedef struct Counting{
+    struct Stats *stats;
+    struct Trace *trace;
+    int phase;              /* of the thread, -1 between phases */
+}Counting;
+
+/* For the parallel front-end: one byte range of the statement section, parsed on its own thread */
+typedef struct Chunk{
+    const char *begin;
+    const char *end;
+    Statements statements;
+    bool failed;
+    Counting counting;      /* of the thread that parses the declarations */
+}Chunk;
+
 /* For the root of the AST. */
 typedef struct Program{
-    Declarations *declarations;
-    Statements *statements;
+    Declarations declarations;
+    Statements statements;
 }Program;
 
+/* For the pipeline: one checked statement on its way to the emitter */
+typedef struct StatementRecord{
+    StmtType kind;
+    char target[65];
+    Expression *expr;
+    DataType type;
+    bool last;              /* no statement follows */
+}StatementRecord;
+
 /* For building the symbol table */
 typedef struct SymbolTable{
     DataType table[26];
@@ -123,6 +239,8 @@ typedef struct{
 //	char *key;//BUG!! Also need to allocate space for it in InitializeMap step!!!
 	char key[65];//BUG!! Also need to allocate space for it!!!
 	DataType type;//value
+	bool bound;             /* a -D binding gave it a value */
+	Value value;            /* the constant of the binding, IntConst or FloatConst like the type */
 }HashNode;
 
 typedef struct{
@@ -130,26 +248,471 @@ typedef struct{
 	HashNode* *storage;
 }HashMap;
 
+/* For macro factoring: every distinct dc instruction line gets an id */
+typedef struct{
+    char **text;
+    int *length;
+    bool *barrier;      /* lines with [ or ] are never moved into a macro */
+    int count;
+    int capacity;
+    int *slots;         /* open addressing over ids, -1 if empty */
+    int slotCount;
+}InstrTable;
+
+typedef struct{
+    char reg;           /* dc register holding the macro */
+    int *body;
+    int length;
+}Macro;
+
+/*
+   For repeat loops: a loop nested depth deep counts its iterations in one
+   dc register and keeps its body as a macro in another, taken from the
+   top of A-Z so they never meet the registers of the IR emitter.
+*/
+#define MaxLoopDepth 4
+#define LoopCounter(depth) ('Y' - 2 * (depth))
+#define LoopMacro(depth) ('Z' - 2 * (depth))
+
+/*** Three-address SSA code, see ir.c ***/
+
+typedef enum IROp { IRNop, IRConstInt, IRConstFloat, IRLoad, IRAdd, IRSub, IRMul, IRDiv, IRIntToFloat,
+             IRStore, IRPrint, IRLoop, IRPhi, IREndLoop } IROp;
+
+/* One instruction, the value it defines is named by its index */
+typedef struct IRInst{
+    IROp op;
+    DataType type;
+    int a, b;               /* operands, indices of earlier instructions or -1 */
+    int sym;                /* IRLoad, IRStore, IRPhi: the variable, IRPrint: the variable printed */
+    int version;            /* IRLoad: version read, IRStore, IRPhi: version defined, IRLoop, IREndLoop: nesting depth */
+    union{
+        int ivalue;         /* also the count of an IRLoop */
+        float fvalue;
+    }imm;
+    int scale;              /* IRConstFloat: digits printed after the point */
+    bool setsPrecision;     /* printing the value runs 5k, dc keeps that precision until 0 k */
+}IRInst;
+
+typedef struct IRSymbol{
+    char name[65];
+    DataType type;
+    int version;            /* last version defined while lowering */
+}IRSymbol;
+
+typedef struct IRProgram{
+    IRInst *insts;
+    int count;
+    int capacity;
+    IRSymbol *syms;
+    int symCount;
+    int symCapacity;
+    int *symSlots;          /* open addressing over syms by name, -1 if empty */
+    int symSlotCount;
+}IRProgram;
+
+/* For value ranges, see ir_ranges: the ints an instruction may compute, lo to hi when bounded */
+typedef struct IRRange{
+    int64_t lo, hi;
+    bool bounded;           /* false when it may not fit in 64 bits, or is no int */
+}IRRange;
+
+/* For program images, see image.c: the IR of a program, mapped from a file and used in place */
+#define ImageMagic "AcDcIMG1"
+
+typedef struct ImageHeader{
+    char magic[8];
+    uint32_t byteOrder;     /* 0x01020304 in the byte order of the writer */
+    uint32_t instSize;      /* sizeof(IRInst) of the writer */
+    uint32_t symSize;       /* sizeof(IRSymbol) of the writer */
+    uint32_t level;         /* the -O level the program was optimized at */
+    uint32_t symCount;
+    uint32_t instCount;
+    uint32_t stmtCount;     /* the IRStore, IRPrint, IRLoop and IREndLoop instructions, in order */
+    uint32_t unused;
+    uint64_t symOffset;     /* from the start of the file */
+    uint64_t instOffset;
+    uint64_t stmtOffset;
+    uint64_t size;          /* of the whole file */
+}ImageHeader;
+
+typedef struct Image{
+    void *base;
+    size_t size;
+    IRProgram ir;           /* insts and syms point into the mapping */
+    const int *stmts;
+    int stmtCount;
+    int level;
+}Image;
+
+/* For columnar evaluation: one input column bound to a declared variable */
+typedef struct EvalColumn{
+    int sym;                /* the variable, an index into the IR symbols */
+    void *base;             /* a binary column: the mapped file, NULL for csv */
+    size_t size;
+    void *rows;             /* csv: the rows of the current block */
+}EvalColumn;
+
+typedef struct EvalInput{
+    EvalColumn *columns;
+    int count;
+    long rows;              /* binary: rows in every file */
+    FILE *csv;              /* NULL for binary columns */
+    int *fields;            /* csv: the column of each field of a line, -1 for fields that are no variable */
+    int fieldCount;
+    long line;              /* csv: of the last line read, for messages */
+    char *text;             /* csv: that line */
+    size_t textSize;
+}EvalInput;
 
-Token getNumericToken( FILE *source, char c );
-Token getStringToken( FILE *source, char c );//EDITED2
-Token scanner( FILE *source );
+/* For columnar evaluation with threads: a run of the instruction order, a level of the statement DAG or several narrow ones */
+typedef struct EvalSegment{
+    int start, end;         /* positions in the order */
+    bool parallel;          /* the threads split it at statement boundaries, otherwise the first thread runs it alone */
+}EvalSegment;
+
+/*
+   For columnar evaluation: in which order the instructions run and where
+   every value is kept. A location is a slot, a buffer of one block of
+   rows, if it is 0 or more, the column of zeros if it is -1 and input
+   column k if it is -2-k.
+*/
+typedef struct EvalPlan{
+    int *location;          /* of the value of each instruction */
+    int slotCount;
+    int scratch;            /* the first of two slots per thread for operands converted on the way in */
+    int *order;             /* the instructions that compute, segment by segment */
+    int orderCount;
+    EvalSegment *segments;
+    int segmentCount;
+    int threads;
+    int *parts;             /* parallel segment s: thread t runs parts[s * (threads + 1) + t] up to the next part */
+    int *prints;            /* the IRPrint instructions in order */
+    char **names;           /* and the variables they print */
+    int printCount;
+    int blockRows;
+    bool *wide;             /* of each instruction: an int kept in 64 bits, its range does not fit in 32 */
+    bool *at5k;             /* of each instruction: run by dc after a 5k, see ir_precisions */
+    bool fractions;         /* an int division runs at 5k and promoteFractions left it, it needs the exact evaluation */
+}EvalPlan;
+
+typedef struct EvalThread{
+    struct Evaluation *run;
+    int index;
+    pthread_t tid;
+    bool overflow;          /* an int did not fit in 64 bits in this thread's share of the block, which is evaluated again */
+}EvalThread;
+
+/* For columnar evaluation: one run, the threads evaluate each block together */
+typedef struct Evaluation{
+    const EvalOps *ops;
+    IRProgram *ir;
+    EvalPlan *plan;
+    EvalInput *in;
+    void **slots;
+    void *zeros;
+    long first;             /* the block: its first row and how many rows, 0 rows stops the threads */
+    int rows;
+    EvalThread *workers;    /* one per thread, the first thread is the caller */
+    pthread_barrier_t barrier;
+}Evaluation;
+
+/* A pass returns true if it changed the program */
+typedef struct IRPass{
+    const char *name;
+    int level;              /* lowest -O level that runs the pass */
+    bool (*run)( IRProgram *ir );
+}IRPass;
+
+/* For the parallel back-end: one task, statements from begin to the next task, and where its output sits in its worker's streams */
+typedef struct Segment{
+    int begin;
+    int worker;
+    long diagOffset, diagLength;
+    long codeOffset, codeLength;
+}Segment;
+
+/* One back-end thread: the statements [lo, hi) it has not started yet, another thread may steal the back half */
+typedef struct Worker{
+    int id;
+    int lo, hi;
+    pthread_mutex_t lock;
+    FILE *diag, *code;
+    char *diagText, *codeText;
+    size_t diagLength, codeLength;
+    Segment *segments;
+    int count;
+    int capacity;
+    struct Backend *backend;
+}Worker;
+
+typedef struct Backend{
+    Program *program;
+    HashMap *map;
+    Worker *workers;
+    int count;
+    Counting counting;      /* of the thread that waits for the workers */
+}Backend;
+
+/* For the pipeline: scanner thread -> tokens -> parser and checker thread -> statements -> emitter */
+typedef struct Pipeline{
+    const char *text;
+    size_t len;
+    Ring tokens;
+    Ring statements;
+    Program program;        /* declarations, and at -O2 the statements collected by the emitter */
+    Statements one;         /* the statement being parsed */
+    HashMap *map;
+    struct Options *opt;    /* for the bindings of the checker */
+    FILE *log;              /* diagnostics of the checker */
+    char *logText;
+    size_t logLength;
+    long errorOffset;       /* where the message of a failure starts in the log */
+    bool failed;
+    Counting counting;      /* of the emitter thread */
+}Pipeline;
+
+/* For the compilation cache, see cache.c; a rebuilt compiler never reuses fragments of an older one */
+#define AcDcVersion "AcDc 2 " __DATE__ " " __TIME__
+
+typedef struct Cache{
+    char *dir;
+    long limit;             /* bytes */
+    _Atomic bool stored;    /* a fragment was added since the last eviction */
+    _Atomic long total;     /* bytes of all fragments after the last store, -1 if not known */
+}Cache;
+
+typedef struct CacheEntry{
+    char *path;
+    long size;
+    long long mtime;        /* ns, the time the fragment was last used */
+}CacheEntry;
+
+/* For the compile server, see server.c: the tree and the symbol table of one request live in its arena */
+typedef struct ArenaBlock{
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    _Alignas(16) char data[];
+}ArenaBlock;
+
+typedef struct Arena{
+    ArenaBlock *blocks;     /* the newest first */
+}Arena;
+
+/* For --trace-alloc, see trace.c: the bytes of the arena layer and of the IR, by the function that allocated them */
+#define MaxTraceSites 128
+
+typedef struct TraceHeader{         /* in front of every traced block */
+    size_t size;
+    int site;
+    int phase;                      /* the phase it was allocated in, -1 outside of them */
+}TraceHeader;
+
+typedef struct TraceCount{
+    const char *name;               /* a function, or a phase */
+    long count;
+    long long bytes;                /* all that was ever allocated */
+    long long live;
+    long long peak;                 /* the most that was live at once */
+}TraceCount;
+
+/* For folding with the arithmetic of dc, see number.c */
+#define NumberInline 3              /* limbs kept in the Number itself, enough for any 64 bit value */
+#define AnyPrecision -1             /* fold only what dc computes the same at 0 k and at 5k */
+#define MaxFloatScale 5             /* digits after the point of a float constant: 1 in the source, at most k once folded */
+
+typedef struct Number{
+    bool negative;
+    int scale;                      /* digits after the point */
+    int length;                     /* limbs in use, 0 for zero */
+    int capacity;                   /* limbs on the heap, 0 while they are inline */
+    uint32_t *heap;
+    uint32_t limbs[NumberInline];   /* nine decimal digits each, least significant first */
+}Number;
+
+/* For --stats, see stats.c: what the compilations of one command line did, counted by all their threads at once */
+typedef enum Phase { ReadPhase, ParsePhase, BuildPhase, CheckPhase, LowerPhase, PassesPhase, EmitPhase, MacrosPhase,
+             PipelinePhase, CachedPhase, PhaseCount }Phase;
+
+typedef struct PhaseClock{
+    long long wall;                 /* ns when the phase started */
+    long long cpu;                  /* ns of cpu time the process had used then */
+    Phase phase;                    /* the one running */
+    int outer;                      /* the phase of the thread before it started, -1 if none */
+}PhaseClock;
+
+typedef struct Stats{
+    _Atomic long long wall[PhaseCount];
+    _Atomic long long cpu[PhaseCount];
+    _Atomic long tokens;
+    _Atomic long bytes;             /* of the sources read */
+    _Atomic long nodes[ProductNode + 1];
+    _Atomic long lookups;           /* of find_map, with lookup_map and bind_map */
+    _Atomic long probes;            /* slots looked at by all lookups */
+    _Atomic long longestProbe;
+    _Atomic long folds;             /* two constants made one */
+    _Atomic long conversions;       /* IntToFloatConvertNode inserted by the checker */
+    _Atomic long instructions;      /* dc numbers and commands in the target files */
+    _Atomic long emitted;           /* bytes of the target files */
+}Stats;
+
+/* For --stats: the dc code written to a target, counted as it goes through, see countingStream */
+typedef struct Emitted{
+    FILE *target;
+    long instructions;
+    long bytes;
+    int skip;               /* characters left of the instruction being counted */
+    bool number;            /* in the digits of a number */
+    bool negation;          /* after a !, which takes the comparison after it */
+}Emitted;
+
+extern __thread Stats *stats;       /* of the compilation on this thread, NULL unless --stats */
+extern const char *phaseNames[PhaseCount];
+#define countStat(field, n) do{ if(stats) atomic_fetch_add_explicit(&stats->field, (n), memory_order_relaxed); }while(0)
+
+/* For --trace-alloc: the counts of all threads, see trace.c */
+typedef struct Trace{
+    pthread_mutex_t lock;
+    TraceCount sites[MaxTraceSites];
+    TraceCount phases[PhaseCount];
+    TraceCount total;
+    int siteCount;
+}Trace;
+
+/* of the compilation on this thread, NULL unless --trace-alloc; set before its first allocation, never changed after */
+extern __thread Trace *tracing;
+
+/* For command line options */
+/* For -D name=value: a declared variable whose value is known when compiling */
+typedef struct Binding{
+    char name[65];
+    Value value;            /* IntConst or FloatConst */
+}Binding;
+
+typedef struct Options{
+    bool factor;            /* --macros */
+    int optimize;           /* -O0 prints the AST directly, -O1 folds, -O2 adds propagation, cse and dce */
+    int jobs;               /* -j N, worker threads: one per program in batch mode, otherwise they share the parsing, checking and printing of one large program, or the evaluation of its independent statements */
+    char *manifest;         /* --batch, one "source_file target_file" pair per line */
+    bool pipeline;          /* --pipeline, scan, parse and emit on three threads at once */
+    Cache *cache;           /* --cache DIR, NULL without it */
+    char *socket;           /* --serve PATH */
+    char *edits;            /* --edits FILE, edits applied to the source one by one */
+    bool image;             /* --emit=image, write the optimized IR instead of dc code */
+    char *eval;             /* --eval, data.csv or var=file,... binary columns to run the program over */
+    Binding *bindings;      /* -D name=value and --bindings FILE, in command line order */
+    int bindingCount;
+    Stats *stats;           /* --stats, what the compilations count in, NULL without it */
+    Trace *trace;           /* --trace-alloc, where their allocations are counted, NULL without it */
+}Options;
+
+/* For one compilation: diagnostics go to diag, an error jumps back to fail instead of exiting */
+typedef struct Context{
+    FILE *diag;
+    jmp_buf fail;
+}Context;
+
+/* For the compile server: one client, served on its own thread */
+typedef struct Connection{
+    int fd;
+    Options *opt;
+}Connection;
+
+/* For batch mode: one source/target pair and what compiling it printed */
+typedef struct Job{
+    char *source;
+    char *target;
+    char *log;
+    size_t logLength;
+    int status;
+    bool done;
+}Job;
+
+/* Workers take the next job in order; logs are written out in job order as they finish */
+typedef struct Batch{
+    Job *jobs;
+    int count;
+    int capacity;
+    int next;               /* first job not taken by a worker */
+    int flushed;            /* first job whose log is not written yet */
+    int status;             /* worst status of all jobs */
+    Options *opt;
+    pthread_mutex_t lock;
+}Batch;
+
+/* For incremental compilation, see edit.c: a program kept parsed, checked and printed between edits */
+typedef struct Fragment{
+    char *text;
+    size_t length;
+}Fragment;
+
+typedef struct Document{
+    char *text;
+    size_t length;
+    size_t size;
+    Options *opt;
+    Program program;
+    HashMap *map;
+    IRProgram ir;           /* the declared variables, for printing one statement */
+    Fragment build;         /* what building the symbol table printed */
+    size_t *start;          /* where the first token of each statement is */
+    Fragment *code;         /* dc code of each statement, below -O2 */
+    Fragment *log;          /* what checking each statement printed */
+    int capacity;
+    Statements fresh;       /* statements parsed again after an edit */
+    size_t *freshStart;
+    int freshCapacity;
+    Fragment whole;         /* dc code of the whole program at -O2 */
+    Fragment error;         /* the syntax error, while the text has one */
+    bool broken;
+}Document;
+
+
+void report( const char *format, ... );
+void fail( const char *format, ... ) __attribute__((noreturn));
+Context *enterContext( Context *ctx );
+int compile( Context *ctx, const char *source_file, const char *target_file, Options *opt );
+int compileText( Context *ctx, const char *text, size_t len, FILE *target, Options *opt );
+void addJob( Batch *batch, char *source, char *target );
+void readManifest( Batch *batch, char *manifest );
+void *batchWorker( void *arg );
+int runBatch( Batch *batch );
+const ScanOps *select_scan_ops( void );
+void InitializeLexer( Lexer *lex, const char *text, size_t len );
+char *read_source( FILE *source, size_t *len );
+Token getNumericToken( Lexer *lex );
+Token getStringToken( Lexer *lex );//EDITED2
+Token scanner( Lexer *lex );
+void token_name( Token token, char *name );
 Declaration makeDeclarationNode( Token declare_type, Token identifier );
-Declarations *makeDeclarationTree( Declaration decl, Declarations *decls );
-Declaration parseDeclaration( FILE *source, Token token );
-Declarations *parseDeclarations( FILE *source );
-Expression *parseValue( FILE *source );
-Expression *parseExpressionTail( FILE *source, Expression *lvalue );
-Expression *parseExpressionPlus( FILE *source, Expression *lvalue );//EDITED1
-Expression *parseExpression( FILE *source, Expression *lvalue );
-//Statement makeAssignmentNode( char id, Expression *expr_tail );
-Statement makeAssignmentNode( char *id, Expression *expr_tail );//EDITED
-//Statement makePrintNode( char id );
-Statement makePrintNode( char *id );//EDITED2
-Statements *makeStatementTree( Statement stmt, Statements *stmts );
-Statement parseStatement( FILE *source, Token token );
-Statements *parseStatements( FILE * source );
+Expression *makeExpressionNodeAt( ValueType type, const char *site );
+#define makeExpressionNode(type) makeExpressionNodeAt((type), __func__)
+void addOperand( Expression *chain, Expression *operand, bool negate );
+void addDeclaration( Declarations *decls, Declaration decl );
+Token pullToken( Lexer *lex );
+Token peekToken( Lexer *lex );
+Token nextToken( Lexer *lex );
+Declaration parseDeclaration( Lexer *lex, Token token );
+void parseDeclarations( Lexer *lex, Declarations *decls );
+Expression *parseValue( Lexer *lex );
+Expression *parseExpression( Lexer *lex, int minPrec );
+void addAssignment( Statements *stmts, char *id, Expression *expr_tail );//EDITED
+void addPrint( Statements *stmts, char *id );//EDITED2
+void addRepeatStart( Statements *stmts, char *registers, Expression *count );
+void addRepeatEnd( Statements *stmts, char *registers );
+void parseStatement( Lexer *lex, Token token, Statements *stmts );
+bool parseNextStatement( Lexer *lex, Statements *stmts );
+void parseStatements( Lexer *lex, Statements *stmts );
+const char *statementBoundary( const char *text, const char *p, const char *end );
+void *parseChunk( void *arg );
+void parseStatementsParallel( Lexer *lex, Statements *stmts, int threads );
 Program parser( FILE *source );
+Program parseText( const char *text, size_t len, int threads );
+void FreeExpression( Expression *expr );
+void FreeStatements( Statements *stmts );
+void FreeProgram( Program *program );
+void FreeMap( HashMap *map );
 void InitializeTable( SymbolTable *table );
 HashMap* InitializeMap(int size);//EDITED2
 void add_table( SymbolTable *table, char c, DataType t );
@@ -162,22 +725,152 @@ bool isConvertType( Expression * old, DataType type );//EDITED3
 DataType generalize( Expression *left, Expression *right );
 DataType lookup_table( SymbolTable *table, char c );
 DataType lookup_map( HashMap *map, char *key );//EDITED2
+HashNode *find_map( HashMap *map, char *key );
 void checkexpression( Expression * expr, SymbolTable * table );
+void fold_int_chain( Expression *expr );
+void fold_float_chain( Expression *expr );
+void mycheckchain( Expression *expr, HashMap *map );
 void mycheckexpression( Expression * expr, HashMap *map );//EDITED3
-void checkstmt( Statement *stmt, SymbolTable * table );
-void mycheckstmt( Statement *stmt, HashMap * map );//EDITED
+void mycheckstmt( Statements *stmts, int i, HashMap * map );//EDITED
 void check( Program *program, SymbolTable * table);
 void mycheck( Program *program, HashMap * map );//EDITED
 void fprint_op( FILE *target, ValueType op );
-void calculate_op( Expression *expr, bool lFlag, bool rFlag );//EDITED3
+bool fold_int( ValueType op, int x, int y, int *r );
+bool fold_number( ValueType op, DataType type, const Number *x, const Number *y, int precision, Value *result );
+bool calculate_op( Expression *expr, int precision );//EDITED3
 void fprint_expr( FILE *target, Expression *expr );
+void fprint_int( FILE *target, int value );
+void fprint_float( FILE *target, float value, int scale );
+void fprint_repeat_end( FILE *target, char counter, char macro );
+void gencodeStatement( Statements *stmts, int i, FILE *target );
 void gencode( Program prog, FILE * target );
+void *backendWorker( void *arg );
+void InitializeRing( Ring *ring, size_t slotSize, unsigned long capacity );
+void FreeRing( Ring *ring );
+void *ringProduce( Ring *ring );
+void ringPublish( Ring *ring );
+void *ringConsume( Ring *ring );
+void ringRelease( Ring *ring );
+void *scanStage( void *arg );
+void *parseStage( void *arg );
+void runPipeline( const char *text, size_t len, FILE *code, Options *opt );
+void emitStatement( IRProgram *ir, Statements *stmts, int i, FILE *code, int level );
+void backend( Program *program, HashMap *map, FILE *code, Options *opt );
+void cachedBackend( Program *program, HashMap *map, FILE *code, Options *opt );
+void parallelBackend( Program *program, HashMap *map, FILE *code, int threads );
+int intern_instr( InstrTable *table, char *text, int len );
+void factor_macros( char *code, size_t len, FILE *target );
+
+void InitializeIR( IRProgram *ir );
+void FreeIR( IRProgram *ir );
+int ir_symbol( IRProgram *ir, char *name, DataType type );
+int ir_emit( IRProgram *ir, IROp op, DataType type, int a, int b );
+int lower_expr( IRProgram *ir, Expression *expr );
+void lower_statement( IRProgram *ir, Statements *stmts, int i );
+void lower_declarations( IRProgram *ir, Declarations *decls );
+void lower_program( IRProgram *ir, Program *program );
+bool ir_unroll( IRProgram *from, IRProgram *to, int **origin, int limit );
+void ir_precisions( IRProgram *ir, bool *at5k );
+bool ir_fold( IRProgram *ir );
+bool ir_propagate( IRProgram *ir );
+bool ir_cse( IRProgram *ir );
+bool ir_dce( IRProgram *ir );
+bool ir_strength( IRProgram *ir );
+bool ir_licm( IRProgram *ir );
+void run_passes( IRProgram *ir, int level );
+bool ir_fits32( IRRange range );
+void ir_ranges( IRProgram *ir, const IRRange *inputs, IRRange *range );
+void ir_gencode( IRProgram *ir, FILE *target );
+
+void InitializeCache( Cache *cache, char *dir, long limit );
+void cache_hash( const char *key, size_t len, char hex[33] );
+void serialize_expression( FILE *key, Expression *expr );
+void cache_declarations( Declarations *decls, Options *opt, char hex[33] );
+void cache_key_header( FILE *key, const char *declarations, int level );
+void cache_statement_key( FILE *key, Statements *stmts, int i );
+bool cache_load( Cache *cache, const char *key, size_t keyLength,
+        char **diag, size_t *diagLength, char **code, size_t *codeLength );
+void cache_store( Cache *cache, const char *key, size_t keyLength,
+        const char *diag, size_t diagLength, const char *code, size_t codeLength );
+void cache_evict( Cache *cache );
+void InitializeArena( Arena *a );
+void FreeArena( Arena *a );
+void useArena( Arena *a );
+void *allocateAt( size_t size, const char *site );
+void *reallocateAt( void *p, size_t size, const char *site );
+void release( void *p );
+void *allocateHeapAt( size_t size, const char *site );
+void *reallocateHeapAt( void *p, size_t size, const char *site );
+void releaseHeap( void *p );
+#define allocate(size) allocateAt((size), __func__)
+#define reallocate(p, size) reallocateAt((p), (size), __func__)
+#define allocateHeap(size) allocateHeapAt((size), __func__)
+#define reallocateHeap(p, size) reallocateHeapAt((p), (size), __func__)
+bool parseRequest( char *header, size_t *len, Options *opt );
+void *serveConnection( void *arg );
+int serve( Options *opt );
+int InitializeDocument( Document *doc, const char *text, size_t len, Options *opt );
+int editDocument( Document *doc, size_t from, size_t to, const char *text, size_t len );
+void writeDocument( Document *doc, FILE *code, FILE *diag );
+void FreeDocument( Document *doc );
+int compileEdits( Context *ctx, const char *source_file, const char *target_file, Options *opt );
+void writeImage( IRProgram *ir, int level, FILE *target );
+bool isImage( const char *path );
+bool loadImage( const char *path, Image *image );
+void FreeImage( Image *image );
+int compileImage( Context *ctx, const char *source_file, FILE *target, Options *opt );
+const EvalOps *select_eval_ops( void );
+void planEvaluation( IRProgram *ir, EvalPlan *plan, EvalInput *in, int threads );
+void FreePlan( EvalPlan *plan );
+bool openColumns( Context *ctx, IRProgram *ir, char *spec, EvalInput *in );
+bool openCsv( Context *ctx, IRProgram *ir, const char *path, EvalInput *in );
+void FreeInput( EvalInput *in );
+int readBlock( Context *ctx, IRProgram *ir, EvalInput *in, long first, int rows );
+void evaluateRange( Evaluation *run, int from, int to, int thread );
+void evaluateSegments( Evaluation *run, int thread );
+void *evaluationWorker( void *arg );
+void writeRows( Evaluation *run, FILE *target );
+void writeRowsExact( Evaluation *run, FILE *target );
+int evaluate( Context *ctx, const char *source_file, const char *target_file, Options *opt );
+bool addBinding( Options *opt, const char *text );
+bool readBindings( Options *opt, const char *path );
+void bind_map( HashMap *map, Options *opt );
+void InitializeNumber( Number *n );
+void FreeNumber( Number *n );
+void number_copy( Number *r, const Number *a );
+void number_from_int( Number *n, int64_t value );
+bool number_parse( Number *n, const char *text );
+size_t number_text( const Number *n, char *buf, size_t size );
+void number_add( Number *r, const Number *a, const Number *b );
+void number_sub( Number *r, const Number *a, const Number *b );
+void number_mul( Number *r, const Number *a, const Number *b, int precision );
+bool number_div( Number *r, const Number *a, const Number *b, int precision );
+bool number_to_int( const Number *n, int *value );
+bool number_from_float( Number *n, float value, int scale );
+bool number_to_float( const Number *n, float *value, int *scale );
+void startPhase( Phase phase, PhaseClock *clock );
+void nextPhase( Phase phase, PhaseClock *clock );
+void endPhase( PhaseClock *clock );
+void useCounting( Options *opt );
+Counting counting( void );
+void joinPhase( const Counting *parent );
+void countTokens( Lexer *lex );
+void countProbes( int probes );
+FILE *countingStream( FILE *target, Emitted *emitted );
+void countEmitted( FILE *code, Emitted *emitted, bool written );
+void writeStats( FILE *out, Stats *stats );
+void *traceAllocate( void *p, size_t size, const char *site, bool zero );
+void tracePiece( size_t size, const char *site );
+void traceRelease( void *p );
+int traceStartPhase( Phase phase );
+void traceEndPhase( int outer );
+int tracePhase( void );
+void InitializeTrace( Trace *trace );
+void requestTrace( int signal );
+void writeTrace( FILE *out, Trace *trace );
 
 void print_expr( Expression *expr );
 void test_parser( FILE *source );
 
-//EDITED2
-void ungets(char *str, FILE *source);
-
 
 #endif // HEADER_H_INCLUDED
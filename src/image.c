@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "header.h"
+
+/*
+   Program images, AcDc --emit=image.
+
+   An image is the checked and optimized IR of a program as it is in
+   memory: the symbol table, the instructions and the list of statements
+   and loop ends, each an array at an offset from the start of the file. Instructions
+   refer to each other and to variables by index only, so nothing has
+   to be fixed up after loading. AcDc maps an image and prints its dc
+   code without scanning, parsing or checking anything, or runs it with
+   --eval, see ir_unroll; the statement list is there for a runtime that
+   wants to evaluate the program itself.
+
+   The arrays have the layout of the compiler that wrote them. The header
+   records the byte order and the sizes, and an image that does not match
+   them is refused.
+*/
+
+#define ImageAlign 16
+
+static size_t alignImage( size_t offset )
+{
+    return (offset + ImageAlign - 1) & ~(size_t)(ImageAlign - 1);
+}
+
+static void padImage( FILE *target, size_t from, size_t to )
+{
+    for(; from < to; from++)
+        fputc(0, target);
+}
+
+/* the instructions dead code elimination left as IRNop are not written */
+void writeImage( IRProgram *ir, int level, FILE *target )
+{
+    ImageHeader header;
+    IRInst *insts = reallocateHeap(NULL, (ir->count + 1) * sizeof(IRInst));
+    IRSymbol *syms = allocateHeap((ir->symCount + 1) * sizeof(IRSymbol));
+    int *index = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *stmts = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int i, count = 0, stmtCount = 0;
+
+    for(i = 0; i < ir->count; i++){
+        if(ir->insts[i].op == IRNop)
+            continue;
+        index[i] = count;
+        insts[count] = ir->insts[i];
+        if(insts[count].a >= 0)
+            insts[count].a = index[insts[count].a];
+        if(insts[count].b >= 0)
+            insts[count].b = index[insts[count].b];
+        if(insts[count].op == IRStore || insts[count].op == IRPrint ||
+                insts[count].op == IRLoop || insts[count].op == IREndLoop)
+            stmts[stmtCount++] = count;
+        count++;
+    }
+    for(i = 0; i < ir->symCount; i++){/* zero padded names, the same program gives the same bytes */
+        strcpy(syms[i].name, ir->syms[i].name);
+        syms[i].type = ir->syms[i].type;
+        syms[i].version = ir->syms[i].version;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ImageMagic, sizeof(header.magic));
+    header.byteOrder = 0x01020304;
+    header.instSize = sizeof(IRInst);
+    header.symSize = sizeof(IRSymbol);
+    header.level = level;
+    header.symCount = ir->symCount;
+    header.instCount = count;
+    header.stmtCount = stmtCount;
+    header.symOffset = alignImage(sizeof(ImageHeader));
+    header.instOffset = alignImage(header.symOffset + header.symCount * sizeof(IRSymbol));
+    header.stmtOffset = alignImage(header.instOffset + header.instCount * sizeof(IRInst));
+    header.size = header.stmtOffset + header.stmtCount * sizeof(int);
+
+    fwrite(&header, sizeof(header), 1, target);
+    padImage(target, sizeof(header), header.symOffset);
+    fwrite(syms, sizeof(IRSymbol), header.symCount, target);
+    padImage(target, header.symOffset + header.symCount * sizeof(IRSymbol), header.instOffset);
+    fwrite(insts, sizeof(IRInst), header.instCount, target);
+    padImage(target, header.instOffset + header.instCount * sizeof(IRInst), header.stmtOffset);
+    fwrite(stmts, sizeof(int), header.stmtCount, target);
+
+    releaseHeap(insts);
+    releaseHeap(syms);
+    releaseHeap(index);
+    releaseHeap(stmts);
+}
+
+/* does the file start like an image */
+bool isImage( const char *path )
+{
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    bool image;
+
+    if(!file)
+        return false;
+    image = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, ImageMagic, sizeof(magic)) == 0;
+    fclose(file);
+    return image;
+}
+
+/* map the image at path, its IR is used in place; false if it is not one this compiler wrote */
+bool loadImage( const char *path, Image *image )
+{
+    const ImageHeader *header;
+    struct stat st;
+    int fd = open(path, O_RDONLY), i;
+    const IRInst *inst;
+    bool valid, needsA, needsB;
+    int depth = 0;
+
+    memset(image, 0, sizeof(Image));
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)){
+        close(fd);
+        return false;
+    }
+    image->size = st.st_size;
+    image->base = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image->base == MAP_FAILED){
+        image->base = NULL;
+        return false;
+    }
+
+    header = image->base;
+    valid = memcmp(header->magic, ImageMagic, sizeof(header->magic)) == 0 &&
+        header->byteOrder == 0x01020304 && header->instSize == sizeof(IRInst) && header->symSize == sizeof(IRSymbol) &&
+        header->size == image->size &&
+        header->symOffset % ImageAlign == 0 && header->instOffset % ImageAlign == 0 && header->stmtOffset % ImageAlign == 0 &&
+        header->symOffset + (uint64_t)header->symCount * sizeof(IRSymbol) <= image->size &&
+        header->instOffset + (uint64_t)header->instCount * sizeof(IRInst) <= image->size &&
+        header->stmtOffset + (uint64_t)header->stmtCount * sizeof(int) <= image->size;
+    if(valid){
+        image->ir.syms = (IRSymbol *)((char *)image->base + header->symOffset);
+        image->ir.symCount = header->symCount;
+        image->ir.insts = (IRInst *)((char *)image->base + header->instOffset);
+        image->ir.count = header->instCount;
+        image->stmts = (const int *)((char *)image->base + header->stmtOffset);
+        image->stmtCount = header->stmtCount;
+        image->level = header->level;
+    }
+
+    /* operands come before their users, variables are in the table, float constants print in MaxFloatScale digits
+       and loops nest, so printing stays in bounds */
+    for(i = 0; valid && i < image->ir.count; i++){
+        inst = &image->ir.insts[i];
+        needsA = inst->op >= IRAdd && inst->op <= IRPrint;
+        needsB = inst->op >= IRAdd && inst->op <= IRDiv;
+        valid = inst->op >= IRNop && inst->op <= IREndLoop && inst->a < i && inst->b < i &&
+            inst->a >= (needsA ? 0 : -1) && inst->b >= (needsB ? 0 : -1) &&
+            ((inst->op != IRLoad && inst->op != IRStore && inst->op != IRPhi) ||
+                (inst->sym >= 0 && inst->sym < image->ir.symCount)) &&
+            (inst->op != IRConstFloat || (inst->scale >= 0 && inst->scale <= MaxFloatScale));
+        if(valid && inst->op == IRLoop)
+            valid = inst->version == depth++ && depth <= MaxLoopDepth;
+        else if(valid && inst->op == IREndLoop)
+            valid = inst->version == --depth && depth >= 0;
+    }
+    valid = valid && depth == 0;
+    for(i = 0; valid && i < image->ir.symCount; i++)
+        valid = memchr(image->ir.syms[i].name, '\0', sizeof(image->ir.syms[i].name)) != NULL;
+    if(!valid)
+        FreeImage(image);
+    return valid;
+}
+
+void FreeImage( Image *image )
+{
+    if(image->base)
+        munmap(image->base, image->size);
+    memset(image, 0, sizeof(Image));
+}
+
+/* an image given as the source file: its dc code, returns the exit status */
+int compileImage( Context *ctx, const char *source_file, FILE *target, Options *opt )
+{
+    Image image;
+    Emitted emitted;
+    FILE *code;
+    char *buf;
+    size_t codeLength;
+
+    if(!loadImage(source_file, &image)){
+        fprintf(ctx->diag, "%s is not an image of this compiler\n", source_file);
+        return 2;
+    }
+    target = countingStream(target, &emitted);
+    code = opt->factor ? open_memstream(&buf, &codeLength) : target;
+    ir_gencode(&image.ir, code);
+    if(opt->factor){
+        fclose(code);
+        factor_macros(buf, codeLength, target);
+        free(buf);
+    }
+    countEmitted(target, &emitted, true);
+    FreeImage(&image);
+    return 0;
+}
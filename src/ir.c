@@ -0,0 +1,1298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "header.h"
+
+/*
+   Three-address SSA code between the checked AST and the dc emitter.
+
+   Every instruction defines at most one value, named by its index in
+   IRProgram.insts, and its operands are indices of earlier instructions.
+   A store defines a new version of its variable and a load names the
+   version it reads, so each version of a variable has exactly one def.
+   Passes are linear scans over the instruction array.
+
+   A repeat loop is an IRLoop, a phi for every variable its body assigns,
+   the body and an IREndLoop. The phi is the version a variable has when
+   an iteration starts: the one stored before the loop the first time,
+   the last one the body stored after that. A loop runs at least once,
+   so after it a variable has the version its body stored last.
+*/
+
+#define MaxInductionVariables 6
+#define InductionRegister(n) (LoopCounter(MaxLoopDepth - 1) - 1 - (n))
+
+
+/********************************************************
+  Lowering
+ *********************************************************/
+void InitializeIR( IRProgram *ir )
+{
+    int i;
+
+    memset(ir, 0, sizeof(IRProgram));
+    ir->symSlotCount = 64;
+    ir->symSlots = reallocateHeap(NULL, ir->symSlotCount * sizeof(int));
+    for(i = 0; i < ir->symSlotCount; i++)
+        ir->symSlots[i] = -1;
+}
+
+void FreeIR( IRProgram *ir )
+{
+    releaseHeap(ir->insts);
+    releaseHeap(ir->syms);
+    releaseHeap(ir->symSlots);
+}
+
+static unsigned long ir_hash_name( const char *name )
+{
+    unsigned long hashval = 5381;
+    int c;
+
+    while((c = *name++))
+        hashval = ((hashval<<5) + hashval) + c;
+    return hashval;
+}
+
+/* index of the variable, added on first sight */
+int ir_symbol( IRProgram *ir, char *name, DataType type )
+{
+    int idx, i;
+
+    if(2 * (ir->symCount + 1) > ir->symSlotCount){
+        releaseHeap(ir->symSlots);
+        ir->symSlotCount *= 2;
+        ir->symSlots = reallocateHeap(NULL, ir->symSlotCount * sizeof(int));
+        for(i = 0; i < ir->symSlotCount; i++)
+            ir->symSlots[i] = -1;
+        for(i = 0; i < ir->symCount; i++){
+            idx = ir_hash_name(ir->syms[i].name) % ir->symSlotCount;
+            while(ir->symSlots[idx] != -1)
+                idx = (idx + 1) % ir->symSlotCount;
+            ir->symSlots[idx] = i;
+        }
+    }
+
+    idx = ir_hash_name(name) % ir->symSlotCount;
+    while((i = ir->symSlots[idx]) != -1){
+        if(strcmp(ir->syms[i].name, name) == 0)
+            return i;
+        idx = (idx + 1) % ir->symSlotCount;
+    }
+
+    if(ir->symCount == ir->symCapacity){
+        ir->symCapacity = ir->symCapacity ? ir->symCapacity * 2 : 16;
+        ir->syms = reallocateHeap(ir->syms, ir->symCapacity * sizeof(IRSymbol));
+    }
+    i = ir->symCount++;
+    memcpy(ir->syms[i].name, name, strlen(name)+1);
+    ir->syms[i].type = type;
+    ir->syms[i].version = 0;
+    ir->symSlots[idx] = i;
+    return i;
+}
+
+int ir_emit( IRProgram *ir, IROp op, DataType type, int a, int b )
+{
+    IRInst *inst;
+
+    if(ir->count == ir->capacity){
+        ir->capacity = ir->capacity ? ir->capacity * 2 : 256;
+        ir->insts = reallocateHeap(ir->insts, ir->capacity * sizeof(IRInst));
+    }
+    inst = &ir->insts[ir->count];
+    memset(inst, 0, sizeof(IRInst));
+    inst->op = op;
+    inst->type = type;
+    inst->a = a;
+    inst->b = b;
+    inst->sym = -1;
+    inst->setsPrecision = (op == IRIntToFloat) ||
+        (a >= 0 && ir->insts[a].setsPrecision) || (b >= 0 && ir->insts[b].setsPrecision);
+    return ir->count++;
+}
+
+static IROp ir_binary_op( ValueType node, bool negate )
+{
+    switch(node){
+        case PlusNode:
+            return IRAdd;
+        case MinusNode:
+            return IRSub;
+        case MulNode:
+        case ProductNode:
+            return IRMul;
+        case DivNode:
+            return IRDiv;
+        case SumNode:
+            return negate ? IRSub : IRAdd;
+        default:
+            return IRNop;
+    }
+}
+
+/* operands are lowered in the order the AST emitter prints them */
+int lower_expr( IRProgram *ir, Expression *expr )
+{
+    int t, u, i;
+
+    switch(expr->v.type){
+        case Identifier:
+            i = ir_symbol(ir, expr->v.val.id, expr->type);
+            t = ir_emit(ir, IRLoad, expr->type, -1, -1);
+            ir->insts[t].sym = i;
+            ir->insts[t].version = ir->syms[i].version;
+            return t;
+        case IntConst:
+            t = ir_emit(ir, IRConstInt, Int, -1, -1);
+            ir->insts[t].imm.ivalue = expr->v.val.ivalue;
+            return t;
+        case FloatConst:
+            t = ir_emit(ir, IRConstFloat, Float, -1, -1);
+            ir->insts[t].imm.fvalue = expr->v.val.fvalue;
+            ir->insts[t].scale = expr->v.scale;
+            return t;
+        case IntToFloatConvertNode:
+            t = lower_expr(ir, expr->leftOperand);
+            return ir_emit(ir, IRIntToFloat, Float, t, -1);
+        case SumNode:
+        case ProductNode:
+            t = lower_expr(ir, expr->operands[0].expr);
+            for(i = 1; i < expr->count; i++){
+                u = lower_expr(ir, expr->operands[i].expr);
+                t = ir_emit(ir, ir_binary_op(expr->v.type, expr->operands[i].negate), expr->type, t, u);
+            }
+            return t;
+        default:
+            t = lower_expr(ir, expr->leftOperand);
+            u = lower_expr(ir, expr->rightOperand);
+            return ir_emit(ir, ir_binary_op(expr->v.type, false), expr->type, t, u);
+    }
+}
+
+void lower_statement( IRProgram *ir, Statements *stmts, int i )
+{
+    int sym, t;
+
+    if(stmts->kind[i] == RepeatStart || stmts->kind[i] == RepeatEnd){
+        t = ir_emit(ir, stmts->kind[i] == RepeatStart ? IRLoop : IREndLoop, Notype, -1, -1);
+        ir->insts[t].version = (LoopMacro(0) - stmts->target[i][1]) / 2;
+        if(stmts->kind[i] == RepeatStart)
+            ir->insts[t].imm.ivalue = stmts->expr[i]->v.val.ivalue;
+    }
+    else if(stmts->kind[i] == Assignment){
+        t = lower_expr(ir, stmts->expr[i]);
+        sym = ir_symbol(ir, stmts->target[i], stmts->type[i]);
+        t = ir_emit(ir, IRStore, stmts->type[i], t, -1);
+        ir->insts[t].sym = sym;
+        ir->insts[t].version = ++ir->syms[sym].version;
+    }
+    else{
+        sym = ir_symbol(ir, stmts->target[i], Notype);
+        if(stmts->expr[i] != NULL)/* a bound variable, its constant is printed */
+            t = lower_expr(ir, stmts->expr[i]);
+        else{
+            t = ir_emit(ir, IRLoad, ir->syms[sym].type, -1, -1);
+            ir->insts[t].sym = sym;
+            ir->insts[t].version = ir->syms[sym].version;
+        }
+        t = ir_emit(ir, IRPrint, ir->syms[sym].type, t, -1);
+        ir->insts[t].sym = sym;
+    }
+}
+
+/* declared variables get their types before any statement is lowered */
+void lower_declarations( IRProgram *ir, Declarations *decls )
+{
+    int i;
+
+    for(i = 0; i < decls->count; i++)
+        ir_symbol(ir, decls->items[i].name, decls->items[i].type);
+}
+
+/* the RepeatEnd of the loop that starts at statement i */
+static int loop_end( Statements *stmts, int i )
+{
+    int depth = 0;
+
+    for(; ; i++){
+        if(stmts->kind[i] == RepeatStart)
+            depth++;
+        else if(stmts->kind[i] == RepeatEnd && --depth == 0)
+            return i;
+    }
+}
+
+void lower_program( IRProgram *ir, Program *program )
+{
+    Statements *stmts = &program->statements;
+    int *seen = NULL, seenCount = 0, i, j, end, sym, t;
+
+    lower_declarations(ir, &program->declarations);
+    for(i = 0; i < stmts->count; i++){
+        lower_statement(ir, stmts, i);
+        if(stmts->kind[i] != RepeatStart)
+            continue;
+
+        /* a phi for every variable the body assigns, once */
+        end = loop_end(stmts, i);
+        for(j = i + 1; j < end; j++){
+            if(stmts->kind[j] != Assignment)
+                continue;
+            sym = ir_symbol(ir, stmts->target[j], stmts->type[j]);
+            if(sym >= seenCount){
+                seen = reallocateHeap(seen, 2 * (sym + 1) * sizeof(int));
+                for(t = seenCount; t < 2 * (sym + 1); t++)
+                    seen[t] = -1;
+                seenCount = 2 * (sym + 1);
+            }
+            if(seen[sym] == i)
+                continue;
+            seen[sym] = i;
+            t = ir_emit(ir, IRPhi, ir->syms[sym].type, -1, -1);
+            ir->insts[t].sym = sym;
+            ir->insts[t].version = ++ir->syms[sym].version;
+        }
+    }
+    releaseHeap(seen);
+}
+
+/* the IREndLoop of the IRLoop at i */
+static int ir_loop_end( IRProgram *ir, int i )
+{
+    int depth = 0;
+
+    for(; ; i++){
+        if(ir->insts[i].op == IRLoop)
+            depth++;
+        else if(ir->insts[i].op == IREndLoop && --depth == 0)
+            return i;
+    }
+}
+
+typedef struct{
+    IRProgram *from, *to;
+    int *index;         /* of every instruction of from, its copy made last, the one of this iteration */
+    int *origin;        /* of every instruction of to, the one of from it copies */
+    int originSize;
+    int limit;
+}IRUnroller;
+
+static bool ir_unroll_range( IRUnroller *un, int first, int last )
+{
+    IRInst *inst;
+    int i, end, k, count, t;
+
+    for(i = first; i < last; i++){
+        inst = &un->from->insts[i];
+        if(inst->op == IRLoop){
+            end = ir_loop_end(un->from, i);
+            for(k = 0; k < inst->imm.ivalue; k++){
+                count = un->to->count;
+                if(!ir_unroll_range(un, i + 1, end))
+                    return false;
+                if(un->to->count == count)/* nothing to repeat */
+                    break;
+            }
+            i = end;
+            continue;
+        }
+        if(inst->op == IRNop)
+            continue;
+        /* a phi is the variable as the iteration starts, without loops that is just its value */
+        t = ir_emit(un->to, inst->op == IRPhi ? IRLoad : inst->op, inst->type,
+                    inst->a >= 0 ? un->index[inst->a] : -1, inst->b >= 0 ? un->index[inst->b] : -1);
+        un->to->insts[t].sym = inst->sym;
+        un->to->insts[t].imm = inst->imm;
+        if(inst->op == IRStore)
+            un->to->insts[t].version = ++un->to->syms[inst->sym].version;
+        else if(inst->op == IRLoad || inst->op == IRPhi)/* in program order the last version stored is the one read */
+            un->to->insts[t].version = un->to->syms[inst->sym].version;
+        if(un->to->capacity > un->originSize){
+            un->originSize = un->to->capacity;
+            un->origin = reallocateHeap(un->origin, un->originSize * sizeof(int));
+        }
+        un->origin[t] = i;
+        un->index[i] = t;
+        if(un->to->count > un->limit)
+            return false;
+    }
+    return true;
+}
+
+/*
+   The checked and optimized IR of a program written out without loops,
+   every body as often as it runs, into the empty ir to; false if that
+   takes more than limit instructions. Loads and stores get new versions,
+   one for every store that runs; the variables keep their indices.
+   (*origin)[t] is the instruction of from that instruction t copies.
+*/
+bool ir_unroll( IRProgram *from, IRProgram *to, int **origin, int limit )
+{
+    IRUnroller un;
+    bool unrolled;
+    int i;
+
+    un.from = from;
+    un.to = to;
+    un.index = reallocateHeap(NULL, (from->count + 1) * sizeof(int));
+    un.origin = NULL;
+    un.originSize = 0;
+    un.limit = limit;
+    for(i = 0; i < from->symCount; i++)
+        if(ir_symbol(to, from->syms[i].name, from->syms[i].type) != i)/* a name twice, the indices would not match */
+            break;
+    unrolled = i == from->symCount && ir_unroll_range(&un, 0, from->count);
+    releaseHeap(un.index);
+    *origin = un.origin;
+    return unrolled;
+}
+
+
+/********************************************************
+  Passes
+ *********************************************************/
+static bool ir_is_const( IRInst *inst )
+{
+    return inst->op == IRConstInt || inst->op == IRConstFloat;
+}
+
+/* the number dc reads for a constant, see calculate_op */
+static bool ir_number( IRInst *inst, Number *n )
+{
+    if(inst->op == IRConstInt){
+        number_from_int(n, inst->imm.ivalue);
+        return true;
+    }
+    return number_from_float(n, inst->imm.fvalue, inst->scale);
+}
+
+/*
+   Binary operations on two constants, folded with the arithmetic of dc
+   like calculate_op does, at the k ir_precisions finds for where the
+   instruction is printed. Conversions are left alone: the 5k they print
+   sets the precision for the rest of the statement.
+*/
+bool ir_fold( IRProgram *ir )
+{
+    static const ValueType node[] = { [IRAdd] = PlusNode, [IRSub] = MinusNode, [IRMul] = MulNode, [IRDiv] = DivNode };
+    bool *at5k = allocateHeap((ir->count + 1) * sizeof(bool));
+    IRInst *inst, *a, *b;
+    Number x, y;
+    Value v;
+    bool changed = false, folded;
+    int i;
+
+    InitializeNumber(&x);
+    InitializeNumber(&y);
+    ir_precisions(ir, at5k);
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        if(inst->op < IRAdd || inst->op > IRDiv)
+            continue;
+        a = &ir->insts[inst->a];
+        b = &ir->insts[inst->b];
+        if(!ir_is_const(a) || !ir_is_const(b))
+            continue;
+        folded = ir_number(a, &x) && ir_number(b, &y) &&
+            fold_number(node[inst->op], inst->type, &x, &y, at5k[i] ? 5 : 0, &v);
+        if(!folded)
+            continue;
+        countStat(folds, 1);
+        if(v.type == IntConst){
+            inst->op = IRConstInt;
+            inst->imm.ivalue = v.val.ivalue;
+        }
+        else{
+            inst->op = IRConstFloat;
+            inst->imm.fvalue = v.val.fvalue;
+            inst->scale = v.scale;
+        }
+        inst->a = inst->b = -1;
+        changed = true;
+    }
+    FreeNumber(&x);
+    FreeNumber(&y);
+    releaseHeap(at5k);
+    return changed;
+}
+
+/* a load of a version that was stored from a constant becomes that constant */
+bool ir_propagate( IRProgram *ir )
+{
+    int *stored = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(int));
+    IRInst *inst, *value;
+    bool changed = false;
+    int i;
+
+    for(i = 0; i < ir->symCount; i++)
+        stored[i] = -1;
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        if(inst->op == IRStore){
+            stored[inst->sym] = inst->a;
+        }
+        else if(inst->op == IRPhi){/* changes from one iteration to the next */
+            stored[inst->sym] = -1;
+        }
+        else if(inst->op == IRLoad && stored[inst->sym] >= 0){
+            value = &ir->insts[stored[inst->sym]];
+            if(ir_is_const(value)){
+                inst->op = value->op;
+                inst->type = value->type;
+                inst->imm = value->imm;
+                inst->scale = value->scale;
+                inst->sym = -1;
+                changed = true;
+            }
+        }
+    }
+    releaseHeap(stored);
+    return changed;
+}
+
+/* a division, or a float product, comes out of dc with as many digits as k says */
+static bool ir_precise( IRInst *inst )
+{
+    return inst->op == IRDiv || (inst->op == IRMul && inst->type == Float);
+}
+
+/* the value t as ir_gencode prints it: operands first, a value printed before is loaded again */
+static void ir_walk_precision( IRProgram *ir, int t, bool *seen, bool *at5k, bool *state )
+{
+    IRInst *inst = &ir->insts[t];
+
+    if(seen[t]){
+        if(inst->setsPrecision)/* ir_fprint_value runs 5k again */
+            *state = true;
+        return;
+    }
+    seen[t] = true;
+    if(inst->a >= 0) ir_walk_precision(ir, inst->a, seen, at5k, state);
+    if(inst->b >= 0) ir_walk_precision(ir, inst->b, seen, at5k, state);
+    if(inst->op == IRIntToFloat)
+        *state = true;
+    at5k[t] = *state;
+}
+
+/* whether every instruction is computed at 5k, in the order ir_gencode prints them */
+void ir_precisions( IRProgram *ir, bool *at5k )
+{
+    bool *seen = allocateHeap((ir->count + 1) * sizeof(bool));
+    bool state = false;
+    int i;
+
+    for(i = 0; i < ir->count; i++){
+        if(ir->insts[i].op == IRStore || ir->insts[i].op == IRPrint)
+            ir_walk_precision(ir, ir->insts[i].a, seen, at5k, &state);
+        if(ir->insts[i].op == IRStore || ir->insts[i].op == IRLoop || ir->insts[i].op == IREndLoop)
+            state = false;/* 0 k */
+    }
+    releaseHeap(seen);
+}
+
+/*
+   Value numbering: identical pure instructions on the same operands are
+   computed once. A division or float product computed at 0 k is not the
+   one computed after a 5k, so for those the precision is part of the value.
+*/
+bool ir_cse( IRProgram *ir )
+{
+    int *repl = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    bool *at5k = allocateHeap((ir->count + 1) * sizeof(bool));
+    int slotCount = 1, *slots, i, j, idx;
+    unsigned long h;
+    IRInst *inst, *other;
+    bool changed = false;
+
+    while(slotCount < 2 * ir->count + 2) slotCount <<= 1;
+    slots = reallocateHeap(NULL, slotCount * sizeof(int));
+    for(i = 0; i < slotCount; i++)
+        slots[i] = -1;
+    ir_precisions(ir, at5k);
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        repl[i] = i;
+        if(inst->a >= 0) inst->a = repl[inst->a];
+        if(inst->b >= 0) inst->b = repl[inst->b];
+        if(inst->op == IRNop || inst->op == IRStore || inst->op == IRPrint ||
+                inst->op == IRLoop || inst->op == IRPhi || inst->op == IREndLoop)
+            continue;
+
+        h = ((((unsigned long)inst->op * 31 + inst->type) * 1000003UL + inst->a) * 1000003UL + inst->b) * 1000003UL;
+        if(inst->op == IRLoad)
+            h += inst->sym * 31 + inst->version;
+        else if(ir_is_const(inst))
+            h += (unsigned int)inst->imm.ivalue;
+        else if(ir_precise(inst))
+            h += at5k[i];
+        h ^= h >> 33;/* spread the small sym, version and constant over the low bits */
+        h *= 0xff51afd7ed558ccdUL;
+        h ^= h >> 33;
+        idx = h & (slotCount - 1);
+
+        while((j = slots[idx]) != -1){
+            other = &ir->insts[j];
+            if(other->op == inst->op && other->type == inst->type &&
+                    other->a == inst->a && other->b == inst->b &&
+                    other->sym == inst->sym && other->version == inst->version &&
+                    memcmp(&other->imm, &inst->imm, sizeof(inst->imm)) == 0 && other->scale == inst->scale &&
+                    (!ir_precise(inst) || at5k[j] == at5k[i]))
+                break;
+            idx = (idx + 1) & (slotCount - 1);
+        }
+        if(j == -1)
+            slots[idx] = i;
+        else{
+            repl[i] = j;
+            inst->op = IRNop;
+            inst->a = inst->b = -1;
+            changed = true;
+        }
+    }
+    releaseHeap(slots);
+    releaseHeap(repl);
+    releaseHeap(at5k);
+    return changed;
+}
+
+static void ir_mark( bool *live, int *work, int *n, int i )
+{
+    if(i >= 0 && !live[i]){
+        live[i] = true;
+        work[(*n)++] = i;
+    }
+}
+
+/*
+   Nothing but p statements is observable, so everything the prints do not
+   depend on, through operands or through the store of a loaded version, is removed.
+   A phi depends on the store before its loop and on the last store of the
+   body; a loop whose body has nothing left goes as well.
+*/
+bool ir_dce( IRProgram *ir )
+{
+    int *current = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(int));
+    int *def = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *back = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *work = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    bool *live = allocateHeap((ir->count + 1) * sizeof(bool));
+    int loops[MaxLoopDepth + 1];
+    bool busy[MaxLoopDepth + 1];
+    bool changed = false;
+    IRInst *inst;
+    int i, j, n = 0, depth = 0;
+
+    for(i = 0; i < ir->symCount; i++)
+        current[i] = -1;
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        def[i] = back[i] = -1;
+        if(inst->op == IRStore)
+            current[inst->sym] = i;
+        else if(inst->op == IRLoad)
+            def[i] = current[inst->sym];
+        else if(inst->op == IRPhi){
+            def[i] = current[inst->sym];
+            current[inst->sym] = i;
+        }
+        else if(inst->op == IRLoop && depth <= MaxLoopDepth)
+            loops[depth++] = i;
+        else if(inst->op == IREndLoop && depth > 0)/* the phis follow their IRLoop */
+            for(j = loops[--depth] + 1; j < i && (ir->insts[j].op == IRPhi || ir->insts[j].op == IRNop); j++)
+                if(ir->insts[j].op == IRPhi)
+                    back[j] = current[ir->insts[j].sym];
+        if(inst->op == IRPrint || inst->op == IRLoop || inst->op == IREndLoop)
+            ir_mark(live, work, &n, i);
+    }
+
+    while(n > 0){
+        i = work[--n];
+        inst = &ir->insts[i];
+        ir_mark(live, work, &n, inst->a);
+        ir_mark(live, work, &n, inst->b);
+        ir_mark(live, work, &n, def[i]);
+        ir_mark(live, work, &n, back[i]);
+    }
+
+    for(i = 0, depth = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        if(inst->op == IRLoop && depth <= MaxLoopDepth){
+            loops[depth] = i;
+            busy[depth++] = false;
+        }
+        else if(inst->op == IREndLoop && depth > 0){
+            if(!busy[--depth])
+                live[loops[depth]] = live[i] = false;
+            else if(depth > 0)
+                busy[depth - 1] = true;
+        }
+        else if((inst->op == IRStore || inst->op == IRPrint) && live[i] && depth > 0)
+            busy[depth - 1] = true;
+    }
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        if(!live[i] && inst->op != IRNop){
+            inst->op = IRNop;
+            inst->a = inst->b = -1;
+            changed = true;
+        }
+    }
+    releaseHeap(current);
+    releaseHeap(def);
+    releaseHeap(back);
+    releaseHeap(work);
+    releaseHeap(live);
+    return changed;
+}
+
+/*
+   The loops of the program, false if there are none. loop[i] is the
+   IRLoop of the innermost loop instruction i is in, -1 outside of all;
+   an IRLoop is in the loop around it. For an IRLoop s, end[s] is its
+   IREndLoop and parent[s] the IRLoop of the loop around it.
+*/
+static bool ir_loops( IRProgram *ir, int *loop, int *end, int *parent )
+{
+    int stack[MaxLoopDepth + 1], depth = 0, i;
+    bool found = false;
+
+    for(i = 0; i < ir->count; i++){
+        loop[i] = depth > 0 ? stack[depth - 1] : -1;
+        if(ir->insts[i].op == IRLoop && depth <= MaxLoopDepth){
+            parent[i] = loop[i];
+            stack[depth++] = i;
+            found = true;
+        }
+        else if(ir->insts[i].op == IREndLoop && depth > 0){
+            end[stack[--depth]] = i;
+            loop[i] = depth > 0 ? stack[depth - 1] : -1;
+        }
+    }
+    return found;
+}
+
+/*
+   Put instruction i right in front of instruction before[i], or leave it
+   where it is if before[i] is i; instructions in front of the same one
+   keep their order. Every before[i] must be an instruction that stays.
+*/
+static void ir_move( IRProgram *ir, int *before )
+{
+    int *first = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *next = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *index = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    IRInst *insts = reallocateHeap(NULL, (ir->capacity + 1) * sizeof(IRInst));
+    int i, j, n = 0;
+
+    for(i = 0; i < ir->count; i++)
+        first[i] = -1;
+    for(i = ir->count - 1; i >= 0; i--)
+        if(before[i] != i){
+            next[i] = first[before[i]];
+            first[before[i]] = i;
+        }
+    for(i = 0; i < ir->count; i++){
+        for(j = first[i]; j != -1; j = next[j])
+            index[j] = n++;
+        if(before[i] == i)
+            index[i] = n++;
+    }
+    for(i = 0; i < ir->count; i++){
+        insts[index[i]] = ir->insts[i];
+        if(ir->insts[i].a >= 0)
+            insts[index[i]].a = index[ir->insts[i].a];
+        if(ir->insts[i].b >= 0)
+            insts[index[i]].b = index[ir->insts[i].b];
+    }
+    releaseHeap(ir->insts);
+    ir->insts = insts;
+    releaseHeap(first);
+    releaseHeap(next);
+    releaseHeap(index);
+}
+
+/* the int constant operand of inst and in *other the other operand, false if neither is one */
+static bool ir_const_operand( IRProgram *ir, IRInst *inst, int *value, int *other )
+{
+    if(ir->insts[inst->b].op == IRConstInt){
+        *value = ir->insts[inst->b].imm.ivalue;
+        *other = inst->a;
+        return true;
+    }
+    if(ir->insts[inst->a].op == IRConstInt && inst->op != IRSub){
+        *value = ir->insts[inst->a].imm.ivalue;
+        *other = inst->b;
+        return true;
+    }
+    return false;
+}
+
+/* does t load version of variable sym */
+static bool ir_loads( IRProgram *ir, int t, int sym, int version )
+{
+    return ir->insts[t].op == IRLoad && ir->insts[t].sym == sym && ir->insts[t].version == version;
+}
+
+/* a new instruction, to be moved in front of instruction at */
+static int ir_emit_before( IRProgram *ir, int **before, int at, IROp op, int a, int b )
+{
+    int t = ir_emit(ir, op, Int, a, b);
+
+    *before = reallocateHeap(*before, (ir->capacity + 1) * sizeof(int));
+    (*before)[t] = at;
+    return t;
+}
+
+/*
+   Strength reduction of induction variables. If the body of a loop adds
+   a constant c to an int variable x once, x * k for a constant k is the
+   same as a variable that starts at x * k before the loop and grows by
+   c * k at the end of every iteration. The variables are dc registers
+   below the ones of the loops, so there are only a few.
+*/
+bool ir_strength( IRProgram *ir )
+{
+    int count = ir->count, *loop, *end, *parent, *before;
+    int s, p, i, x, version, store, step, k, other, increment, sym, t, u, used = 0;
+    IRInst *inst;
+    char name[2];
+    bool changed = false;
+
+    loop = reallocateHeap(NULL, (count + 1) * sizeof(int));
+    end = reallocateHeap(NULL, (count + 1) * sizeof(int));
+    parent = reallocateHeap(NULL, (count + 1) * sizeof(int));
+    before = reallocateHeap(NULL, (ir->capacity + 1) * sizeof(int));
+    for(i = 0; i < count; i++)
+        before[i] = i;
+    for(i = 0; i < ir->symCount; i++)
+        if(ir->syms[i].name[0] >= 'A' && ir->syms[i].name[0] <= 'Z')
+            used++;
+
+    if(!ir_loops(ir, loop, end, parent))
+        count = 0;
+    for(s = 0; s < count; s++){
+        if(ir->insts[s].op != IRLoop)
+            continue;
+        for(p = s + 1; p < end[s] && (ir->insts[p].op == IRPhi || ir->insts[p].op == IRNop); p++){
+            if(ir->insts[p].op != IRPhi || ir->insts[p].type != Int)
+                continue;
+            x = ir->insts[p].sym;
+            version = ir->insts[p].version;
+
+            /* x = x + c, the only store of x in the loop and not in a loop inside it */
+            store = -1;
+            for(i = p + 1; i < end[s]; i++)
+                if(ir->insts[i].op == IRStore && ir->insts[i].sym == x)
+                    store = (store == -1 && loop[i] == s) ? i : -2;
+            if(store < 0)
+                continue;
+            inst = &ir->insts[ir->insts[store].a];
+            if((inst->op != IRAdd && inst->op != IRSub) || inst->type != Int ||
+                    !ir_const_operand(ir, inst, &step, &other) || !ir_loads(ir, other, x, version) ||
+                    (inst->op == IRSub && __builtin_sub_overflow(0, step, &step)))
+                continue;
+
+            for(i = p + 1; i < end[s] && used < MaxInductionVariables; i++){
+                inst = &ir->insts[i];
+                if(inst->op != IRMul || inst->type != Int || !ir_const_operand(ir, inst, &k, &other) ||
+                        !ir_loads(ir, other, x, version) || __builtin_mul_overflow(step, k, &increment))
+                    continue;
+
+                name[0] = InductionRegister(used++);
+                name[1] = '\0';
+                sym = ir_symbol(ir, name, Int);
+
+                /* x * k before the loop */
+                t = ir_emit_before(ir, &before, s, IRLoad, -1, -1);
+                ir->insts[t].sym = x;
+                ir->insts[t].version = version - 1;
+                u = ir_emit_before(ir, &before, s, IRConstInt, -1, -1);
+                ir->insts[u].imm.ivalue = k;
+                t = ir_emit_before(ir, &before, s, IRStore, ir_emit_before(ir, &before, s, IRMul, t, u), -1);
+                ir->insts[t].sym = sym;
+                ir->insts[t].version = ++ir->syms[sym].version;
+
+                /* its phi, loaded in place of the product */
+                t = ir_emit_before(ir, &before, s + 1, IRPhi, -1, -1);
+                ir->insts[t].sym = sym;
+                ir->insts[t].version = ++ir->syms[sym].version;
+                inst = &ir->insts[i];
+                inst->op = IRLoad;
+                inst->a = inst->b = -1;
+                inst->sym = sym;
+                inst->version = ir->insts[t].version;
+
+                /* + c * k at the end of the body */
+                t = ir_emit_before(ir, &before, end[s], IRLoad, -1, -1);
+                ir->insts[t].sym = sym;
+                ir->insts[t].version = inst->version;
+                u = ir_emit_before(ir, &before, end[s], IRConstInt, -1, -1);
+                ir->insts[u].imm.ivalue = increment;
+                t = ir_emit_before(ir, &before, end[s], IRStore, ir_emit_before(ir, &before, end[s], IRAdd, t, u), -1);
+                ir->insts[t].sym = sym;
+                ir->insts[t].version = ++ir->syms[sym].version;
+                changed = true;
+            }
+        }
+    }
+    if(changed)
+        ir_move(ir, before);
+    releaseHeap(loop);
+    releaseHeap(end);
+    releaseHeap(parent);
+    releaseHeap(before);
+    return changed;
+}
+
+/* a value that comes out the same whatever precision dc has: no divisions, no float products */
+static bool ir_hoistable( IRInst *inst )
+{
+    switch(inst->op){
+        case IRAdd:
+        case IRSub:
+        case IRIntToFloat:
+            return true;
+        case IRMul:
+            return inst->type == Int;
+        default:
+            return false;
+    }
+}
+
+/*
+   Loop invariant code motion. A value in a loop whose operands are all
+   computed in front of the loop moves there, and so can the values that
+   use it; a load moves if the version it reads was stored before the
+   loop. ir_gencode computes what moved once, before the loop starts.
+*/
+bool ir_licm( IRProgram *ir )
+{
+    int *loop = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *end = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *parent = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *before = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    int *current = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(int));
+    int i, l, at, def;
+    IRInst *inst;
+    bool changed = false, invariant;
+
+    if(ir_loops(ir, loop, end, parent)){
+        for(i = 0; i < ir->symCount; i++)
+            current[i] = -1;
+        for(i = 0; i < ir->count; i++){
+            inst = &ir->insts[i];
+            before[i] = i;
+            def = -1;
+            if(inst->op == IRStore || inst->op == IRPhi){
+                current[inst->sym] = i;
+                continue;
+            }
+            if(inst->op == IRLoad)
+                def = current[inst->sym];
+            else if(!ir_is_const(inst) && !ir_hoistable(inst))
+                continue;
+
+            /* out of loop l as long as nothing it reads is computed in l */
+            for(at = i, l = loop[i]; l >= 0; l = parent[l]){
+                invariant = !(def > l && def < end[l]);
+                if(inst->a >= 0)
+                    invariant = invariant && !(before[inst->a] > l && before[inst->a] < end[l]);
+                if(inst->b >= 0)
+                    invariant = invariant && !(before[inst->b] > l && before[inst->b] < end[l]);
+                if(!invariant)
+                    break;
+                at = l;
+            }
+            if(at != i){
+                before[i] = at;
+                changed = true;
+            }
+        }
+        if(changed)
+            ir_move(ir, before);
+    }
+    releaseHeap(loop);
+    releaseHeap(end);
+    releaseHeap(parent);
+    releaseHeap(before);
+    releaseHeap(current);
+    return changed;
+}
+
+/* passes in the order they run, each one runs only at its level and above */
+static const IRPass ir_passes[] = {
+    { "propagate", 2, ir_propagate },
+    { "fold",      1, ir_fold      },
+    { "cse",       2, ir_cse       },
+    { "dce",       2, ir_dce       },
+    { "strength",  2, ir_strength  },
+    { "licm",      2, ir_licm      },
+};
+
+/* run the pipeline until no pass changes anything */
+void run_passes( IRProgram *ir, int level )
+{
+    int round, i;
+    bool changed = true;
+
+    for(round = 0; changed && round < 8; round++){
+        changed = false;
+        for(i = 0; i < (int)(sizeof(ir_passes) / sizeof(ir_passes[0])); i++)
+            if(ir_passes[i].level <= level && ir_passes[i].run(ir))
+                changed = true;
+    }
+}
+
+
+/********************************************************
+  Value ranges
+  The ints an instruction may compute, as an interval of
+  64 bit ints. An interval that would need more bits is
+  unbounded, and so is everything that is not an int.
+  Variables start in the range their caller knows them
+  to be in, a phi may hold whatever its loop computes.
+ *********************************************************/
+static const IRRange ir_unbounded = { 0, 0, false };
+
+static IRRange ir_range( int64_t lo, int64_t hi )
+{
+    IRRange range = { lo, hi, true };
+
+    return range;
+}
+
+bool ir_fits32( IRRange range )
+{
+    return range.bounded && range.lo >= INT32_MIN && range.hi <= INT32_MAX;
+}
+
+/* the smallest interval holding the four products or quotients of the ends */
+static IRRange ir_corners( IROp op, IRRange a, IRRange b )
+{
+    int64_t ends[4], lo, hi;
+    int i;
+
+    for(i = 0; i < 4; i++){
+        int64_t x = i < 2 ? a.lo : a.hi, y = i % 2 == 0 ? b.lo : b.hi;
+        if(op == IRMul){
+            if(__builtin_mul_overflow(x, y, &ends[i]))
+                return ir_unbounded;
+        }
+        else if(x == INT64_MIN && y == -1)
+            return ir_unbounded;
+        else
+            ends[i] = x / y;
+    }
+    lo = hi = ends[0];
+    for(i = 1; i < 4; i++){
+        lo = ends[i] < lo ? ends[i] : lo;
+        hi = ends[i] > hi ? ends[i] : hi;
+    }
+    return ir_range(lo, hi);
+}
+
+static IRRange ir_range_of( IROp op, IRRange a, IRRange b )
+{
+    int64_t lo, hi, m;
+
+    if(!a.bounded || !b.bounded)
+        return ir_unbounded;
+    switch(op){
+        case IRAdd:
+            if(__builtin_add_overflow(a.lo, b.lo, &lo) || __builtin_add_overflow(a.hi, b.hi, &hi))
+                return ir_unbounded;
+            return ir_range(lo, hi);
+        case IRSub:
+            if(__builtin_sub_overflow(a.lo, b.hi, &lo) || __builtin_sub_overflow(a.hi, b.lo, &hi))
+                return ir_unbounded;
+            return ir_range(lo, hi);
+        case IRMul:
+            return ir_corners(op, a, b);
+        default:
+            if(b.lo > 0 || b.hi < 0)
+                return ir_corners(op, a, b);
+            /* a divisor that may be 0 or +-1: no bigger than the dividend, and 0 on a division by zero */
+            if(a.lo == INT64_MIN)
+                return ir_unbounded;
+            m = -a.lo > a.hi ? -a.lo : a.hi;
+            return ir_range(-m, m);
+    }
+}
+
+/*
+   range[i] for every instruction, in one pass in program order. A load
+   has the range of the def of its version, inputs[sym] when the
+   variable was not assigned yet; without inputs that is unbounded.
+*/
+void ir_ranges( IRProgram *ir, const IRRange *inputs, IRRange *range )
+{
+    int *current = reallocateHeap(NULL, (ir->symCount + 1) * sizeof(int));
+    IRInst *inst;
+    int i, def;
+
+    for(i = 0; i < ir->symCount; i++)
+        current[i] = -1;
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        range[i] = ir_unbounded;
+        if(inst->type != Int)
+            continue;
+        switch(inst->op){
+            case IRConstInt:
+                range[i] = ir_range(inst->imm.ivalue, inst->imm.ivalue);
+                break;
+            case IRLoad:
+                def = current[inst->sym];
+                if(def < 0 && inst->version == 0 && inputs != NULL)
+                    range[i] = inputs[inst->sym];
+                else if(def >= 0 && ir->insts[def].version == inst->version)
+                    range[i] = range[def];
+                break;
+            case IRAdd: case IRSub: case IRMul: case IRDiv:
+                if(ir->insts[inst->a].type == Int && ir->insts[inst->b].type == Int)
+                    range[i] = ir_range_of(inst->op, range[inst->a], range[inst->b]);
+                break;
+            case IRStore:
+                if(ir->insts[inst->a].type == Int)
+                    range[i] = range[inst->a];
+                break;
+            default:
+                break;
+        }
+        if(inst->op == IRStore || inst->op == IRPhi)
+            current[inst->sym] = i;
+    }
+    releaseHeap(current);
+}
+
+/********************************************************
+  Code generation from the IR
+  A value is printed at the place it is used, like the AST emitter does.
+  A value used more than once is stored in a spare register (A-Z) the
+  first time it is computed and loaded from there afterwards.
+  A loop keeps the registers of values computed before it until it ends,
+  the values ir_licm moved in front of it are computed there, and every
+  iteration starts and ends at precision 0.
+ *********************************************************/
+typedef struct{
+    IRProgram *ir;
+    FILE *target;
+    int *uses;          /* remaining uses of every value */
+    char *reg;          /* register holding the value, 0 if none */
+    bool freeReg[26];
+    bool precision;     /* a 5k has run since the last 0 k */
+    int *end;           /* the IREndLoop of every IRLoop */
+    int loops[MaxLoopDepth + 1];    /* the IRLoops printed and not ended, outermost first */
+    unsigned held[MaxLoopDepth + 1];/* registers freed inside them, free again when they end */
+    int depth;
+}IREmitter;
+
+static void ir_free_register( IREmitter *em, int t )
+{
+    int d;
+
+    for(d = 0; d < em->depth && em->loops[d] < t; d++);
+    if(d < em->depth)/* the next iteration loads it again */
+        em->held[d] |= 1u << (em->reg[t] - 'A');
+    else
+        em->freeReg[em->reg[t] - 'A'] = true;
+}
+
+static void ir_fprint_value( IREmitter *em, int t );
+
+/* print the computation of t, false if t is a constant or a load, which are never kept in registers */
+static bool ir_fprint_computation( IREmitter *em, int t )
+{
+    IRInst *inst = &em->ir->insts[t];
+
+    switch(inst->op){
+        case IRConstInt:
+            fprint_int(em->target, inst->imm.ivalue);
+            return false;
+        case IRConstFloat:
+            fprint_float(em->target, inst->imm.fvalue, inst->scale);
+            return false;
+        case IRLoad:
+            fprintf(em->target, "l%s\n", em->ir->syms[inst->sym].name);
+            return false;
+        case IRIntToFloat:
+            ir_fprint_value(em, inst->a);
+            fprintf(em->target, "5k\n");
+            em->precision = true;
+            return true;
+        case IRAdd:
+        case IRSub:
+        case IRMul:
+        case IRDiv:
+            ir_fprint_value(em, inst->a);
+            ir_fprint_value(em, inst->b);
+            fprint_op(em->target, inst->op == IRAdd ? PlusNode : inst->op == IRSub ? MinusNode :
+                    inst->op == IRMul ? MulNode : DivNode);
+            return true;
+        default:
+            fprintf(em->target, "Error in ir_fprint_value op = %d\n", inst->op);
+            return false;
+    }
+}
+
+static void ir_fprint_value( IREmitter *em, int t )
+{
+    IRInst *inst = &em->ir->insts[t];
+    int i;
+
+    if(em->reg[t]){
+        fprintf(em->target, "l%c\n", em->reg[t]);
+        if(inst->setsPrecision && !em->precision){/* the computation it replaces would have run 5k */
+            fprintf(em->target, "5k\n");
+            em->precision = true;
+        }
+        if(--em->uses[t] == 0)
+            ir_free_register(em, t);
+        return;
+    }
+
+    if(!ir_fprint_computation(em, t))
+        return;
+
+    if(em->uses[t] > 1){
+        for(i = 0; i < 26 && !em->freeReg[i]; i++);
+        if(i < 26){
+            em->freeReg[i] = false;
+            em->reg[t] = 'A' + i;
+            em->uses[t]--;
+            fprintf(em->target, "d\ns%c\n", em->reg[t]);
+        }
+    }
+}
+
+static int compareIndex( const void *a, const void *b )
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* the loop starting at instruction s: what moved in front of it goes to registers, then the loop opens */
+static void ir_fprint_loop( IREmitter *em, int s, int *moved )
+{
+    IRInst *inst;
+    int n = 0, i, j, operand;
+
+    for(i = s + 1; i < em->end[s]; i++)
+        for(j = 0; j < 2; j++){
+            operand = j == 0 ? em->ir->insts[i].a : em->ir->insts[i].b;
+            if(operand >= 0 && operand < s && !em->reg[operand] && ir_hoistable(&em->ir->insts[operand])){
+                em->reg[operand] = '?';/* counted once */
+                moved[n++] = operand;
+            }
+        }
+    qsort(moved, n, sizeof(int), compareIndex);
+    for(i = 0; i < n; i++)
+        em->reg[moved[i]] = 0;
+    for(i = 0; i < n; i++){
+        for(j = 0; j < 26 && !em->freeReg[j]; j++);
+        if(j == 26)/* computed where it is used */
+            break;
+        em->freeReg[j] = false;
+        ir_fprint_computation(em, moved[i]);
+        em->reg[moved[i]] = 'A' + j;
+        fprintf(em->target, "s%c\n", em->reg[moved[i]]);
+    }
+
+    if(em->precision){
+        fprintf(em->target, "0 k\n");
+        em->precision = false;
+    }
+    inst = &em->ir->insts[s];
+    fprint_int(em->target, inst->imm.ivalue);
+    fprintf(em->target, "s%c\n[\n", LoopCounter(inst->version));
+    if(em->depth <= MaxLoopDepth){
+        em->loops[em->depth] = s;
+        em->held[em->depth++] = 0;
+    }
+}
+
+static void ir_fprint_end_loop( IREmitter *em, int e )
+{
+    int i;
+
+    if(em->precision){
+        fprintf(em->target, "0 k\n");
+        em->precision = false;
+    }
+    fprint_repeat_end(em->target, LoopCounter(em->ir->insts[e].version), LoopMacro(em->ir->insts[e].version));
+    if(em->depth > 0){
+        em->depth--;
+        for(i = 0; i < 26; i++)
+            if(em->held[em->depth] & (1u << i))
+                em->freeReg[i] = true;
+    }
+}
+
+void ir_gencode( IRProgram *ir, FILE *target )
+{
+    IREmitter em;
+    IRInst *inst;
+    int *moved, stack[MaxLoopDepth + 1], depth = 0, i;
+
+    em.ir = ir;
+    em.target = target;
+    em.uses = allocateHeap((ir->count + 1) * sizeof(int));
+    em.reg = allocateHeap((ir->count + 1) * sizeof(char));
+    em.end = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    moved = reallocateHeap(NULL, (ir->count + 1) * sizeof(int));
+    em.precision = false;
+    em.depth = 0;
+    for(i = 0; i < 26; i++)
+        em.freeReg[i] = true;
+    for(i = 0; i < ir->symCount; i++)/* the variables of ir_strength */
+        if(ir->syms[i].name[0] >= 'A' && ir->syms[i].name[0] <= 'Z')
+            em.freeReg[ir->syms[i].name[0] - 'A'] = false;
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        if(inst->op == IRNop) continue;
+        if(inst->a >= 0) em.uses[inst->a]++;
+        if(inst->b >= 0) em.uses[inst->b]++;
+        em.end[i] = ir->count;
+        if(inst->op == IRLoop || inst->op == IREndLoop){
+            em.freeReg[LoopCounter(inst->version) - 'A'] = false;
+            em.freeReg[LoopMacro(inst->version) - 'A'] = false;
+        }
+        if(inst->op == IRLoop && depth <= MaxLoopDepth)
+            stack[depth++] = i;
+        else if(inst->op == IREndLoop && depth > 0)
+            em.end[stack[--depth]] = i;
+    }
+
+    for(i = 0; i < ir->count; i++){
+        inst = &ir->insts[i];
+        switch(inst->op){
+            case IRStore:
+                ir_fprint_value(&em, inst->a);
+                fprintf(target, "s%s\n", ir->syms[inst->sym].name);
+                fprintf(target, "0 k\n");
+                em.precision = false;
+                break;
+            case IRPrint:
+                ir_fprint_value(&em, inst->a);
+                fprintf(target, "p\n");
+                break;
+            case IRLoop:
+                ir_fprint_loop(&em, i, moved);
+                break;
+            case IREndLoop:
+                ir_fprint_end_loop(&em, i);
+                break;
+            default:
+                break;
+        }
+    }
+    releaseHeap(em.uses);
+    releaseHeap(em.reg);
+    releaseHeap(em.end);
+    releaseHeap(moved);
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "header.h"
+#include "acdc.h"
+
+/*
+   libacdc, the compiler as a library, see acdc.h.
+
+   A call compiles on the caller's thread under a Context of its own, so
+   an error returns from acdc_compile instead of ending the process, and
+   calls on different threads never meet. The tree and the symbol table
+   are allocated in an arena that goes when the call returns, also when
+   the source had a syntax error half way through the tree.
+*/
+
+#define ArenaBlockSize (64 * 1024)
+
+/****  Arenas ****/
+
+/* the arena of the compilation running on this thread, NULL when there is none */
+static __thread Arena *arena;
+
+void InitializeArena( Arena *a )
+{
+    a->blocks = NULL;
+}
+
+void FreeArena( Arena *a )
+{
+    ArenaBlock *next;
+
+    while(a->blocks != NULL){
+        next = a->blocks->next;
+        releaseHeap(a->blocks);
+        a->blocks = next;
+    }
+}
+
+void useArena( Arena *a )
+{
+    arena = a;
+}
+
+/*
+   zeroed memory for site, the function that asks, see the allocate macro;
+   in an arena every piece is led by its size, so reallocate knows what to copy
+*/
+void *allocateAt( size_t size, const char *site )
+{
+    ArenaBlock *block;
+    size_t need, blockSize;
+    char *p;
+
+    if(arena == NULL)
+        return tracing ? traceAllocate(NULL, size, site, true) : calloc(1, size);
+    if(tracing)
+        tracePiece(size, site);
+    need = 16 + ((size + 15) & ~(size_t)15);
+    block = arena->blocks;
+    if(block == NULL || block->used + need > block->size){
+        blockSize = need > ArenaBlockSize ? need : ArenaBlockSize;
+        block = tracing ? traceAllocate(NULL, sizeof(ArenaBlock) + blockSize, "arena", true)
+                        : calloc(1, sizeof(ArenaBlock) + blockSize);
+        block->size = blockSize;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    p = block->data + block->used;
+    block->used += need;
+    *(size_t *)p = size;
+    return p + 16;
+}
+
+void *reallocateAt( void *p, size_t size, const char *site )
+{
+    size_t old;
+    void *q;
+
+    if(arena == NULL)
+        return tracing ? traceAllocate(p, size, site, false) : realloc(p, size);
+    if(p == NULL)
+        return allocateAt(size, site);
+    old = *(size_t *)((char *)p - 16);
+    if(size <= old)
+        return p;
+    q = allocateAt(size, site);
+    memcpy(q, p, old);
+    return q;
+}
+
+/* in an arena nothing is given back before the arena goes */
+void release( void *p )
+{
+    if(arena == NULL)
+        releaseHeap(p);
+}
+
+/* calloc outside any arena, for what is freed before the compilation ends, like the IR */
+void *allocateHeapAt( size_t size, const char *site )
+{
+    return tracing ? traceAllocate(NULL, size, site, true) : calloc(1, size);
+}
+
+/* and realloc */
+void *reallocateHeapAt( void *p, size_t size, const char *site )
+{
+    return tracing ? traceAllocate(p, size, site, false) : realloc(p, size);
+}
+
+void releaseHeap( void *p )
+{
+    if(tracing)
+        traceRelease(p);
+    else
+        free(p);
+}
+
+
+
+
+/****  Library ****/
+
+int acdc_compile( const char *src, size_t len, acdc_output *out, const acdc_options *options )
+{
+    Options opt;
+    Context ctx;
+    Arena a;
+    FILE *target;
+    int status;
+
+    memset(&opt, 0, sizeof(opt));
+    opt.optimize = options ? options->optimize : 1;
+    opt.factor = options ? options->macros != 0 : false;
+    opt.jobs = 1;
+    memset(out, 0, sizeof(acdc_output));
+    if(opt.optimize < 0 || opt.optimize > 2)
+        return 2;
+    useCounting(&opt);/* none, the counters of the command line are not the caller's */
+
+    ctx.diag = open_memstream(&out->diag, &out->diag_length);
+    target = open_memstream(&out->code, &out->code_length);
+    InitializeArena(&a);
+    useArena(&a);
+    status = compileText(&ctx, src, len, target, &opt);
+    useArena(NULL);
+    FreeArena(&a);
+    fclose(ctx.diag);
+    fclose(target);
+    if(status != 0){/* like the target file, empty after an error */
+        out->code[0] = '\0';
+        out->code_length = 0;
+    }
+    return status;
+}
+
+void acdc_free_output( acdc_output *out )
+{
+    free(out->code);
+    free(out->diag);
+    memset(out, 0, sizeof(acdc_output));
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "header.h"
+
+/*
+   The AcDc command line. The compiler itself is the library in the other
+   files, see acdc.h for the interface meant for embedding.
+*/
+
+int main( int argc, char *argv[] )
+{
+    Context ctx;
+    Options opt;
+    Batch batch;
+    Cache cache;
+    Stats counters;
+    Trace trace;
+    char *files[2], *cacheDir = NULL, *unit, *binding;
+    long cacheSize = 64L << 20;
+    int i, nfiles = 0, status = 0;
+
+    opt.factor = false;
+    opt.optimize = 1;
+    opt.jobs = 1;
+    opt.manifest = NULL;
+    opt.pipeline = false;
+    opt.socket = NULL;
+    opt.edits = NULL;
+    opt.image = false;
+    opt.eval = NULL;
+    opt.bindings = NULL;
+    opt.bindingCount = 0;
+    opt.stats = NULL;
+    opt.trace = NULL;
+    memset(&batch, 0, sizeof(batch));
+    for(i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--macros") == 0)
+            opt.factor = true;
+        else if(strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '2' && argv[i][3] == '\0')
+            opt.optimize = argv[i][2] - '0';
+        else if(strncmp(argv[i], "-j", 2) == 0 && (argv[i][2] != '\0' || i + 1 < argc))
+            opt.jobs = atoi(argv[i][2] != '\0' ? argv[i] + 2 : argv[++i]);
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            opt.manifest = argv[++i];
+        else if(strcmp(argv[i], "--pipeline") == 0)
+            opt.pipeline = true;
+        else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            opt.socket = argv[++i];
+        else if(strcmp(argv[i], "--emit=image") == 0 || strcmp(argv[i], "--emit=dc") == 0)
+            opt.image = (argv[i][7] == 'i');
+        else if(strcmp(argv[i], "--eval") == 0 && i + 1 < argc)
+            opt.eval = argv[++i];
+        else if(strncmp(argv[i], "-D", 2) == 0 && (argv[i][2] != '\0' || i + 1 < argc)){
+            binding = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+            if(!addBinding(&opt, binding)){
+                printf("bad binding : %s\n", binding);
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--bindings") == 0 && i + 1 < argc){
+            if(!readBindings(&opt, argv[++i])){
+                printf("bad bindings file : %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if(strcmp(argv[i], "--stats") == 0){
+            memset(&counters, 0, sizeof(counters));
+            opt.stats = &counters;
+        }
+        else if(strcmp(argv[i], "--trace-alloc") == 0){
+            InitializeTrace(&trace);
+            opt.trace = &trace;
+            signal(SIGUSR1, requestTrace);
+        }
+        else if(strcmp(argv[i], "--edits") == 0 && i + 1 < argc)
+            opt.edits = argv[++i];
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if(strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc){/* bytes, or with a K, M or G suffix */
+            cacheSize = strtol(argv[++i], &unit, 10);
+            if(*unit == 'K' || *unit == 'k')
+                cacheSize <<= 10;
+            else if(*unit == 'M' || *unit == 'm')
+                cacheSize <<= 20;
+            else if(*unit == 'G' || *unit == 'g')
+                cacheSize <<= 30;
+        }
+        else if(strchr(argv[i], ':') != NULL){/* source:target pair */
+            char *pair = argv[i], *colon = strrchr(pair, ':');
+            *colon = '\0';
+            addJob(&batch, pair, colon + 1);
+        }
+        else if(nfiles < 2)
+            files[nfiles++] = argv[i];
+        else
+            nfiles = 3;
+    }
+    if(opt.jobs < 1)
+        opt.jobs = 1;
+    opt.cache = NULL;
+    if(cacheDir != NULL){
+        InitializeCache(&cache, cacheDir, cacheSize);
+        opt.cache = &cache;
+    }
+    useCounting(&opt);
+
+    if( opt.socket != NULL && opt.manifest == NULL && batch.count == 0 && nfiles == 0 )
+        status = serve(&opt);
+    else if( (opt.manifest != NULL || batch.count > 0) && nfiles == 0 ){
+        if(opt.manifest != NULL)
+            readManifest(&batch, opt.manifest);
+        batch.opt = &opt;
+        status = runBatch(&batch);
+    }
+    else if( nfiles == 2 && batch.count == 0 ){
+        ctx.diag = stdout;
+        if(opt.eval != NULL)
+            status = evaluate(&ctx, files[0], files[1], &opt);
+        else if(opt.edits != NULL)
+            status = compileEdits(&ctx, files[0], files[1], &opt);
+        else
+            status = compile(&ctx, files[0], files[1], &opt);
+    }
+    else{
+        printf("Usage: %s [-O0|-O1|-O2] [--macros] [-D name=value ...] [--bindings file] [-j N | --pipeline] [--cache dir [--cache-size N[K|M|G]]] [--emit=dc|image] [--stats] [--trace-alloc] source_file target_file\n", argv[0]);
+        printf("       %s [-O0|-O1|-O2] [--macros] [-j N] [--cache dir] [--stats] [--trace-alloc] [--batch manifest] [source_file:target_file ...]\n", argv[0]);
+        printf("       %s [-O0|-O1|-O2] [--macros] --edits edit_file source_file target_file\n", argv[0]);
+        printf("       %s [-O0|-O1|-O2] [--macros] [--cache dir] --serve socket_path\n", argv[0]);
+        printf("       %s [-O0|-O1|-O2] [-j N] --eval data.csv|var=file,... source_file target_file\n", argv[0]);
+    }
+
+    if(opt.cache != NULL)
+        cache_evict(opt.cache);
+    if(opt.stats != NULL)
+        writeStats(stderr, opt.stats);
+    if(opt.trace != NULL)
+        writeTrace(stderr, opt.trace);
+    return status;
+}
+
+
+/*********************************************
+  Batch compilation
+ *********************************************/
+void addJob( Batch *batch, char *source, char *target )
+{
+    Job *job;
+
+    if(batch->count == batch->capacity){
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->jobs = realloc(batch->jobs, batch->capacity * sizeof(Job));
+    }
+    job = &batch->jobs[batch->count++];
+    memset(job, 0, sizeof(Job));
+    job->source = source;
+    job->target = target;
+}
+
+/* every non empty line is "source_file target_file" */
+void readManifest( Batch *batch, char *manifest )
+{
+    FILE *file = fopen(manifest, "r");
+    char *line = NULL, *source, *target, *save;
+    size_t size = 0;
+
+    if(!file){
+        printf("can't open the manifest %s\n", manifest);
+        exit(2);
+    }
+    while(getline(&line, &size, file) != -1){
+        source = strtok_r(line, " \t\r\n", &save);
+        target = strtok_r(NULL, " \t\r\n", &save);
+        if(source == NULL)
+            continue;
+        if(target == NULL){
+            printf("manifest %s : no target file for %s\n", manifest, source);
+            exit(2);
+        }
+        addJob(batch, strdup(source), strdup(target));
+    }
+    free(line);
+    fclose(file);
+}
+
+void *batchWorker( void *arg )
+{
+    Batch *batch = arg;
+    Context ctx;
+    Options opt = *batch->opt;
+    Job *job;
+    FILE *log;
+    int i;
+
+    opt.jobs = 1;/* the pool already keeps every core busy */
+    opt.pipeline = false;
+    useCounting(&opt);
+
+    while(1){
+        pthread_mutex_lock(&batch->lock);
+        i = batch->next < batch->count ? batch->next++ : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if(i < 0)
+            return NULL;
+
+        job = &batch->jobs[i];
+        log = open_memstream(&job->log, &job->logLength);
+        ctx.diag = log;
+        job->status = compile(&ctx, job->source, job->target, &opt);
+        if(job->status != 0)
+            fprintf(log, "%s : compilation failed\n", job->source);
+        fclose(log);
+
+        /* logs come out in job order whichever worker finishes first */
+        pthread_mutex_lock(&batch->lock);
+        job->done = true;
+        if(job->status > batch->status)
+            batch->status = job->status;
+        while(batch->flushed < batch->count && batch->jobs[batch->flushed].done){
+            job = &batch->jobs[batch->flushed++];
+            fwrite(job->log, 1, job->logLength, stdout);
+            free(job->log);
+            job->log = NULL;
+        }
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+int runBatch( Batch *batch )
+{
+    pthread_t *workers;
+    int i, n = batch->opt->jobs;
+
+    if(n > batch->count)
+        n = batch->count > 0 ? batch->count : 1;
+    pthread_mutex_init(&batch->lock, NULL);
+    workers = malloc(n * sizeof(pthread_t));
+    for(i = 0; i < n; i++)
+        pthread_create(&workers[i], NULL, batchWorker, batch);
+    for(i = 0; i < n; i++)
+        pthread_join(workers[i], NULL);
+    fflush(stdout);
+    free(workers);
+    pthread_mutex_destroy(&batch->lock);
+    return batch->status;
+}
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "header.h"
+
+/*
+   Decimal numbers of any size, the arithmetic of dc.
+
+   A Number is a magnitude, a sign and a scale, the count of its digits
+   after the point. dc computes + and - exactly at the larger scale of
+   the operands, * at min(sa + sb, max(k, sa, sb)) and / at k, the
+   precision set by the last k command, and drops the digits past the
+   scale. Folding with the same rules gives the constant dc would have
+   computed at run time.
+
+   The magnitude is kept in limbs of nine decimal digits, least
+   significant first, so scaling by a power of ten moves whole limbs.
+   Up to NumberInline limbs, every 64 bit value, are stored in the Number
+   itself and the constants of a program are folded without allocating;
+   longer values go to the heap, which FreeNumber releases. Operands
+   that fit in 64 bits take a shortcut through machine arithmetic.
+
+   The result of an operation must not be one of its operands.
+*/
+
+#define LimbBase 1000000000u
+#define LimbDigits 9
+#define Limbs(n) ((n)->capacity ? (n)->heap : (n)->limbs)
+
+static const uint32_t power10[LimbDigits + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+void InitializeNumber( Number *n )
+{
+    memset(n, 0, sizeof(Number));
+}
+
+void FreeNumber( Number *n )
+{
+    free(n->heap);
+    InitializeNumber(n);
+}
+
+/* room for length limbs, the ones in use are kept */
+static uint32_t *reserve( Number *n, int length )
+{
+    uint32_t *heap;
+
+    if(length <= NumberInline && n->capacity == 0)
+        return n->limbs;
+    if(length <= n->capacity)
+        return n->heap;
+    heap = malloc(2 * length * sizeof(uint32_t));
+    memcpy(heap, Limbs(n), n->length * sizeof(uint32_t));
+    free(n->heap);
+    n->heap = heap;
+    n->capacity = 2 * length;
+    return heap;
+}
+
+/* drop the leading zero limbs, zero has no sign */
+static void trim( Number *n )
+{
+    const uint32_t *d = Limbs(n);
+
+    while(n->length > 0 && d[n->length - 1] == 0)
+        n->length--;
+    if(n->length == 0)
+        n->negative = false;
+}
+
+static void set_u64( Number *n, uint64_t u )
+{
+    uint32_t *d = reserve(n, 3);
+
+    for(n->length = 0; u != 0; u /= LimbBase)
+        d[n->length++] = u % LimbBase;
+}
+
+/* the magnitude, if it fits in 64 bits */
+static bool get_u64( const Number *n, uint64_t *u )
+{
+    const uint32_t *d = Limbs(n);
+    uint64_t value = 0;
+    int i;
+
+    if(n->length > 3)
+        return false;
+    for(i = n->length - 1; i >= 0; i--)
+        if(__builtin_mul_overflow(value, LimbBase, &value) || __builtin_add_overflow(value, d[i], &value))
+            return false;
+    *u = value;
+    return true;
+}
+
+/* n * m + add, m at most LimbBase and add below it */
+static void mul_add_small( Number *n, uint32_t m, uint32_t add )
+{
+    uint32_t *d = reserve(n, n->length + 1);
+    uint64_t carry = add;
+    int i;
+
+    for(i = 0; i < n->length; i++){
+        carry += (uint64_t)d[i] * m;
+        d[i] = carry % LimbBase;
+        carry /= LimbBase;
+    }
+    if(carry != 0)
+        d[n->length++] = carry;
+    trim(n);
+}
+
+/* n / m truncated, returns the remainder */
+static uint32_t div_small( Number *n, uint32_t m )
+{
+    uint32_t *d = Limbs(n);
+    uint64_t rest = 0;
+    int i;
+
+    for(i = n->length - 1; i >= 0; i--){
+        rest = rest * LimbBase + d[i];
+        d[i] = rest / m;
+        rest %= m;
+    }
+    trim(n);
+    return rest;
+}
+
+/* n * 10^digits */
+static void scale_up( Number *n, int digits )
+{
+    int limbs = digits / LimbDigits;
+    uint32_t *d;
+
+    if(n->length == 0)
+        return;
+    if(limbs > 0){
+        d = reserve(n, n->length + limbs);
+        memmove(d + limbs, d, n->length * sizeof(uint32_t));
+        memset(d, 0, limbs * sizeof(uint32_t));
+        n->length += limbs;
+    }
+    if(digits % LimbDigits != 0)
+        mul_add_small(n, power10[digits % LimbDigits], 0);
+}
+
+/* n / 10^digits, truncated */
+static void scale_down( Number *n, int digits )
+{
+    int limbs = digits / LimbDigits;
+    uint32_t *d = Limbs(n);
+
+    if(limbs >= n->length){
+        n->length = 0;
+        n->negative = false;
+        return;
+    }
+    if(limbs > 0){
+        memmove(d, d + limbs, (n->length - limbs) * sizeof(uint32_t));
+        n->length -= limbs;
+    }
+    if(digits % LimbDigits != 0)
+        div_small(n, power10[digits % LimbDigits]);
+}
+
+static int compare_magnitude( const Number *a, const Number *b )
+{
+    const uint32_t *x = Limbs(a), *y = Limbs(b);
+    int i;
+
+    if(a->length != b->length)
+        return a->length < b->length ? -1 : 1;
+    for(i = a->length - 1; i >= 0; i--)
+        if(x[i] != y[i])
+            return x[i] < y[i] ? -1 : 1;
+    return 0;
+}
+
+/****  Magnitudes, the limb by limb slow path ****/
+
+static void add_magnitude( Number *r, const Number *a, const Number *b )
+{
+    int length = a->length > b->length ? a->length : b->length, i;
+    uint32_t *d = reserve(r, length + 1), sum, carry = 0;
+    const uint32_t *x = Limbs(a), *y = Limbs(b);
+
+    for(i = 0; i < length; i++){
+        sum = carry + (i < a->length ? x[i] : 0) + (i < b->length ? y[i] : 0);
+        carry = sum >= LimbBase;
+        d[i] = carry ? sum - LimbBase : sum;
+    }
+    d[length] = carry;
+    r->length = length + 1;
+}
+
+/* |a| - |b| where |a| >= |b| */
+static void sub_magnitude( Number *r, const Number *a, const Number *b )
+{
+    uint32_t *d = reserve(r, a->length);
+    const uint32_t *x = Limbs(a), *y = Limbs(b);
+    int64_t diff;
+    int borrow = 0, i;
+
+    for(i = 0; i < a->length; i++){
+        diff = (int64_t)x[i] - borrow - (i < b->length ? y[i] : 0);
+        borrow = diff < 0;
+        d[i] = borrow ? diff + LimbBase : diff;
+    }
+    r->length = a->length;
+}
+
+static void mul_magnitude( Number *r, const Number *a, const Number *b )
+{
+    uint32_t *d = reserve(r, a->length + b->length);
+    const uint32_t *x = Limbs(a), *y = Limbs(b);
+    uint64_t carry;
+    int i, j;
+
+    memset(d, 0, (a->length + b->length) * sizeof(uint32_t));
+    for(i = 0; i < a->length; i++){
+        carry = 0;
+        for(j = 0; j < b->length; j++){
+            carry += d[i + j] + (uint64_t)x[i] * y[j];
+            d[i + j] = carry % LimbBase;
+            carry /= LimbBase;
+        }
+        d[i + b->length] = carry;
+    }
+    r->length = a->length + b->length;
+}
+
+/* |a| / |b| truncated, one limb of the quotient at a time by bisection */
+static void div_magnitude( Number *q, const Number *a, const Number *b )
+{
+    Number rest, product, spare, swap;
+    const uint32_t *x = Limbs(a);
+    uint32_t *d, low, high, mid;
+    int i;
+
+    if(b->length == 1){
+        number_copy(q, a);
+        div_small(q, Limbs(b)[0]);
+        return;
+    }
+    InitializeNumber(&rest);
+    InitializeNumber(&product);
+    InitializeNumber(&spare);
+    d = reserve(q, a->length);
+    q->length = a->length;
+    for(i = a->length - 1; i >= 0; i--){
+        mul_add_small(&rest, LimbBase, x[i]);
+        for(low = 0, high = LimbBase - 1; low < high; ){
+            mid = low + (high - low + 1) / 2;
+            number_copy(&product, b);
+            mul_add_small(&product, mid, 0);
+            if(compare_magnitude(&product, &rest) <= 0)
+                low = mid;
+            else
+                high = mid - 1;
+        }
+        if(low > 0){
+            number_copy(&product, b);
+            mul_add_small(&product, low, 0);
+            sub_magnitude(&spare, &rest, &product);
+            trim(&spare);
+            swap = rest;
+            rest = spare;
+            spare = swap;
+        }
+        d[i] = low;
+    }
+    FreeNumber(&rest);
+    FreeNumber(&product);
+    FreeNumber(&spare);
+}
+
+/****  Numbers ****/
+
+void number_copy( Number *r, const Number *a )
+{
+    uint32_t *d = reserve(r, a->length);
+
+    memcpy(d, Limbs(a), a->length * sizeof(uint32_t));
+    r->length = a->length;
+    r->negative = a->negative;
+    r->scale = a->scale;
+}
+
+void number_from_int( Number *n, int64_t value )
+{
+    set_u64(n, value < 0 ? 0 - (uint64_t)value : (uint64_t)value);
+    n->negative = value < 0;
+    n->scale = 0;
+}
+
+/* digits with an optional point and a leading _ or - */
+bool number_parse( Number *n, const char *text )
+{
+    const char *p = text + (*text == '_' || *text == '-');
+    bool digits = false;
+
+    n->length = 0;
+    n->scale = 0;
+    for(; *p >= '0' && *p <= '9'; p++, digits = true)
+        mul_add_small(n, 10, *p - '0');
+    if(*p == '.')
+        for(p++; *p >= '0' && *p <= '9'; p++, n->scale++, digits = true)
+            mul_add_small(n, 10, *p - '0');
+    n->negative = (*text == '_' || *text == '-');
+    trim(n);
+    return digits && *p == '\0';
+}
+
+/* n the way dc reads it, like snprintf the length is returned even if it does not fit in size */
+size_t number_text( const Number *n, char *buf, size_t size )
+{
+    const uint32_t *d = Limbs(n);
+    uint32_t top;
+    size_t length, i = 0;
+    int digits = 0, p;
+
+    if(n->length > 0)
+        for(digits = (n->length - 1) * LimbDigits, top = d[n->length - 1]; top != 0; top /= 10)
+            digits++;
+    if(digits < n->scale + 1)
+        digits = n->scale + 1;
+    length = n->negative + digits + (n->scale > 0);
+    if(length >= size)
+        return length;
+    if(n->negative)
+        buf[i++] = '_';
+    for(p = digits - 1; p >= 0; p--){
+        if(p == n->scale - 1)
+            buf[i++] = '.';
+        buf[i++] = '0' + (p / LimbDigits < n->length ? d[p / LimbDigits] / power10[p % LimbDigits] % 10 : 0);
+    }
+    buf[i] = '\0';
+    return length;
+}
+
+void number_add( Number *r, const Number *a, const Number *b )
+{
+    const Number *x = a, *y = b;
+    Number aligned;
+    uint64_t u, v;
+    int64_t sum;
+
+    InitializeNumber(&aligned);
+    if(a->scale != b->scale){/* the one with fewer digits after the point gets more */
+        number_copy(&aligned, a->scale < b->scale ? a : b);
+        scale_up(&aligned, abs(a->scale - b->scale));
+        aligned.scale = a->scale < b->scale ? b->scale : a->scale;
+        if(a->scale < b->scale)
+            x = &aligned;
+        else
+            y = &aligned;
+    }
+
+    if(get_u64(x, &u) && get_u64(y, &v) && u < 1ull << 62 && v < 1ull << 62){
+        sum = (x->negative ? -(int64_t)u : (int64_t)u) + (y->negative ? -(int64_t)v : (int64_t)v);
+        set_u64(r, sum < 0 ? 0 - (uint64_t)sum : (uint64_t)sum);
+        r->negative = sum < 0;
+    }
+    else if(x->negative == y->negative){
+        add_magnitude(r, x, y);
+        r->negative = x->negative;
+    }
+    else if(compare_magnitude(x, y) >= 0){
+        sub_magnitude(r, x, y);
+        r->negative = x->negative;
+    }
+    else{
+        sub_magnitude(r, y, x);
+        r->negative = y->negative;
+    }
+    r->scale = x->scale;
+    trim(r);
+    FreeNumber(&aligned);
+}
+
+void number_sub( Number *r, const Number *a, const Number *b )
+{
+    Number negated = *b;/* shares the limbs of b, which are only read */
+
+    negated.negative = b->length > 0 && !b->negative;
+    number_add(r, a, &negated);
+}
+
+void number_mul( Number *r, const Number *a, const Number *b, int precision )
+{
+    int scale = a->scale > b->scale ? a->scale : b->scale;
+    uint64_t u, v, w;
+
+    if(precision > scale)
+        scale = precision;
+    if(scale > a->scale + b->scale)
+        scale = a->scale + b->scale;
+
+    if(get_u64(a, &u) && get_u64(b, &v) && !__builtin_mul_overflow(u, v, &w))
+        set_u64(r, w);
+    else
+        mul_magnitude(r, a, b);
+    r->negative = a->negative != b->negative;
+    r->scale = a->scale + b->scale;
+    if(scale < r->scale){
+        scale_down(r, r->scale - scale);
+        r->scale = scale;
+    }
+    trim(r);
+}
+
+/* false for a division by zero, which dc refuses */
+bool number_div( Number *r, const Number *a, const Number *b, int precision )
+{
+    Number x, y;
+    uint64_t u, v;
+
+    if(b->length == 0)
+        return false;
+    InitializeNumber(&x);
+    InitializeNumber(&y);
+    number_copy(&x, a);
+    scale_up(&x, precision + b->scale);
+    number_copy(&y, b);
+    scale_up(&y, a->scale);
+    if(get_u64(&x, &u) && get_u64(&y, &v))
+        set_u64(r, u / v);
+    else
+        div_magnitude(r, &x, &y);
+    r->negative = a->negative != b->negative;
+    r->scale = precision;
+    trim(r);
+    FreeNumber(&x);
+    FreeNumber(&y);
+    return true;
+}
+
+/* the int constant that is n, false if n has a fraction or does not fit */
+bool number_to_int( const Number *n, int *value )
+{
+    uint64_t u;
+
+    if(n->scale != 0 || !get_u64(n, &u) || u > (n->negative ? (uint64_t)INT_MAX + 1 : (uint64_t)INT_MAX))
+        return false;
+    *value = n->negative ? (int)-(int64_t)u : (int)u;
+    return true;
+}
+
+/* the text of a float constant, as fprint_float prints it */
+static void float_text( char *buf, size_t size, float value, int scale )
+{
+    if(value < 0)
+        snprintf(buf, size, "_%.*f", scale, -value);
+    else
+        snprintf(buf, size, "%.*f", scale, value);
+}
+
+/* the number dc reads for a float constant, false if it is not a number */
+bool number_from_float( Number *n, float value, int scale )
+{
+    char text[64];
+
+    float_text(text, sizeof(text), value, scale);
+    return number_parse(n, text);
+}
+
+/* the float constant that prints as n, with its scale; false if there is none */
+bool number_to_float( const Number *n, float *value, int *scale )
+{
+    char text[64], printed[64];
+    float f;
+
+    if(n->scale > MaxFloatScale || number_text(n, text, sizeof(text)) >= sizeof(text))
+        return false;
+    if(text[0] == '_')
+        text[0] = '-';
+    f = strtof(text, NULL);
+    float_text(printed, sizeof(printed), f, n->scale);
+    if(printed[0] == '_')
+        printed[0] = '-';
+    if(strcmp(printed, text) != 0)
+        return false;
+    *value = f;
+    *scale = n->scale;
+    return true;
+}
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "header.h"
+
+/*
+   Compile server, AcDc --serve PATH.
+
+   Clients connect to the Unix socket at PATH and send any number of
+   requests, each a line "LEN [-O0|-O1|-O2] [--macros]" and then LEN bytes
+   of AC source. Every request is answered with a line
+   "STATUS CODELEN DIAGLEN" and then the dc code and the messages the
+   compiler printed; STATUS is the exit status AcDc would have returned,
+   and there is no code when it is not 0.
+
+   Each connection has its own thread. The source, the tree and the
+   symbol table of a request are allocated in an arena that is dropped
+   in one piece when the answer is written, also when the request ended
+   in a syntax error half way through the tree.
+*/
+
+#define MaxRequest (64L << 20)
+
+/****  Requests ****/
+
+/* "LEN [-O0|-O1|-O2] [--macros]", the options start from the server's own */
+bool parseRequest( char *header, size_t *len, Options *opt )
+{
+    char *word, *rest, *end;
+
+    word = strtok_r(header, " \t\r\n", &rest);
+    if(word == NULL)
+        return false;
+    *len = strtoul(word, &end, 10);
+    if(*end != '\0' || *len > MaxRequest)
+        return false;
+    while((word = strtok_r(NULL, " \t\r\n", &rest)) != NULL){
+        if(strncmp(word, "-O", 2) == 0 && word[2] >= '0' && word[2] <= '2' && word[3] == '\0')
+            opt->optimize = word[2] - '0';
+        else if(strcmp(word, "--macros") == 0)
+            opt->factor = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+void *serveConnection( void *arg )
+{
+    Connection *conn = arg;
+    FILE *in = fdopen(conn->fd, "r"), *out = fdopen(dup(conn->fd), "w"), *target;
+    char header[256], *text, *code, *diag;
+    size_t len, codeLength, diagLength;
+    Options opt;
+    Context ctx;
+    Arena a;
+    int status;
+
+    useCounting(conn->opt);
+    while(fgets(header, sizeof(header), in) != NULL){
+        opt = *conn->opt;
+        if(!parseRequest(header, &len, &opt)){
+            fprintf(out, "2 0 12\nbad request\n");
+            break;
+        }
+        InitializeArena(&a);
+        useArena(&a);
+        text = allocate(len + 1);
+        if(fread(text, 1, len, in) != len){
+            useArena(NULL);
+            FreeArena(&a);
+            break;
+        }
+
+        ctx.diag = open_memstream(&diag, &diagLength);
+        target = open_memstream(&code, &codeLength);
+        status = compileText(&ctx, text, len, target, &opt);
+        fclose(ctx.diag);
+        fclose(target);
+        useArena(NULL);
+        FreeArena(&a);
+
+        if(status != 0)/* like the target file, empty after an error */
+            codeLength = 0;
+        fprintf(out, "%d %zu %zu\n", status, codeLength, diagLength);
+        fwrite(code, 1, codeLength, out);
+        fwrite(diag, 1, diagLength, out);
+        free(code);
+        free(diag);
+        if(fflush(out) != 0)
+            break;
+        if(opt.cache != NULL)
+            cache_evict(opt.cache);
+    }
+
+    fclose(in);
+    fclose(out);
+    free(conn);
+    return NULL;
+}
+
+/* accept clients until the socket fails, returns the exit status */
+int serve( Options *opt )
+{
+    struct sockaddr_un addr;
+    Connection *conn;
+    pthread_t tid;
+    int listener, fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(opt->socket) >= sizeof(addr.sun_path)){
+        printf("socket path too long : %s\n", opt->socket);
+        return 2;
+    }
+    strcpy(addr.sun_path, opt->socket);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(opt->socket);
+    if(listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0){
+        printf("can't listen on %s\n", opt->socket);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);/* a client that hangs up ends its connection, not the server */
+
+    /* requests run on the connection's thread, start to end */
+    opt->jobs = 1;
+    opt->pipeline = false;
+    for(;;){
+        fd = accept(listener, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        conn = malloc(sizeof(Connection));
+        conn->fd = fd;
+        conn->opt = opt;
+        if(pthread_create(&tid, NULL, serveConnection, conn) != 0){
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(listener);
+    return 2;
+}
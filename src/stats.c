@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "header.h"
+
+/*
+   --stats: what the compiler did, printed as one line of JSON on stderr
+   when AcDc exits, so it can go into logs as it is.
+
+   The counters are in the Options of the compilations, the command line
+   has one set for everything it compiles, in batch mode the sum of all
+   programs. A thread counts into the ones of the compilation it runs,
+   see useCounting, and the threads started for a phase into the ones of
+   the thread that started them, see joinPhase. Threads count at the same
+   time, so the counters are atomic; without --stats stats is NULL and
+   nothing is counted.
+   A phase is timed on the wall clock and on the cpu time of the whole
+   process, so with -j the cpu time of a phase includes its workers.
+*/
+
+__thread Stats *stats;
+
+const char *phaseNames[PhaseCount] = {
+    "read", "parse", "build", "check", "lower", "passes", "emit", "macros", "pipeline", "cached"
+};
+static const char *nodeName[ProductNode + 1] = {
+    "Identifier", "IntConst", "FloatConst", "PlusNode", "MinusNode", "MulNode", "DivNode",
+    "IntToFloatConvertNode", "SumNode", "ProductNode"
+};
+
+static long long clockNs( clockid_t id )
+{
+    struct timespec t;
+
+    clock_gettime(id, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+void startPhase( Phase phase, PhaseClock *clock )
+{
+    clock->phase = phase;
+    if(tracing)
+        clock->outer = traceStartPhase(phase);
+    if(stats == NULL)
+        return;
+    clock->wall = clockNs(CLOCK_MONOTONIC);
+    clock->cpu = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* the time since the clock started goes to its phase */
+void endPhase( PhaseClock *clock )
+{
+    if(tracing)/* a phase run inside another one, like the backend of --cache, goes back to it */
+        traceEndPhase(clock->outer);
+    if(stats == NULL)
+        return;
+    atomic_fetch_add_explicit(&stats->wall[clock->phase], clockNs(CLOCK_MONOTONIC) - clock->wall, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->cpu[clock->phase], clockNs(CLOCK_PROCESS_CPUTIME_ID) - clock->cpu,
+                              memory_order_relaxed);
+}
+
+/* end the running phase and start the next one on the same clock */
+void nextPhase( Phase phase, PhaseClock *clock )
+{
+    endPhase(clock);
+    startPhase(phase, clock);
+}
+
+/* this thread counts what it compiles in the counters of opt, between phases */
+void useCounting( Options *opt )
+{
+    stats = opt->stats;
+    tracing = opt->trace;
+}
+
+/* what this thread counts in, for the threads it starts */
+Counting counting( void )
+{
+    Counting c;
+
+    c.stats = stats;
+    c.trace = tracing;
+    c.phase = tracing ? tracePhase() : -1;
+    return c;
+}
+
+/* a thread started for a phase counts where the thread that started it does, in its phase; its time is in the one of that thread, which waits for it */
+void joinPhase( const Counting *parent )
+{
+    stats = parent->stats;
+    tracing = parent->trace;
+    if(tracing)
+        traceStartPhase(parent->phase);
+}
+
+/* the lexer counts its own tokens, they are added up once it is done */
+void countTokens( Lexer *lex )
+{
+    countStat(tokens, lex->tokens);
+    lex->tokens = 0;
+}
+
+void countProbes( int probes )
+{
+    long longest;
+
+    if(stats == NULL)
+        return;
+    countStat(lookups, 1);
+    countStat(probes, probes);
+    longest = atomic_load_explicit(&stats->longestProbe, memory_order_relaxed);
+    while(probes > longest &&
+          !atomic_compare_exchange_weak_explicit(&stats->longestProbe, &longest, probes,
+                                                 memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static bool numberChar( char c )
+{
+    return (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+/* a number, or a command with its register, is one instruction; the brackets of a macro are not.
+   stdio writes the code in pieces that may end inside an instruction, so where it is stays in emitted */
+static ssize_t writeCounted( void *cookie, const char *code, size_t len )
+{
+    Emitted *emitted = cookie;
+    size_t i, written = fwrite(code, 1, len, emitted->target);
+    char c;
+
+    for(i = 0; i < written; i++){
+        c = code[i];
+        if(emitted->skip > 0){
+            emitted->skip--;
+            continue;
+        }
+        if(emitted->negation){
+            emitted->negation = false;
+            if(c == '<' || c == '>' || c == '='){
+                emitted->skip = 1;
+                continue;
+            }
+        }
+        if(emitted->number){
+            if(numberChar(c))
+                continue;
+            emitted->number = false;
+        }
+        if(c == ' ' || c == '\n' || c == '[' || c == ']')
+            continue;
+        emitted->instructions++;
+        if(numberChar(c))
+            emitted->number = true;
+        else if(c != '\0' && strchr("lsLS<>=", c) != NULL)
+            emitted->skip = 1;
+        else if(c == '!')
+            emitted->negation = true;
+    }
+    emitted->bytes += written;
+    return written;
+}
+
+/* the stream to write the dc code for target through, target itself without --stats */
+FILE *countingStream( FILE *target, Emitted *emitted )
+{
+    cookie_io_functions_t io = { NULL, writeCounted, NULL, NULL };
+    FILE *code;
+
+    memset(emitted, 0, sizeof(Emitted));
+    emitted->target = target;
+    if(stats == NULL || (code = fopencookie(emitted, "w", io)) == NULL)
+        return target;
+    return code;
+}
+
+/* done writing through code; what went through is counted if the code was written out, not for a compilation that failed */
+void countEmitted( FILE *code, Emitted *emitted, bool written )
+{
+    if(code == emitted->target)
+        return;
+    fclose(code);
+    if(!written)
+        return;
+    countStat(instructions, emitted->instructions);
+    countStat(emitted, emitted->bytes);
+}
+
+void writeStats( FILE *out, Stats *stats )
+{
+    int i;
+
+    fprintf(out, "{\"phases\": {");
+    for(i = 0; i < PhaseCount; i++)
+        fprintf(out, "%s\"%s\": {\"wall_ns\": %lld, \"cpu_ns\": %lld}", i ? ", " : "", phaseNames[i],
+                (long long)stats->wall[i], (long long)stats->cpu[i]);
+    fprintf(out, "}, \"tokens\": %ld, \"bytes_read\": %ld, \"nodes\": {", (long)stats->tokens, (long)stats->bytes);
+    for(i = 0; i <= ProductNode; i++)
+        fprintf(out, "%s\"%s\": %ld", i ? ", " : "", nodeName[i], (long)stats->nodes[i]);
+    fprintf(out, "}, \"lookups\": %ld, \"probes\": %ld, \"longest_probe\": %ld, \"folds\": %ld, "
+                 "\"conversions\": %ld, \"dc_instructions\": %ld, \"dc_bytes\": %ld}\n",
+            (long)stats->lookups, (long)stats->probes, (long)stats->longestProbe, (long)stats->folds,
+            (long)stats->conversions, (long)stats->instructions, (long)stats->emitted);
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "header.h"
+
+/*
+   --trace-alloc: where the memory of the compiler goes.
+
+   allocate, reallocate and release, the layer the tree, the statements
+   and the symbol table come from, and reallocateHeap and releaseHeap,
+   the one of the IR, pass every block through here. The block is led
+   by a TraceHeader with its size and the function that allocated it, so
+   its bytes count as live at that function until it is released. For
+   each function, and each phase of the compilation, the report has the
+   allocations, their bytes, and the most bytes live at once.
+
+   In an arena, which the library and the server compile in, a piece
+   is only counted at its function; the memory it lives in is the arena
+   block, allocated at "arena" and released with the arena.
+
+   A block is charged to the phase its thread was in when it was
+   allocated, so phases running at once on several threads each get
+   their own; its live bytes leave that phase when it is released,
+   whichever phase that happens in. The threads started for a phase,
+   the workers of -j and the stages of --pipeline, join it.
+
+   The counts are in the Trace of the Options, which every thread of the
+   compilations shares; a thread traces from the first allocation it
+   makes for them, see useCounting and joinPhase, so every block it
+   releases is one it traced.
+
+   The report is printed on stderr when AcDc exits, and also on SIGUSR1:
+   the signal only sets a flag, the next traced allocation prints it.
+*/
+
+__thread Trace *tracing;
+static __thread int phase = -1;             /* the phase of this thread, -1 between phases */
+static volatile sig_atomic_t requested;
+
+void InitializeTrace( Trace *trace )
+{
+    memset(trace, 0, sizeof(Trace));
+    pthread_mutex_init(&trace->lock, NULL);
+}
+
+/* the functions are told apart by their __func__, which is one string per function */
+static int site_index( Trace *trace, const char *site )
+{
+    int i;
+
+    for(i = 0; i < trace->siteCount; i++)
+        if(trace->sites[i].name == site)
+            return i;
+    if(trace->siteCount == MaxTraceSites)
+        return MaxTraceSites - 1;/* the last one takes in the rest */
+    trace->sites[trace->siteCount].name = trace->siteCount == MaxTraceSites - 1 ? "other" : site;
+    return trace->siteCount++;
+}
+
+static void count_live( TraceCount *count, long long change )
+{
+    count->live += change;
+    if(count->live > count->peak)
+        count->peak = count->live;
+}
+
+/* realloc of a traced block, or a new one when p is NULL; zero clears a new block */
+void *traceAllocate( void *p, size_t size, const char *site, bool zero )
+{
+    Trace *trace = tracing;
+    TraceHeader *header = p ? (TraceHeader *)p - 1 : NULL;
+    size_t old = header ? header->size : 0;
+    int oldSite = header ? header->site : 0, oldPhase = header ? header->phase : -1;
+
+    if(header == NULL && zero)
+        header = calloc(1, sizeof(TraceHeader) + size);
+    else
+        header = realloc(header, sizeof(TraceHeader) + size);
+    if(header == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&trace->lock);
+    if(p != NULL){
+        count_live(&trace->sites[oldSite], -(long long)old);
+        if(oldPhase >= 0)
+            count_live(&trace->phases[oldPhase], -(long long)old);
+        count_live(&trace->total, -(long long)old);
+    }
+    header->size = size;
+    header->site = site_index(trace, site);
+    header->phase = phase;
+    trace->sites[header->site].count++;
+    trace->sites[header->site].bytes += size;
+    count_live(&trace->sites[header->site], size);
+    if(phase >= 0){
+        trace->phases[phase].count++;
+        trace->phases[phase].bytes += size;
+        count_live(&trace->phases[phase], size);
+    }
+    trace->total.count++;
+    trace->total.bytes += size;
+    count_live(&trace->total, size);
+    pthread_mutex_unlock(&trace->lock);
+
+    if(requested){
+        requested = 0;
+        writeTrace(stderr, trace);
+    }
+    return header + 1;
+}
+
+/* a piece of an arena, counted at its function but not in the totals, which have the arena's blocks */
+void tracePiece( size_t size, const char *site )
+{
+    Trace *trace = tracing;
+    int i;
+
+    pthread_mutex_lock(&trace->lock);
+    i = site_index(trace, site);
+    trace->sites[i].count++;
+    trace->sites[i].bytes += size;
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void traceRelease( void *p )
+{
+    Trace *trace = tracing;
+    TraceHeader *header;
+
+    if(p == NULL)
+        return;
+    header = (TraceHeader *)p - 1;
+    pthread_mutex_lock(&trace->lock);
+    count_live(&trace->sites[header->site], -(long long)header->size);
+    if(header->phase >= 0)
+        count_live(&trace->phases[header->phase], -(long long)header->size);
+    count_live(&trace->total, -(long long)header->size);
+    pthread_mutex_unlock(&trace->lock);
+    free(header);
+}
+
+/* the phase the thread was in before comes back, it goes back to it at the end */
+int traceStartPhase( Phase started )
+{
+    int outer = phase;
+
+    phase = started;
+    return outer;
+}
+
+void traceEndPhase( int outer )
+{
+    phase = outer;
+}
+
+int tracePhase( void )
+{
+    return phase;
+}
+
+void requestTrace( int signal )
+{
+    (void)signal;
+    requested = 1;
+}
+
+static int compare_bytes( const void *a, const void *b )
+{
+    long long x = ((const TraceCount *)a)->bytes, y = ((const TraceCount *)b)->bytes;
+
+    return (x < y) - (x > y);
+}
+
+/* sites with the most bytes first */
+void writeTrace( FILE *out, Trace *trace )
+{
+    TraceCount sorted[MaxTraceSites], byPhase[PhaseCount], all;
+    int i, n;
+
+    pthread_mutex_lock(&trace->lock);
+    n = trace->siteCount;
+    memcpy(sorted, trace->sites, n * sizeof(TraceCount));
+    memcpy(byPhase, trace->phases, sizeof(byPhase));
+    all = trace->total;
+    pthread_mutex_unlock(&trace->lock);
+    qsort(sorted, n, sizeof(TraceCount), compare_bytes);
+
+    fprintf(out, "%-28s %12s %16s %16s %16s\n", "site", "allocations", "bytes", "live", "peak live");
+    for(i = 0; i < n; i++)
+        fprintf(out, "%-28s %12ld %16lld %16lld %16lld\n", sorted[i].name,
+                sorted[i].count, sorted[i].bytes, sorted[i].live, sorted[i].peak);
+    fprintf(out, "%-28s %12s %16s %16s %16s\n", "phase", "allocations", "bytes", "live", "peak live");
+    for(i = 0; i < PhaseCount; i++)
+        if(byPhase[i].count > 0)
+            fprintf(out, "%-28s %12ld %16lld %16lld %16lld\n", phaseNames[i],
+                    byPhase[i].count, byPhase[i].bytes, byPhase[i].live, byPhase[i].peak);
+    fprintf(out, "%-28s %12ld %16lld %16lld %16lld\n", "total", all.count, all.bytes, all.live, all.peak);
+}
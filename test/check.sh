@@ -0,0 +1,239 @@
+#!/bin/sh
+# make check: run from src once AcDc is built.
+# Every test/X.ac that has an X.out must print X.out through dc at -O0, -O1 and -O2.
+# Without dc the programs cannot be run, and only the checks that need no dc are made.
+
+tests=../test
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+# name, then the command; a failing command fails the check
+expect()
+{
+    name=$1
+    shift
+    if ! "$@"; then
+        echo "FAIL: $name"
+        failed=1
+    fi
+}
+
+# run dc code and compare what it prints with a .out
+prints()
+{
+    dc "$1" | cmp -s - "$2"
+}
+
+if command -v dc > /dev/null 2>&1; then
+    for expected in $tests/*.out; do
+        for level in 0 1 2; do
+            expect "${expected%.out}.ac at -O$level" ./AcDc -O$level "${expected%.out}.ac" $work/check.dc > /dev/null
+            expect "${expected%.out}.ac at -O$level prints ${expected##*/}" prints $work/check.dc "$expected"
+        done
+    done
+else
+    echo "dc not found, the test programs are not run"
+fi
+
+# constant folding: the sample of the README folds 3 + 1.0/2 at the 5k it runs at, an int * after it scales nothing
+for level in 0 1 2; do
+    ./AcDc -O$level $tests/sample.ac $work/sample.dc > /dev/null
+    expect "sample.ac at -O$level folds 3 + 1.0/2 into 3.50000" test "$(head -n 1 $work/sample.dc)" = "3.50000"
+done
+
+# repeat: loops nest 4 deep, counting in Y, W, U and S with their macros in Z, X, V and T; a fifth loop is an error
+registers()
+{
+    for register in Y Z W X U V S T; do
+        grep -q "s$register\$" "$1" || return 1
+    done
+}
+
+for level in 0 1 2; do
+    ./AcDc -O$level $tests/repeat.ac $work/repeat.dc > /dev/null
+    expect "repeat.ac at -O$level uses the registers of 4 loops" registers $work/repeat.dc
+done
+printf 'i a\nrepeat 1 {\nrepeat 1 {\nrepeat 1 {\nrepeat 1 {\nrepeat 1 {\na = 1\n}\n}\n}\n}\n}\n' > $work/deep.ac
+./AcDc $work/deep.ac $work/deep.dc > $work/deep.log
+expect "a fifth loop fails" test $? -eq 1
+expect "a fifth loop is nested too deep" grep -q "Loops nested too deep" $work/deep.log
+
+# -D and --bindings: a bound variable compiles like its constant written in its place, a value out of range is rejected
+printf 'i n\nf r\ni a\nf b\na = n * 3 + 1\nb = r * 2 + a\np a\np b\n' > $work/bound.ac
+sed 's/n \*/4 */; s/r \*/1.5 */' $work/bound.ac > $work/constants.ac
+printf '# sizes\n\nn=4\nr=1.5\n' > $work/bindings
+for level in 0 1 2; do
+    ./AcDc -O$level $work/constants.ac $work/constants.dc > /dev/null
+    expect "-D at -O$level" ./AcDc -O$level -D n=4 -Dr=1.5 $work/bound.ac $work/bound.dc > /dev/null
+    expect "-D at -O$level compiles the constants" cmp -s $work/bound.dc $work/constants.dc
+    expect "--bindings at -O$level" ./AcDc -O$level --bindings $work/bindings $work/bound.ac $work/bound.dc > /dev/null
+    expect "--bindings at -O$level compiles the constants" cmp -s $work/bound.dc $work/constants.dc
+done
+for binding in n=99999999999 n=-2147483649 r=1$(printf '%050d' 0).0 n=4x N=4 =4 n=; do
+    expect "-D $binding is a bad binding" test "$(./AcDc -D $binding $work/bound.ac $work/bound.dc)" = "bad binding : $binding"
+done
+printf 'n=4\nr=99999999999999999999999999999999999999999.0\n' > $work/bindings
+expect "a bindings file with a bad binding is rejected" \
+    test "$(./AcDc --bindings $work/bindings $work/bound.ac $work/bound.dc)" = "bad bindings file : $work/bindings"
+expect "a bound variable may not be assigned" sh -c "./AcDc -D a=1 $work/bound.ac $work/bound.dc | grep -q 'bound at compile time'"
+
+# --eval: a row with no columns bound computes what dc prints, the floats to single precision
+printf 'none\n0\n' > $work/row.csv
+evaluates()
+{
+    ./AcDc --eval $work/row.csv "$1" $work/row.out > /dev/null &&
+        tail -n 1 $work/row.out | tr ',' '\n' | paste -d ' ' "$2" - |
+        awk '{ d = $1 - $2; if(d < 0) d = -d; m = $1 < 0 ? -$1 : $1; if($2 == "" || d > 0.0001 * (m > 1 ? m : 1)) bad = 1 } END { exit bad }'
+}
+
+for expected in $tests/*.out; do
+    expect "${expected%.out}.ac evaluates to ${expected##*/}" evaluates "${expected%.out}.ac" "$expected"
+done
+
+# more declarations than the 46 slots the symbol table once had, where probing never ended; each one adds 1 to the last
+awk 'BEGIN {
+    letters = "abcdefghijklmnopqrstuvwxyz"
+    for(n = 0; n < 60; n++){
+        name = "v" substr(letters, int(n / 26) + 1, 1) substr(letters, n % 26 + 1, 1)
+        print "i " name
+        body = body name " = " (n ? last " + 1" : "1") "\n"
+        last = name
+    }
+    printf "%sp %s\n", body, last
+}' > $work/symbols.ac
+echo 60 > $work/symbols.out
+for level in 0 1 2; do
+    expect "60 declarations at -O$level" ./AcDc -O$level $work/symbols.ac $work/symbols.dc > /dev/null
+done
+expect "60 declarations evaluate" evaluates $work/symbols.ac $work/symbols.out
+
+# --emit=image: an image prints the dc code of its level and --eval runs it like the source
+printf 'n\n1\n-7\n2147483647\n' > $work/rows.csv
+for source in ../test/*.ac; do
+    for level in 0 1 2; do
+        ./AcDc -O$level $source $work/direct.dc > /dev/null
+        expect "${source##*/} image at -O$level" ./AcDc -O$level --emit=image $source $work/image.img > /dev/null
+        ./AcDc $work/image.img $work/image.dc
+        [ $level -eq 0 ] || expect "${source##*/} image at -O$level prints what -O$level does" cmp -s $work/image.dc $work/direct.dc
+        ./AcDc -O$level --eval $work/rows.csv $source $work/source.csv > /dev/null
+        expect "${source##*/} image at -O$level evaluates" ./AcDc --eval $work/rows.csv $work/image.img $work/image.csv
+        expect "${source##*/} image at -O$level evaluates like the source" cmp -s $work/image.csv $work/source.csv
+    done
+done
+
+# --cache: a second run reuses every fragment, an edited statement is the only new one
+fragments()
+{
+    find "$1" -mindepth 2 -type f | wc -l
+}
+
+./AcDc ../test/precision.ac $work/plain.dc > $work/plain.log
+expect "cache miss" ./AcDc --cache $work/cache ../test/precision.ac $work/miss.dc > $work/miss.log
+expect "cache miss prints what no cache does" cmp -s $work/miss.log $work/plain.log
+expect "cache miss writes what no cache does" cmp -s $work/miss.dc $work/plain.dc
+stored=$(fragments $work/cache)
+expect "cache hit" ./AcDc --cache $work/cache ../test/precision.ac $work/hit.dc > $work/hit.log
+expect "cache hit prints what no cache does" cmp -s $work/hit.log $work/plain.log
+expect "cache hit writes what no cache does" cmp -s $work/hit.dc $work/plain.dc
+expect "cache hit stores nothing" test "$(fragments $work/cache)" -eq "$stored"
+sed 's/^c = a \/ 4/c = a \/ 5/' ../test/precision.ac > $work/edited.ac
+expect "cache after an edit" ./AcDc --cache $work/cache $work/edited.ac $work/edited.dc > /dev/null
+expect "cache stores the edited statement only" test "$(fragments $work/cache)" -eq $((stored + 1))
+expect "cache size is the bytes of the fragments" \
+    test "$(cat $work/cache/size)" -eq "$(find $work/cache -mindepth 2 -type f -exec cat {} + | wc -c)"
+for source in ../test/*.ac; do
+    ./AcDc --cache $work/small --cache-size 1K $source $work/small.dc > /dev/null
+done
+expect "cache stays in its size" test "$(find $work/small -mindepth 2 -type f -exec cat {} + | wc -c)" -le 1024
+
+# --edits: what the last version compiles to, after an edit of a value, a syntax error and its repair, and a new declaration
+size=$(($(wc -c < ../test/precision.ac)))
+{
+    printf '16 17 1\n9'
+    printf '%d %d 2\n= ' $size $size
+    printf '%d %d 4\np a\n' $size $((size + 2))
+    printf '0 0 4\ni d\n'
+} > $work/edits
+{
+    printf 'i d\n'
+    sed 's/^a = 7$/a = 9/' ../test/precision.ac
+    printf 'p a\n'
+} > $work/edited.ac
+for options in "-O0" "-O1" "-O2 --macros"; do
+    ./AcDc $options $work/edited.ac $work/edited.dc > $work/edited.log
+    expect "edits $options" ./AcDc $options --edits $work/edits ../test/precision.ac $work/edits.dc > $work/edits.log
+    expect "edits $options print what compiling the last version does" cmp -s $work/edits.log $work/edited.log
+    expect "edits $options write what compiling the last version does" cmp -s $work/edits.dc $work/edited.dc
+done
+
+# --stats: the dc code is counted as it is written, in every way of compiling it
+counted()
+{
+    sed -n 's/.*"dc_instructions": \([0-9]*\), "dc_bytes": \([0-9]*\).*/\1 \2/p' "$1"
+}
+
+./AcDc -O1 ../test/precision.ac $work/plain.dc > /dev/null
+./AcDc -O1 --stats ../test/precision.ac $work/stats.dc 2> $work/stats.err > /dev/null
+plain=$(counted $work/stats.err)
+expect "stats counts the bytes of the target" test "${plain#* }" -eq "$(($(wc -c < $work/plain.dc)))"
+expect "stats counts instructions" test "${plain% *}" -gt 0
+./AcDc -O1 --emit=image ../test/precision.ac $work/precision.img > /dev/null
+for options in "--pipeline" "-j 2" "--cache $work/statscache" "--cache $work/statscache"; do
+    ./AcDc -O1 --stats $options ../test/precision.ac $work/stats.dc 2> $work/stats.err > /dev/null
+    expect "stats $options counts what -O1 writes" test "$(counted $work/stats.err)" = "$plain"
+done
+./AcDc -O1 --stats $work/precision.img $work/stats.dc 2> $work/stats.err > /dev/null
+expect "stats counts the code printed from an image" test "$(counted $work/stats.err)" = "$plain"
+./AcDc -O2 --macros --stats ../test/precision.ac $work/stats.dc 2> $work/stats.err > /dev/null
+macros=$(counted $work/stats.err)
+expect "stats counts the code after the macros" test "${macros#* }" -eq "$(($(wc -c < $work/stats.dc)))"
+printf 'f a\na = 3\np a\na = (3 + 4\n' > $work/late.ac
+for options in "-O1" "--pipeline"; do
+    ./AcDc --stats $options $work/late.ac $work/stats.dc 2> $work/stats.err > /dev/null
+    expect "stats $options counts nothing for a program that failed" test "$(counted $work/stats.err)" = "0 0"
+done
+
+# --trace-alloc: in every way of compiling, the output is the untraced one, every block is counted at a site and released by exit
+traced()
+{
+    awk '/^site /{ table = 1; next } /^phase /{ table = 2; next }
+         /^total /{ total = $2; live = $4; next }
+         table == 1 { sites += $2 }
+         END { exit !(total > 0 && sites == total && live == 0) }' "$1"
+}
+
+for options in "-O0" "-O2 --macros" "-j 2" "--pipeline" "--cache $work/tracecache" "--emit=image" "--eval $work/row.csv"; do
+    ./AcDc $options ../test/precision.ac $work/plain.out > $work/plain.log
+    expect "trace-alloc $options" ./AcDc --trace-alloc $options ../test/precision.ac $work/traced.out 2> $work/trace.err > $work/traced.log
+    expect "trace-alloc $options writes what no tracing does" cmp -s $work/traced.out $work/plain.out
+    expect "trace-alloc $options prints what no tracing does" cmp -s $work/traced.log $work/plain.log
+    expect "trace-alloc $options releases what it allocates" traced $work/trace.err
+done
+expect "trace-alloc of an image" ./AcDc --trace-alloc $work/precision.img $work/traced.out 2> $work/trace.err
+expect "trace-alloc of an image releases what it allocates" traced $work/trace.err
+
+# --serve: the answers to several requests on one connection are what the command line does
+answer()
+{
+    ./AcDc "$@" $work/answer.dc > $work/answer.log
+    status=$?
+    [ $status -eq 0 ] || : > $work/answer.dc
+    echo "$status $(($(wc -c < $work/answer.dc))) $(($(wc -c < $work/answer.log)))"
+    cat $work/answer.dc $work/answer.log
+}
+
+printf 'f a\na = 3 $ 4\np a\n' > $work/bad.ac
+gcc ../test/client.c -o $work/client
+./AcDc --serve $work/socket > /dev/null &
+server=$!
+for options in "-O0" "-O2 --macros"; do
+    for source in ../test/precision.ac $work/bad.ac ../test/sample.ac; do
+        answer $options $source
+    done > $work/expected.answers
+    expect "serve $options" $work/client $work/socket "$options" ../test/precision.ac $work/bad.ac ../test/sample.ac > $work/answers
+    expect "serve $options answers what the command line does" cmp -s $work/answers $work/expected.answers
+done
+kill $server
+
+exit $failed
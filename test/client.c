@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+   A client of AcDc --serve for make check.
+
+   client socket_path options source_file ...
+   sends every source_file on one connection as a request with the
+   options ("-O2 --macros", or "" for none) and writes every answer,
+   the STATUS CODELEN DIAGLEN line and what follows it, to stdout.
+*/
+
+static char *readFile( const char *path, size_t *len )
+{
+    FILE *file = fopen(path, "rb");
+    char *text;
+
+    if(file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    rewind(file);
+    text = malloc(*len + 1);
+    if(fread(text, 1, *len, file) != *len){
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    return text;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct sockaddr_un addr;
+    FILE *in, *out;
+    char header[256], *text;
+    size_t len, codeLength, diagLength, n;
+    int fd, status, i, c, tries;
+
+    if(argc < 4){
+        printf("usage: %s socket_path options source_file ...\n", argv[0]);
+        return 2;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    for(tries = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0; tries++){/* the server may still be starting */
+        if(tries == 100){
+            printf("can't connect to %s\n", argv[1]);
+            return 2;
+        }
+        usleep(50000);
+    }
+    in = fdopen(fd, "r");
+    out = fdopen(dup(fd), "w");
+
+    for(i = 3; i < argc; i++){
+        text = readFile(argv[i], &len);
+        if(text == NULL){
+            printf("can't read %s\n", argv[i]);
+            return 2;
+        }
+        fprintf(out, "%zu %s\n", len, argv[2]);
+        fwrite(text, 1, len, out);
+        fflush(out);
+        free(text);
+
+        if(fgets(header, sizeof(header), in) == NULL ||
+                sscanf(header, "%d %zu %zu", &status, &codeLength, &diagLength) != 3)
+            return 2;
+        fputs(header, stdout);
+        for(n = 0; n < codeLength + diagLength && (c = getc(in)) != EOF; n++)
+            putchar(c);
+    }
+    fclose(out);
+    fclose(in);
+    return 0;
+}